@@ -0,0 +1,212 @@
+/******************************************************************************
+ *  File Name:
+ *    bench_buffer_soak.cpp
+ *
+ *  Description:
+ *    Producer/consumer soak of the pipe send path: pooled buffers of mixed
+ *    sizes passed through the send queue. Counts every global allocation once
+ *    the pool is warm and fails if there are any, then prints the result as a
+ *    JSON line like the other benchmarks.
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include "sim_buffer_pool.hpp"
+#include "sim_queue.hpp"
+
+/*-----------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------*/
+
+static constexpr size_t WARMUP_MESSAGES = 100000;  /**< Sent before counting starts */
+static constexpr size_t SOAK_MESSAGES   = 1000000; /**< Sent while counting allocations */
+static constexpr size_t IN_FLIGHT_LIMIT = 128;     /**< Most messages queued at once, bounds the pool size */
+static constexpr size_t WARM_BUFFERS    = 256;     /**< Per size class, above a thread cache plus IN_FLIGHT_LIMIT */
+
+/*-----------------------------------------------------------------------------
+Private Data
+-----------------------------------------------------------------------------*/
+
+static std::atomic<uint64_t> s_allocations{ 0 };
+static std::atomic<size_t>   s_in_flight{ 0 };
+
+/*-----------------------------------------------------------------------------
+Global Allocator
+-----------------------------------------------------------------------------*/
+
+void *operator new( size_t size )
+{
+  s_allocations.fetch_add( 1, std::memory_order_relaxed );
+  if( void *ptr = malloc( size ? size : 1 ) )
+  {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+
+__attribute__( ( noinline ) ) void operator delete( void *ptr ) noexcept
+{
+  free( ptr );
+}
+
+
+__attribute__( ( noinline ) ) void operator delete( void *ptr, size_t ) noexcept
+{
+  free( ptr );
+}
+
+/*-----------------------------------------------------------------------------
+Private Functions
+-----------------------------------------------------------------------------*/
+
+/**
+ * @brief Picks a message size, mostly small with the odd large one
+ *
+ * @param state   Generator state, advanced on every call
+ * @return size_t Bytes, between 1 and MAX_POOLED_BUFFER
+ */
+static size_t next_size( uint64_t &state )
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+
+  const size_t shift = ( state & 0xFF ) < 240 ? ( state >> 8 ) % 9 : ( state >> 8 ) % 17;
+  const size_t base  = size_t( 1 ) << shift;
+  return std::min( mb::hw::sim::MAX_POOLED_BUFFER, base + ( ( state >> 32 ) % base ) );
+}
+
+
+/**
+ * @brief Sends a run of messages without letting more than IN_FLIGHT_LIMIT queue up
+ *
+ * @param queue   Queue to send on
+ * @param count   Messages to send
+ * @param state   Size generator state
+ */
+static void produce( mb::hw::sim::ThreadSafeQueue<mb::hw::sim::PooledBuffer> &queue, const size_t count, uint64_t &state )
+{
+  for( size_t idx = 0; idx < count; idx++ )
+  {
+    while( s_in_flight.load( std::memory_order_acquire ) >= IN_FLIGHT_LIMIT )
+    {
+      std::this_thread::yield();
+    }
+
+    mb::hw::sim::PooledBuffer buffer( next_size( state ) );
+    memset( buffer.data(), static_cast<int>( idx ), buffer.size() );
+
+    s_in_flight.fetch_add( 1, std::memory_order_acq_rel );
+    queue.push( std::move( buffer ) );
+  }
+
+  while( s_in_flight.load( std::memory_order_acquire ) != 0 )
+  {
+    std::this_thread::yield();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+Public Functions
+-----------------------------------------------------------------------------*/
+
+int main()
+{
+  using namespace mb::hw::sim;
+
+  ThreadSafeQueue<PooledBuffer> queue;
+  uint64_t                      state    = 0x9E3779B97F4A7C15ull;
+  uint64_t                      checksum = 0;
+
+  /*---------------------------------------------------------------------------
+  The consumer stands in for the pipe send thread: pop, read, recycle
+  ---------------------------------------------------------------------------*/
+  size_t classes = 0;
+  for( size_t size = MIN_POOLED_BUFFER; size <= MAX_POOLED_BUFFER; size <<= 1 )
+  {
+    classes++;
+  }
+
+  const size_t total = ( WARM_BUFFERS * classes ) + WARMUP_MESSAGES + SOAK_MESSAGES;
+
+  std::thread consumer( [ &queue, &checksum, total ]() {
+    PooledBuffer buffer;
+    size_t       received = 0;
+    while( received < total )
+    {
+      if( queue.pop( buffer ) )
+      {
+        checksum += buffer.data()[ buffer.size() - 1 ];
+        buffer = PooledBuffer();
+        received++;
+        s_in_flight.fetch_sub( 1, std::memory_order_acq_rel );
+      }
+    }
+  } );
+
+  /*---------------------------------------------------------------------------
+  Rare large messages would take a long time to grow their size class to its
+  working set, so hand every class more buffers than it can ever have in use:
+  the consumer's thread cache plus everything in flight. The consumer keeps
+  some and spills the rest to the shared lists for the producer.
+  ---------------------------------------------------------------------------*/
+  for( size_t size = MIN_POOLED_BUFFER; size <= MAX_POOLED_BUFFER; size <<= 1 )
+  {
+    std::vector<PooledBuffer> held;
+    held.reserve( WARM_BUFFERS );
+    for( size_t idx = 0; idx < WARM_BUFFERS; idx++ )
+    {
+      held.emplace_back( size );
+      held.back().data()[ size - 1 ] = 0;
+    }
+
+    s_in_flight.fetch_add( held.size(), std::memory_order_acq_rel );
+    for( auto &buffer : held )
+    {
+      queue.push( std::move( buffer ) );
+    }
+  }
+
+  produce( queue, WARMUP_MESSAGES, state );
+
+  /*---------------------------------------------------------------------------
+  Everything from here on should be served by the warm pool and queue
+  ---------------------------------------------------------------------------*/
+  const uint64_t allocs_before = s_allocations.load();
+  const auto     pool_before   = getBufferPoolStats();
+  const auto     start         = std::chrono::steady_clock::now();
+
+  produce( queue, SOAK_MESSAGES, state );
+
+  const auto     stop         = std::chrono::steady_clock::now();
+  const uint64_t allocs_after = s_allocations.load();
+  const auto     pool_after   = getBufferPoolStats();
+
+  consumer.join();
+
+  const double   elapsed_ns = std::chrono::duration<double, std::nano>( stop - start ).count();
+  const uint64_t allocs     = allocs_after - allocs_before;
+
+  printf( "{\"bench\":\"buffer_soak\",\"messages\":%zu,\"ns_per_msg\":%.1f,\"allocations\":%llu,"
+          "\"pool_system_allocs\":%llu,\"checksum\":%llu}\n",
+          SOAK_MESSAGES, elapsed_ns / static_cast<double>( SOAK_MESSAGES ),
+          static_cast<unsigned long long>( allocs ),
+          static_cast<unsigned long long>( pool_after.system_allocs - pool_before.system_allocs ),
+          static_cast<unsigned long long>( checksum ) );
+
+  return ( allocs == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
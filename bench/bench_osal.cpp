@@ -0,0 +1,463 @@
+/******************************************************************************
+ *  File Name:
+ *    bench_osal.cpp
+ *
+ *  Description:
+ *    Microbenchmarks of the simulated OSAL primitives. Each result is printed
+ *    as one JSON object per line so runs can be diffed by scripts.
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mbedutils/drivers/threading/thread.hpp>
+#include <mbedutils/interfaces/mutex_intf.hpp>
+#include <mbedutils/interfaces/smphr_intf.hpp>
+#include <mbedutils/interfaces/time_intf.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_timer.hpp"
+
+/*-----------------------------------------------------------------------------
+Constants
+-----------------------------------------------------------------------------*/
+
+static constexpr size_t             BATCH_SIZE     = 1000;  /**< Calls timed together for cheap operations */
+static constexpr size_t             BATCH_COUNT    = 2000;  /**< Samples collected per cheap operation */
+static constexpr size_t             CONTENDED_OPS  = 20000; /**< Lock cycles per thread in contended runs */
+static constexpr size_t             PING_PONG_OPS  = 20000; /**< Round trips in the semaphore ping-pong */
+static constexpr size_t             DELAY_SAMPLES  = 200;   /**< Sleeps measured per requested duration */
+static constexpr size_t             SPAWN_SAMPLES  = 32;    /**< Tasks created in the start-up latency run */
+static constexpr mb::thread::TaskId TASK_ID_BASE   = 0x4000;
+static constexpr int64_t            CANCEL_TIMEOUT = 1000000000LL;
+
+/*-----------------------------------------------------------------------------
+Aliases
+-----------------------------------------------------------------------------*/
+
+using LockFunc = void ( * )( void * );
+
+/*-----------------------------------------------------------------------------
+Private Functions
+-----------------------------------------------------------------------------*/
+
+static inline int64_t now_ns()
+{
+  return mb::time::sim::monotonic_ns();
+}
+
+
+/**
+ * @brief Prints the distribution of a set of samples as a single JSON line
+ *
+ * @param name      Benchmark name
+ * @param threads   Threads involved in the measurement
+ * @param unit      Unit of the samples
+ * @param samples   Measurements, sorted in place
+ */
+static void report( const char *name, const size_t threads, const char *unit, std::vector<double> &samples )
+{
+  if( samples.empty() )
+  {
+    return;
+  }
+
+  std::sort( samples.begin(), samples.end() );
+
+  double sum = 0.0;
+  for( const double sample : samples )
+  {
+    sum += sample;
+  }
+
+  auto pct = [ &samples ]( const double q ) {
+    return samples[ std::min( samples.size() - 1, static_cast<size_t>( q * static_cast<double>( samples.size() ) ) ) ];
+  };
+
+  printf( "{\"bench\":\"%s\",\"threads\":%zu,\"unit\":\"%s\",\"samples\":%zu,\"min\":%.1f,\"p50\":%.1f,\"p99\":%.1f,"
+          "\"max\":%.1f,\"mean\":%.1f}\n",
+          name, threads, unit, samples.size(), samples.front(), pct( 0.50 ), pct( 0.99 ), samples.back(),
+          sum / static_cast<double>( samples.size() ) );
+  fflush( stdout );
+}
+
+
+/**
+ * @brief Times an operation that is too cheap to measure one call at a time
+ *
+ * @param name      Benchmark name
+ * @param op        Operation to run, called BATCH_SIZE times per sample
+ */
+template<typename Op>
+static void run_batched( const char *name, Op &&op )
+{
+  std::vector<double> samples;
+  samples.reserve( BATCH_COUNT );
+
+  for( size_t batch = 0; batch < BATCH_COUNT; batch++ )
+  {
+    const int64_t start = now_ns();
+    for( size_t idx = 0; idx < BATCH_SIZE; idx++ )
+    {
+      op();
+    }
+    samples.push_back( static_cast<double>( now_ns() - start ) / static_cast<double>( BATCH_SIZE ) );
+  }
+
+  report( name, 1, "ns/op", samples );
+}
+
+
+/**
+ * @brief Hammers one lock from several threads, timing every acquisition
+ *
+ * @param name      Benchmark name
+ * @param threads   Number of competing threads
+ * @param handle    Lock under test
+ * @param lock      Acquires the lock
+ * @param unlock    Releases the lock
+ */
+static void run_contended( const char *name, const size_t threads, void *handle, LockFunc lock, LockFunc unlock )
+{
+  std::vector<std::vector<double>> per_thread( threads );
+  std::vector<std::thread>         workers;
+  std::atomic<size_t>              ready{ 0 };
+  std::atomic<bool>                go{ false };
+
+  for( size_t tid = 0; tid < threads; tid++ )
+  {
+    workers.emplace_back( [ &, tid ] {
+      auto &samples = per_thread[ tid ];
+      samples.reserve( CONTENDED_OPS );
+
+      ready.fetch_add( 1 );
+      while( !go.load() )
+      {
+        std::this_thread::yield();
+      }
+
+      for( size_t idx = 0; idx < CONTENDED_OPS; idx++ )
+      {
+        const int64_t start = now_ns();
+        lock( handle );
+        samples.push_back( static_cast<double>( now_ns() - start ) );
+        unlock( handle );
+      }
+    } );
+  }
+
+  while( ready.load() != threads )
+  {
+    std::this_thread::yield();
+  }
+
+  go.store( true );
+  for( auto &worker : workers )
+  {
+    worker.join();
+  }
+
+  std::vector<double> samples;
+  for( auto &set : per_thread )
+  {
+    samples.insert( samples.end(), set.begin(), set.end() );
+  }
+
+  report( name, threads, "ns/lock", samples );
+}
+
+
+static void bench_mutex( const size_t max_threads )
+{
+  mb::osal::mb_mutex_t           mtx  = nullptr;
+  mb::osal::mb_recursive_mutex_t rmtx = nullptr;
+
+  if( !mb::osal::createMutex( mtx ) || !mb::osal::createRecursiveMutex( rmtx ) )
+  {
+    fprintf( stderr, "Unable to create the benchmark mutexes\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  run_batched( "mutex_uncontended", [ mtx ] {
+    mb::osal::lockMutex( mtx );
+    mb::osal::unlockMutex( mtx );
+  } );
+
+  run_batched( "rmutex_uncontended", [ rmtx ] {
+    mb::osal::lockRecursiveMutex( rmtx );
+    mb::osal::unlockRecursiveMutex( rmtx );
+  } );
+
+  run_batched( "rmutex_nested_depth2", [ rmtx ] {
+    mb::osal::lockRecursiveMutex( rmtx );
+    mb::osal::lockRecursiveMutex( rmtx );
+    mb::osal::unlockRecursiveMutex( rmtx );
+    mb::osal::unlockRecursiveMutex( rmtx );
+  } );
+
+  /*---------------------------------------------------------------------------
+  Powers of two up to the limit, and always the limit itself
+  ---------------------------------------------------------------------------*/
+  std::vector<size_t> thread_counts;
+  for( size_t threads = 2; threads < max_threads; threads *= 2 )
+  {
+    thread_counts.push_back( threads );
+  }
+  thread_counts.push_back( max_threads );
+
+  for( const size_t threads : thread_counts )
+  {
+    run_contended( "mutex_contended", threads, mtx, []( void *h ) { mb::osal::lockMutex( h ); },
+                   []( void *h ) { mb::osal::unlockMutex( h ); } );
+    run_contended( "rmutex_contended", threads, rmtx, []( void *h ) { mb::osal::lockRecursiveMutex( h ); },
+                   []( void *h ) { mb::osal::unlockRecursiveMutex( h ); } );
+  }
+
+  mb::osal::destroyMutex( mtx );
+  mb::osal::destroyRecursiveMutex( rmtx );
+}
+
+
+/**
+ * @brief Bounces a token between two threads through a pair of semaphores
+ */
+static void bench_smphr()
+{
+  mb::osal::mb_smphr_t ping = nullptr;
+  mb::osal::mb_smphr_t pong = nullptr;
+
+  if( !mb::osal::createSmphr( ping, 1, 0 ) || !mb::osal::createSmphr( pong, 1, 0 ) )
+  {
+    fprintf( stderr, "Unable to create the benchmark semaphores\n" );
+    exit( EXIT_FAILURE );
+  }
+
+  run_batched( "smphr_release_acquire", [ &ping ] {
+    mb::osal::releaseSmphr( ping );
+    mb::osal::acquireSmphr( ping );
+  } );
+
+  std::thread responder( [ &ping, &pong ] {
+    for( size_t idx = 0; idx < PING_PONG_OPS; idx++ )
+    {
+      mb::osal::acquireSmphr( ping );
+      mb::osal::releaseSmphr( pong );
+    }
+  } );
+
+  std::vector<double> samples;
+  samples.reserve( PING_PONG_OPS );
+
+  for( size_t idx = 0; idx < PING_PONG_OPS; idx++ )
+  {
+    const int64_t start = now_ns();
+    mb::osal::releaseSmphr( ping );
+    mb::osal::acquireSmphr( pong );
+    samples.push_back( static_cast<double>( now_ns() - start ) );
+  }
+
+  responder.join();
+  report( "smphr_ping_pong", 2, "ns/round_trip", samples );
+
+  mb::osal::destroySmphr( ping );
+  mb::osal::destroySmphr( pong );
+}
+
+
+static void idle_task( void *arg )
+{
+  ( void )arg;
+}
+
+
+/**
+ * @brief Stamps the host time the task first ran at
+ *
+ * @param arg   std::atomic<int64_t> to store the time in
+ */
+static void stamp_task( void *arg )
+{
+  static_cast<std::atomic<int64_t> *>( arg )->store( now_ns() );
+}
+
+
+/**
+ * @brief Registers a task with the simulator without starting it
+ *
+ * @param id        Unique task id
+ * @param func      Task body
+ * @param arg       Argument for the task body
+ * @return true     The task was created
+ */
+static bool spawn_task( const mb::thread::TaskId id, void ( *func )( void * ) = idle_task, void *arg = nullptr )
+{
+  mb::thread::Task::Config cfg = {};
+  cfg.id        = id;
+  cfg.name      = "bench";
+  cfg.func      = func;
+  cfg.user_data = arg;
+
+  return mb::thread::intf::create_task( cfg ) == id;
+}
+
+
+/**
+ * @brief Times task registration, then the latency from starting the
+ * scheduler to the first instruction of a task.
+ */
+static void bench_task_create()
+{
+  std::vector<double> samples;
+  samples.reserve( SPAWN_SAMPLES );
+
+  for( size_t idx = 0; idx < SPAWN_SAMPLES; idx++ )
+  {
+    const int64_t start = now_ns();
+    if( !spawn_task( TASK_ID_BASE + static_cast<mb::thread::TaskId>( idx ) ) )
+    {
+      fprintf( stderr, "Unable to create benchmark task %zu\n", idx );
+      exit( EXIT_FAILURE );
+    }
+    samples.push_back( static_cast<double>( now_ns() - start ) / 1000.0 );
+  }
+
+  report( "create_task", 1, "us", samples );
+  mb::thread::sim::cancelAllTasks( CANCEL_TIMEOUT );
+
+  samples.clear();
+  for( size_t idx = 0; idx < SPAWN_SAMPLES; idx++ )
+  {
+    std::atomic<int64_t> first_run{ 0 };
+    if( !spawn_task( TASK_ID_BASE, stamp_task, &first_run ) )
+    {
+      fprintf( stderr, "Unable to create benchmark task %zu\n", idx );
+      exit( EXIT_FAILURE );
+    }
+
+    const int64_t start = now_ns();
+    mb::thread::intf::start_scheduler();
+    while( !first_run.load() )
+    {
+      std::this_thread::yield();
+    }
+
+    samples.push_back( static_cast<double>( first_run.load() - start ) / 1000.0 );
+    mb::thread::sim::cancelAllTasks( CANCEL_TIMEOUT );
+  }
+
+  report( "task_start_latency", 1, "us", samples );
+  mb::time::sim::stopTimerService();
+}
+
+
+/**
+ * @brief Measures task lookups as the task table grows. Called from a
+ * non-task thread, so every lookup walks the whole table.
+ */
+static void bench_task_lookup()
+{
+  static const size_t task_counts[] = { 1, 8, 32, 128 };
+
+  mb::thread::TaskId next_id = TASK_ID_BASE;
+  char               name[ 64 ];
+
+  for( const size_t count : task_counts )
+  {
+    while( ( next_id - TASK_ID_BASE ) < count )
+    {
+      if( !spawn_task( next_id++ ) )
+      {
+        fprintf( stderr, "Unable to create benchmark task %u\n", static_cast<unsigned>( next_id - 1 ) );
+        exit( EXIT_FAILURE );
+      }
+    }
+
+    snprintf( name, sizeof( name ), "this_thread_id_tasks_%zu", count );
+    run_batched( name, [] {
+      volatile mb::thread::TaskId id = mb::thread::this_thread::id();
+      ( void )id;
+    } );
+
+    snprintf( name, sizeof( name ), "this_thread_get_name_tasks_%zu", count );
+    run_batched( name, [] {
+      auto task_name = mb::thread::this_thread::get_name();
+      ( void )task_name;
+    } );
+  }
+
+  mb::thread::sim::cancelAllTasks( CANCEL_TIMEOUT );
+}
+
+
+static void bench_time()
+{
+  run_batched( "millis", [] {
+    volatile int64_t value = mb::time::millis();
+    ( void )value;
+  } );
+
+  run_batched( "micros", [] {
+    volatile int64_t value = mb::time::micros();
+    ( void )value;
+  } );
+
+  /*---------------------------------------------------------------------------
+  Report how late each delay finished, in host time
+  ---------------------------------------------------------------------------*/
+  static const size_t delays_us[] = { 10, 100, 1000 };
+  char                name[ 64 ];
+
+  for( const size_t delay : delays_us )
+  {
+    const int64_t       requested_ns = mb::time::sim::toHostNanos( static_cast<int64_t>( delay ) * 1000LL );
+    std::vector<double> samples;
+    samples.reserve( DELAY_SAMPLES );
+
+    for( size_t idx = 0; idx < DELAY_SAMPLES; idx++ )
+    {
+      const int64_t start = now_ns();
+      mb::time::delayMicroseconds( delay );
+      samples.push_back( static_cast<double>( now_ns() - start - requested_ns ) );
+    }
+
+    snprintf( name, sizeof( name ), "delay_us_%zu_error", delay );
+    report( name, 1, "ns", samples );
+  }
+}
+
+/*-----------------------------------------------------------------------------
+Public Functions
+-----------------------------------------------------------------------------*/
+
+int main( int argc, char **argv )
+{
+  /*---------------------------------------------------------------------------
+  Optional argument: most threads to use in the contended runs
+  ---------------------------------------------------------------------------*/
+  size_t max_threads = std::max<size_t>( 2, std::thread::hardware_concurrency() );
+  if( argc > 1 )
+  {
+    max_threads = std::max<size_t>( 2, strtoul( argv[ 1 ], nullptr, 10 ) );
+  }
+
+  mb::osal::initMutexDriver();
+  mb::osal::initSmphrDriver();
+  mb::thread::intf::driver_setup();
+
+  bench_mutex( max_threads );
+  bench_smphr();
+  bench_time();
+  bench_task_create();
+  bench_task_lookup();
+
+  return EXIT_SUCCESS;
+}
@@ -11,33 +11,233 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <mbedutils/drivers/system/atexit.hpp>
+#include <mbedutils/logging.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sim_atexit.hpp"
+#include "sim_time.hpp"
+
+namespace mb::system::atexit::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct Registration
+  {
+    Callback *handle;   /**< Identity of the callback, as passed to registerCallback() */
+    Callback  callback; /**< Copy that is actually invoked */
+    uint32_t  priority;
+  };
+
+  /**
+   * @brief Completion tracking of one priority level during exit()
+   */
+  struct LevelRun
+  {
+    std::mutex              mtx;
+    std::condition_variable cv;
+    size_t                  remaining;
+    std::vector<bool>       done;
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::mutex                                         s_registry_lock;
+  static std::vector<Registration>                          s_registry;
+  static std::unordered_map<const Callback *, const char *> s_tags;
+  static std::atomic<uint32_t>                              s_deadline_ms{ DEFAULT_LEVEL_DEADLINE_MS };
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Builds the name a callback is reported under
+   */
+  static std::string label_of( const Callback *handle )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+
+    auto iter = s_tags.find( handle );
+    if( iter != s_tags.end() )
+    {
+      return iter->second;
+    }
+
+    char buffer[ 32 ];
+    snprintf( buffer, sizeof( buffer ), "%p", static_cast<const void *>( handle ) );
+    return buffer;
+  }
+
+
+  /**
+   * @brief Runs every callback of one priority level concurrently
+   *
+   * @param first     First registration of the level
+   * @param last      One past the last registration of the level
+   */
+  static void run_level( std::vector<Registration>::iterator first, std::vector<Registration>::iterator last )
+  {
+    const uint32_t priority    = first->priority;
+    const uint32_t deadline_ms = s_deadline_ms.load();
+    const size_t   count       = static_cast<size_t>( std::distance( first, last ) );
+
+    auto run = std::make_shared<LevelRun>();
+    run->remaining = count;
+    run->done.assign( count, false );
+
+    std::vector<std::thread> workers;
+    workers.reserve( count );
+
+    for( size_t idx = 0; idx < count; idx++ )
+    {
+      const Registration &reg = first[ idx ];
+      workers.emplace_back( [ run, idx, reg, priority, deadline_ms ] {
+        const int64_t start = mb::time::sim::monotonic_ns();
+        reg.callback();
+        const int64_t elapsed_ms = ( mb::time::sim::monotonic_ns() - start ) / 1000000LL;
+
+        if( elapsed_ms > static_cast<int64_t>( deadline_ms ) )
+        {
+          LOG_ERROR( "atexit callback %s at priority %u took %lld ms, over the %u ms deadline",
+                     label_of( reg.handle ).c_str(), priority, static_cast<long long>( elapsed_ms ), deadline_ms );
+        }
+
+        std::lock_guard<std::mutex> lock( run->mtx );
+        run->done[ idx ] = true;
+        run->remaining--;
+        run->cv.notify_all();
+      } );
+    }
+
+    /*-------------------------------------------------------------------------
+    Wait out the deadline, then abandon whatever is still running
+    -------------------------------------------------------------------------*/
+    std::vector<bool> done;
+    {
+      std::unique_lock<std::mutex> lock( run->mtx );
+      run->cv.wait_for( lock, std::chrono::milliseconds( deadline_ms ), [ &run ] { return run->remaining == 0; } );
+      done = run->done;
+    }
+
+    for( size_t idx = 0; idx < count; idx++ )
+    {
+      if( done[ idx ] )
+      {
+        workers[ idx ].join();
+        continue;
+      }
+
+      LOG_ERROR( "atexit callback %s at priority %u still running after %u ms, moving on",
+                 label_of( first[ idx ].handle ).c_str(), priority, deadline_ms );
+      workers[ idx ].detach();
+    }
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void setLevelDeadline( const uint32_t timeout_ms )
+  {
+    s_deadline_ms.store( timeout_ms );
+  }
+
+
+  void tagCallback( mb::system::atexit::Callback &callback, const char *tag )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+    s_tags[ &callback ] = tag;
+  }
+}    // namespace mb::system::atexit::sim
+
 
 namespace mb::system::atexit
 {
+  using namespace mb::system::atexit::sim;
+
   /*---------------------------------------------------------------------------
   Public Functions
   ---------------------------------------------------------------------------*/
 
   void initialize()
   {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+    s_registry.clear();
   }
 
 
   bool registerCallback( mb::system::atexit::Callback &callback, uint32_t priority )
   {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+
+    auto iter = std::find_if( s_registry.begin(), s_registry.end(),
+                              [ &callback ]( const Registration &reg ) { return reg.handle == &callback; } );
+    if( iter != s_registry.end() )
+    {
+      return false;
+    }
+
+    s_registry.push_back( Registration{ &callback, callback, priority } );
     return true;
   }
 
 
   bool unregisterCallback( mb::system::atexit::Callback &callback )
   {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+
+    auto iter = std::find_if( s_registry.begin(), s_registry.end(),
+                              [ &callback ]( const Registration &reg ) { return reg.handle == &callback; } );
+    if( iter == s_registry.end() )
+    {
+      return false;
+    }
+
+    s_registry.erase( iter );
     return true;
   }
 
 
   void exit()
   {
+    /*-------------------------------------------------------------------------
+    Take ownership of the registry so every callback runs at most once
+    -------------------------------------------------------------------------*/
+    std::vector<Registration> pending;
+    {
+      std::lock_guard<std::mutex> lock( s_registry_lock );
+      pending.swap( s_registry );
+    }
+
+    /*-------------------------------------------------------------------------
+    Highest priority first. Within a level, registration order is kept even
+    though the callbacks then run concurrently.
+    -------------------------------------------------------------------------*/
+    std::stable_sort( pending.begin(), pending.end(),
+                      []( const Registration &lhs, const Registration &rhs ) { return lhs.priority > rhs.priority; } );
+
+    auto first = pending.begin();
+    while( first != pending.end() )
+    {
+      auto last = std::find_if( first, pending.end(),
+                                [ first ]( const Registration &reg ) { return reg.priority != first->priority; } );
+      run_level( first, last );
+      first = last;
+    }
   }
 
 }    // namespace mb::system::atexit
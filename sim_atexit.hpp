@@ -0,0 +1,57 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_atexit.hpp
+ *
+ *  Description:
+ *    Simulator specific interface to the atexit driver
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_ATEXIT_HPP
+#define MBEDUTILS_SIM_ATEXIT_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstdint>
+#include <mbedutils/drivers/system/atexit.hpp>
+
+namespace mb::system::atexit::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Time each priority level gets to finish during exit() by default
+   */
+  static constexpr uint32_t DEFAULT_LEVEL_DEADLINE_MS = 100;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Sets how long exit() waits on each priority level.
+   *
+   * Callbacks of one level run concurrently, each on its own thread. Once the
+   * deadline passes, exit() reports every callback still running and moves
+   * on to the next level without waiting for them.
+   *
+   * @param timeout_ms  Deadline of a single priority level
+   */
+  void setLevelDeadline( const uint32_t timeout_ms );
+
+  /**
+   * @brief Attaches a name to a callback so it is identifiable in overrun reports
+   *
+   * @param callback  Callback to tag, identified by its address
+   * @param tag       String with static storage duration
+   */
+  void tagCallback( mb::system::atexit::Callback &callback, const char *tag );
+
+}    // namespace mb::system::atexit::sim
+
+#endif /* !MBEDUTILS_SIM_ATEXIT_HPP */
@@ -0,0 +1,345 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_buffer_pool.cpp
+ *
+ *  Description:
+ *    Recycled message buffers for the simulator IO paths
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include "sim_buffer_pool.hpp"
+
+namespace mb::hw::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t   CLASS_COUNT    = 11;   /**< 64 bytes through 64 KiB in powers of two */
+  static constexpr uint32_t OVERSIZE_CLASS = 0xFF; /**< Marks blocks owned by the system allocator */
+  static constexpr size_t   CACHE_LIMIT    = 64;   /**< Free buffers a thread keeps per class */
+  static constexpr size_t   TRANSFER_BATCH = 16;   /**< Buffers moved per trip to the shared lists */
+
+  static_assert( ( MIN_POOLED_BUFFER << ( CLASS_COUNT - 1 ) ) == MAX_POOLED_BUFFER );
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Bookkeeping in front of every buffer. Sized to keep the data 16 byte aligned.
+   */
+  struct alignas( 16 ) BlockHeader
+  {
+    BlockHeader *next;
+    uint32_t     size_class;
+    uint32_t     capacity;
+  };
+
+  static_assert( sizeof( BlockHeader ) == 16 );
+
+  struct FreeList
+  {
+    BlockHeader *head  = nullptr;
+    size_t       count = 0;
+  };
+
+  struct SharedList
+  {
+    std::mutex lock;
+    FreeList   list;
+  };
+
+  /**
+   * @brief Per-thread stash of free buffers, returned to the shared lists when the thread exits
+   */
+  struct ThreadCache
+  {
+    std::array<FreeList, CLASS_COUNT> lists;
+
+    ~ThreadCache();
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::atomic<uint64_t> s_acquired{ 0 };
+  static std::atomic<uint64_t> s_thread_hits{ 0 };
+  static std::atomic<uint64_t> s_shared_hits{ 0 };
+  static std::atomic<uint64_t> s_system_allocs{ 0 };
+  static std::atomic<uint64_t> s_oversize{ 0 };
+
+  static thread_local ThreadCache tls_cache;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Shared free lists. Never destroyed, threads may still exit after static destruction.
+   */
+  static std::array<SharedList, CLASS_COUNT> &shared_lists()
+  {
+    static auto *s_lists = new std::array<SharedList, CLASS_COUNT>();
+    return *s_lists;
+  }
+
+
+  static inline size_t class_of( const size_t size )
+  {
+    size_t idx = 0;
+    while( ( MIN_POOLED_BUFFER << idx ) < size )
+    {
+      idx++;
+    }
+
+    return idx;
+  }
+
+
+  static inline BlockHeader *header_of( void *data )
+  {
+    return reinterpret_cast<BlockHeader *>( static_cast<uint8_t *>( data ) - sizeof( BlockHeader ) );
+  }
+
+
+  static inline uint8_t *data_of( BlockHeader *block )
+  {
+    return reinterpret_cast<uint8_t *>( block + 1 );
+  }
+
+
+  static BlockHeader *system_alloc( const uint32_t size_class, const size_t capacity )
+  {
+    s_system_allocs.fetch_add( 1, std::memory_order_relaxed );
+
+    auto block        = static_cast<BlockHeader *>( ::operator new( sizeof( BlockHeader ) + capacity ) );
+    block->next       = nullptr;
+    block->size_class = size_class;
+    block->capacity   = static_cast<uint32_t>( capacity );
+    return block;
+  }
+
+
+  /**
+   * @brief Moves up to count buffers from one list to another
+   */
+  static void transfer( FreeList &from, FreeList &to, size_t count )
+  {
+    while( count-- && from.head )
+    {
+      BlockHeader *block = from.head;
+      from.head          = block->next;
+      from.count--;
+
+      block->next = to.head;
+      to.head     = block;
+      to.count++;
+    }
+  }
+
+
+  static uint8_t *acquire( const size_t size )
+  {
+    s_acquired.fetch_add( 1, std::memory_order_relaxed );
+
+    if( size > MAX_POOLED_BUFFER )
+    {
+      s_oversize.fetch_add( 1, std::memory_order_relaxed );
+      return data_of( system_alloc( OVERSIZE_CLASS, size ) );
+    }
+
+    const size_t idx   = class_of( size );
+    FreeList    &local = tls_cache.lists[ idx ];
+
+    if( local.head )
+    {
+      s_thread_hits.fetch_add( 1, std::memory_order_relaxed );
+    }
+    else
+    {
+      SharedList &shared = shared_lists()[ idx ];
+      {
+        std::lock_guard<std::mutex> lock( shared.lock );
+        transfer( shared.list, local, TRANSFER_BATCH );
+      }
+
+      if( !local.head )
+      {
+        return data_of( system_alloc( static_cast<uint32_t>( idx ), MIN_POOLED_BUFFER << idx ) );
+      }
+
+      s_shared_hits.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    BlockHeader *block = local.head;
+    local.head         = block->next;
+    local.count--;
+    return data_of( block );
+  }
+
+
+  static void release( void *data )
+  {
+    BlockHeader *block = header_of( data );
+
+    if( block->size_class == OVERSIZE_CLASS )
+    {
+      ::operator delete( block );
+      return;
+    }
+
+    FreeList &local = tls_cache.lists[ block->size_class ];
+    block->next     = local.head;
+    local.head      = block;
+    local.count++;
+
+    /*-------------------------------------------------------------------------
+    Threads that only ever free, like the ZMQ IO thread, would hoard buffers
+    -------------------------------------------------------------------------*/
+    if( local.count > CACHE_LIMIT )
+    {
+      SharedList                 &shared = shared_lists()[ block->size_class ];
+      std::lock_guard<std::mutex> lock( shared.lock );
+      transfer( local, shared.list, CACHE_LIMIT / 2 );
+    }
+  }
+
+
+  ThreadCache::~ThreadCache()
+  {
+    for( size_t idx = 0; idx < CLASS_COUNT; idx++ )
+    {
+      SharedList                 &shared = shared_lists()[ idx ];
+      std::lock_guard<std::mutex> lock( shared.lock );
+      transfer( lists[ idx ], shared.list, lists[ idx ].count );
+    }
+  }
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  PooledBuffer::PooledBuffer( const size_t size ) : data_( acquire( size ) ), size_( size )
+  {
+  }
+
+
+  PooledBuffer::PooledBuffer( const void *data, const size_t size ) : PooledBuffer( size )
+  {
+    if( size )
+    {
+      memcpy( data_, data, size );
+    }
+  }
+
+
+  PooledBuffer::~PooledBuffer()
+  {
+    if( data_ )
+    {
+      release( data_ );
+    }
+  }
+
+
+  PooledBuffer::PooledBuffer( PooledBuffer &&other ) noexcept : data_( other.data_ ), size_( other.size_ )
+  {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+
+  PooledBuffer &PooledBuffer::operator=( PooledBuffer &&other ) noexcept
+  {
+    if( this != &other )
+    {
+      if( data_ )
+      {
+        release( data_ );
+      }
+
+      data_       = other.data_;
+      size_       = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+
+    return *this;
+  }
+
+
+  uint8_t *PooledBuffer::data()
+  {
+    return data_;
+  }
+
+
+  const uint8_t *PooledBuffer::data() const
+  {
+    return data_;
+  }
+
+
+  size_t PooledBuffer::size() const
+  {
+    return size_;
+  }
+
+
+  size_t PooledBuffer::capacity() const
+  {
+    return data_ ? header_of( data_ )->capacity : 0;
+  }
+
+
+  bool PooledBuffer::empty() const
+  {
+    return size_ == 0;
+  }
+
+
+  uint8_t *PooledBuffer::detach()
+  {
+    uint8_t *memory = data_;
+    data_           = nullptr;
+    size_           = 0;
+    return memory;
+  }
+
+
+  void PooledBuffer::recycle( void *memory )
+  {
+    if( memory )
+    {
+      release( memory );
+    }
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  BufferPoolStats getBufferPoolStats()
+  {
+    BufferPoolStats stats;
+    stats.acquired      = s_acquired.load();
+    stats.thread_hits   = s_thread_hits.load();
+    stats.shared_hits   = s_shared_hits.load();
+    stats.system_allocs = s_system_allocs.load();
+    stats.oversize      = s_oversize.load();
+
+    return stats;
+  }
+
+}    // namespace mb::hw::sim
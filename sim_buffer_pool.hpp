@@ -0,0 +1,120 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_buffer_pool.hpp
+ *
+ *  Description:
+ *    Recycled message buffers for the simulator IO paths
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_BUFFER_POOL_HPP
+#define MBEDUTILS_SIM_BUFFER_POOL_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+
+namespace mb::hw::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t MIN_POOLED_BUFFER = 64;        /**< Smallest size class */
+  static constexpr size_t MAX_POOLED_BUFFER = 64 * 1024; /**< Larger requests go straight to the system */
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct BufferPoolStats
+  {
+    uint64_t acquired;      /**< Buffers handed out */
+    uint64_t thread_hits;   /**< Served from the calling thread's cache */
+    uint64_t shared_hits;   /**< Served by refilling from the shared free lists */
+    uint64_t system_allocs; /**< Fell back to the system allocator */
+    uint64_t oversize;      /**< Requests above MAX_POOLED_BUFFER, included in system_allocs */
+  };
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Byte buffer drawn from a size-classed, thread-caching pool.
+   *
+   * Each thread keeps a small stack of free buffers per size class and only
+   * touches the shared, locked free lists to refill or spill in batches. Once
+   * the pool is warm, passing messages around costs no system allocations.
+   */
+  class PooledBuffer
+  {
+  public:
+    PooledBuffer() = default;
+
+    /**
+     * @brief Acquires a buffer of the given size. Contents are uninitialized.
+     *
+     * @param size    Bytes needed
+     */
+    explicit PooledBuffer( const size_t size );
+
+    /**
+     * @brief Acquires a buffer holding a copy of the given bytes
+     *
+     * @param data    Bytes to copy
+     * @param size    Number of bytes
+     */
+    PooledBuffer( const void *data, const size_t size );
+
+    ~PooledBuffer();
+
+    PooledBuffer( PooledBuffer &&other ) noexcept;
+    PooledBuffer &operator=( PooledBuffer &&other ) noexcept;
+
+    PooledBuffer( const PooledBuffer & )            = delete;
+    PooledBuffer &operator=( const PooledBuffer & ) = delete;
+
+    uint8_t       *data();
+    const uint8_t *data() const;
+    size_t         size() const;
+    size_t         capacity() const;
+    bool           empty() const;
+
+    /**
+     * @brief Gives up ownership so the memory can outlive this object, e.g. inside a ZMQ message
+     *
+     * @return uint8_t*   Memory to hand back later with PooledBuffer::recycle()
+     */
+    uint8_t *detach();
+
+    /**
+     * @brief Returns memory obtained from detach() to the pool. Safe from any thread.
+     *
+     * @param memory  Pointer returned by detach()
+     */
+    static void recycle( void *memory );
+
+  private:
+    uint8_t *data_ = nullptr;
+    size_t   size_ = 0;
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Gets the usage counters of the message buffer pool
+   *
+   * @return BufferPoolStats
+   */
+  BufferPoolStats getBufferPoolStats();
+
+}    // namespace mb::hw::sim
+
+#endif /* !MBEDUTILS_SIM_BUFFER_POOL_HPP */
@@ -0,0 +1,95 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_futex.hpp
+ *
+ *  Description:
+ *    Thin wrappers around the Linux futex syscall for simulator primitives
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_FUTEX_HPP
+#define MBEDUTILS_SIM_FUTEX_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace mb::hw::sim::futex
+{
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Sleeps while the word still holds the expected value.
+   *
+   * @param word      Futex word to wait on
+   * @param expected  Value the word must hold for the caller to sleep
+   * @param deadline  Absolute CLOCK_MONOTONIC timeout, or nullptr to wait forever
+   * @param shared    True if the word lives in memory shared with other processes
+   * @return int      0 when woken, otherwise the errno (EAGAIN, ETIMEDOUT, EINTR)
+   */
+  static inline int wait( std::atomic<uint32_t> *word, const uint32_t expected, const timespec *deadline = nullptr,
+                          const bool shared = false )
+  {
+    static_assert( sizeof( std::atomic<uint32_t> ) == sizeof( uint32_t ), "Futex word must be 32 bits" );
+
+    const int  op = FUTEX_WAIT_BITSET | ( shared ? 0 : FUTEX_PRIVATE_FLAG );
+    const long rc = ::syscall( SYS_futex, reinterpret_cast<uint32_t *>( word ), op, expected, deadline, nullptr,
+                               FUTEX_BITSET_MATCH_ANY );
+    return ( rc == 0 ) ? 0 : errno;
+  }
+
+  /**
+   * @brief Wakes up to the given number of threads sleeping on the word
+   *
+   * @param word    Futex word
+   * @param count   Max number of waiters to wake
+   * @param shared  True if the word lives in memory shared with other processes
+   */
+  static inline void wake( std::atomic<uint32_t> *word, const int count = 1, const bool shared = false )
+  {
+    const int op = FUTEX_WAKE | ( shared ? 0 : FUTEX_PRIVATE_FLAG );
+    ::syscall( SYS_futex, reinterpret_cast<uint32_t *>( word ), op, count, nullptr, nullptr, 0 );
+  }
+
+  /**
+   * @brief Wakes every thread sleeping on the word
+   *
+   * @param word    Futex word
+   */
+  static inline void wake_all( std::atomic<uint32_t> *word )
+  {
+    wake( word, INT_MAX );
+  }
+
+  /**
+   * @brief Builds an absolute CLOCK_MONOTONIC deadline from a relative timeout
+   *
+   * @param timeout_ns  Nanoseconds from now
+   * @return timespec
+   */
+  static inline timespec deadline_from_now( const int64_t timeout_ns )
+  {
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    const int64_t total = static_cast<int64_t>( ts.tv_nsec ) + ( timeout_ns % 1000000000LL );
+    ts.tv_sec += static_cast<time_t>( timeout_ns / 1000000000LL + total / 1000000000LL );
+    ts.tv_nsec = static_cast<long>( total % 1000000000LL );
+    return ts;
+  }
+
+}    // namespace mb::hw::sim::futex
+
+#endif /* !MBEDUTILS_SIM_FUTEX_HPP */
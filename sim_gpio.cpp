@@ -11,10 +11,675 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <mbedutils/interfaces/gpio_intf.hpp>
+#include <mbedutils/logging.hpp>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include "sim_futex.hpp"
+#include "sim_gpio.hpp"
+#include "sim_time.hpp"
+#include "sim_vcd.hpp"
+
+namespace mb::hw::gpio::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Configuration of a single pin, each field updated independently
+   */
+  struct PinRecord
+  {
+    std::atomic<bool>        configured;
+    std::atomic<Mode_t>      mode;
+    std::atomic<Pull_t>      pull;
+    std::atomic<Drive_t>     drive;
+    std::atomic<Speed_t>     speed;
+    std::atomic<Alternate_t> alternate;
+  };
+
+  /**
+   * @brief Interrupt line bound to a single pin
+   */
+  struct IrqLine
+  {
+    std::shared_ptr<const Callback_t> handler; /**< Guarded by s_irq_mtx */
+    std::atomic<int64_t>              edge_ns;
+    std::atomic<uint64_t>             fired;
+    std::atomic<uint64_t>             missed;
+    std::atomic<int64_t>              latency_total_ns;
+    std::atomic<int64_t>              latency_max_ns;
+  };
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr int64_t SHM_POLL_TIMEOUT_NS = 100000000;
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::array<std::atomic<uint32_t>, MAX_PORTS>                s_port_state;
+  static std::array<std::array<PinRecord, PINS_PER_PORT>, MAX_PORTS> s_pin_config;
+
+  /*-------------------------------------------------------------------------
+  Live pin state. Points at s_port_state, or into the shared memory region
+  while the bridge is open.
+  -------------------------------------------------------------------------*/
+  static std::atomic<std::atomic<uint32_t> *> s_state{ s_port_state.data() };
+  static std::atomic<ShmRegion *>             s_shm{ nullptr };
+  static std::string                          s_shm_name;
+  static std::thread                          s_shm_thread;
+  static std::atomic<bool>                    s_shm_stop{ false };
+
+  /*-------------------------------------------------------------------------
+  Interrupt state. Edge detection reads only the trigger masks and touches
+  the pending bits, so pin writes never take the mutex.
+  -------------------------------------------------------------------------*/
+  static std::array<std::atomic<uint32_t>, MAX_PORTS>              s_rising_mask;
+  static std::array<std::atomic<uint32_t>, MAX_PORTS>              s_falling_mask;
+  static std::array<std::atomic<uint32_t>, MAX_PORTS>              s_pending;
+  static std::array<std::array<IrqLine, PINS_PER_PORT>, MAX_PORTS> s_irq_lines;
+  static std::mutex                                                s_irq_mtx;
+  static std::thread                                               s_isr_thread;
+  static std::atomic<bool>                                         s_isr_stop{ false };
+  static std::atomic<bool>                                         s_isr_waiting{ false };
+  static std::atomic<uint32_t>                                     s_isr_seq{ 0 };
+  static std::atomic<int>                                          s_isr_priority{ 0 };
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static inline bool is_valid( const Port_t port, const Pin_t pin )
+  {
+    return ( static_cast<size_t>( port ) < MAX_PORTS ) && ( static_cast<size_t>( pin ) < PINS_PER_PORT );
+  }
+
+
+  static inline uint32_t pin_mask( const Pin_t pin )
+  {
+    return 1u << static_cast<size_t>( pin );
+  }
+
+
+  static inline PinRecord &pin_record( const Port_t port, const Pin_t pin )
+  {
+    return s_pin_config[ static_cast<size_t>( port ) ][ static_cast<size_t>( pin ) ];
+  }
+
+
+  static inline std::atomic<uint32_t> &port_word( const size_t port )
+  {
+    return s_state.load( std::memory_order_acquire )[ port ];
+  }
+
+
+  static inline IrqLine &irq_line( const Port_t port, const Pin_t pin )
+  {
+    return s_irq_lines[ static_cast<size_t>( port ) ][ static_cast<size_t>( pin ) ];
+  }
+
+
+  /**
+   * @brief Gets which edges a trigger responds to.
+   *
+   * Level triggers fire on entering the level. They are not re-asserted
+   * while the level is held, since a harness-driven input has no way for the
+   * handler to clear its source.
+   */
+  static void trigger_edges( const Trigger_t trigger, bool &rising, bool &falling )
+  {
+    rising  = ( trigger == Trigger_t::TRIGGER_RISING_EDGE ) || ( trigger == Trigger_t::TRIGGER_BOTH_EDGE ) ||
+             ( trigger == Trigger_t::TRIGGER_HIGH_LEVEL );
+    falling = ( trigger == Trigger_t::TRIGGER_FALLING_EDGE ) || ( trigger == Trigger_t::TRIGGER_BOTH_EDGE ) ||
+              ( trigger == Trigger_t::TRIGGER_LOW_LEVEL );
+  }
+
+
+  /**
+   * @brief Latches interrupts on a port and wakes the ISR thread
+   *
+   * @param port    Port index
+   * @param lines   Pins whose interrupt fired
+   */
+  static void raise_irq( const size_t port, const uint32_t lines )
+  {
+    const int64_t now = mb::time::sim::monotonic_ns();
+
+    /*-------------------------------------------------------------------------
+    Like a pending bit in hardware, an edge arriving before the handler ran is
+    merged into the one already latched and counted as missed.
+    -------------------------------------------------------------------------*/
+    uint32_t fresh = lines & ~s_pending[ port ].load( std::memory_order_relaxed );
+    while( fresh )
+    {
+      const size_t pin = static_cast<size_t>( __builtin_ctz( fresh ) );
+      fresh &= fresh - 1;
+      s_irq_lines[ port ][ pin ].edge_ns.store( now, std::memory_order_relaxed );
+    }
+
+    uint32_t merged = lines & s_pending[ port ].fetch_or( lines, std::memory_order_seq_cst );
+    while( merged )
+    {
+      const size_t pin = static_cast<size_t>( __builtin_ctz( merged ) );
+      merged &= merged - 1;
+      s_irq_lines[ port ][ pin ].missed.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    s_isr_seq.fetch_add( 1, std::memory_order_seq_cst );
+    if( s_isr_waiting.load( std::memory_order_seq_cst ) )
+    {
+      mb::hw::sim::futex::wake( &s_isr_seq );
+    }
+  }
+
+
+  /**
+   * @brief Runs edge detection after a port's state word changed
+   *
+   * @param port        Port index
+   * @param old_state   State word before the update
+   * @param new_state   State word after the update
+   */
+  static inline void on_change( const size_t port, const uint32_t old_state, const uint32_t new_state )
+  {
+    const uint32_t changed = old_state ^ new_state;
+    if( !changed )
+    {
+      return;
+    }
+
+    const uint32_t fire = ( changed & new_state & s_rising_mask[ port ].load( std::memory_order_relaxed ) ) |
+                          ( changed & ~new_state & s_falling_mask[ port ].load( std::memory_order_relaxed ) );
+    if( fire )
+    {
+      raise_irq( port, fire );
+    }
+  }
+
+
+  /**
+   * @brief Appends the transitions of a port update to the shared edge log
+   */
+  static void log_edges( ShmRegion *shm, const size_t port, const uint32_t old_state, const uint32_t new_state )
+  {
+    const int64_t now = mb::time::sim::monotonic_ns();
+
+    uint32_t changed = old_state ^ new_state;
+    while( changed )
+    {
+      const size_t pin = static_cast<size_t>( __builtin_ctz( changed ) );
+      changed &= changed - 1;
+
+      const uint64_t idx  = shm->edge_head.fetch_add( 1, std::memory_order_relaxed );
+      ShmEdge       &edge = shm->edges[ idx & ( SHM_EDGE_DEPTH - 1 ) ];
+
+      edge.sequence.store( 2 * idx + 1, std::memory_order_relaxed );
+      std::atomic_thread_fence( std::memory_order_release );
+      edge.timestamp_ns = now;
+      edge.port         = static_cast<uint16_t>( port );
+      edge.pin          = static_cast<uint8_t>( pin );
+      edge.level        = ( new_state >> pin ) & 1u;
+      edge.sequence.store( 2 * idx + 2, std::memory_order_release );
+    }
+  }
+
+
+  /**
+   * @brief Opens a pin state update for shared memory readers
+   *
+   * @return ShmRegion*   Bridge region, if open, to pass to end_update()
+   */
+  static inline ShmRegion *begin_update()
+  {
+    ShmRegion *shm = s_shm.load( std::memory_order_acquire );
+    if( shm )
+    {
+      shm->seq_begin.fetch_add( 1, std::memory_order_seq_cst );
+    }
+
+    return shm;
+  }
+
+
+  /**
+   * @brief Publishes a pin state update and runs edge detection on it
+   */
+  static inline void end_update( ShmRegion *shm, const size_t port, const uint32_t old_state, const uint32_t new_state )
+  {
+    if( mb::hw::sim::vcd::enabled() && ( old_state != new_state ) )
+    {
+      mb::hw::sim::vcd::recordGpio( port, old_state ^ new_state, new_state );
+    }
+
+    if( shm )
+    {
+      shm->seq_end.fetch_add( 1, std::memory_order_seq_cst );
+      if( old_state != new_state )
+      {
+        log_edges( shm, port, old_state, new_state );
+      }
+    }
+
+    on_change( port, old_state, new_state );
+  }
+
+
+  /**
+   * @brief Applies harness commands from the shared memory ring
+   */
+  static void shm_command_thread( ShmRegion *shm )
+  {
+    while( !s_shm_stop.load() )
+    {
+      const uint32_t head = shm->cmd_head.load( std::memory_order_acquire );
+      uint32_t       tail = shm->cmd_tail.load( std::memory_order_relaxed );
+
+      if( head == tail )
+      {
+        /*---------------------------------------------------------------------
+        The timeout bounds how long a stop request can go unnoticed
+        ---------------------------------------------------------------------*/
+        const timespec deadline = mb::hw::sim::futex::deadline_from_now( SHM_POLL_TIMEOUT_NS );
+        mb::hw::sim::futex::wait( &shm->cmd_head, head, &deadline, true );
+        continue;
+      }
+
+      while( tail != head )
+      {
+        const ShmCommand &cmd = shm->commands[ tail & ( SHM_CMD_DEPTH - 1 ) ];
+        writePort( static_cast<Port_t>( cmd.port ), cmd.value, cmd.mask );
+        tail++;
+      }
+
+      shm->cmd_tail.store( tail, std::memory_order_release );
+    }
+  }
+
+
+  /**
+   * @brief Applies a scheduling priority to the ISR thread. s_irq_mtx must be held.
+   */
+  static bool apply_isr_priority( const int priority )
+  {
+    sched_param param    = {};
+    param.sched_priority = priority;
+
+    const int err = pthread_setschedparam( s_isr_thread.native_handle(), priority ? SCHED_FIFO : SCHED_OTHER, &param );
+    if( err )
+    {
+      LOG_ERROR( "Unable to set GPIO ISR thread priority: %s", strerror( err ) );
+    }
+
+    return err == 0;
+  }
+
+
+  static bool any_pending()
+  {
+    for( const auto &word : s_pending )
+    {
+      if( word.load( std::memory_order_seq_cst ) )
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  /**
+   * @brief Invokes the handler of a line that was pending
+   */
+  static void service_line( const size_t port, const size_t pin )
+  {
+    IrqLine &line = s_irq_lines[ port ][ pin ];
+
+    std::shared_ptr<const Callback_t> handler;
+    {
+      std::lock_guard<std::mutex> lock( s_irq_mtx );
+      handler = line.handler;
+    }
+
+    if( !handler )
+    {
+      return;
+    }
+
+    const int64_t latency = mb::time::sim::monotonic_ns() - line.edge_ns.load( std::memory_order_relaxed );
+    line.fired.fetch_add( 1, std::memory_order_relaxed );
+    line.latency_total_ns.fetch_add( latency, std::memory_order_relaxed );
+    if( latency > line.latency_max_ns.load( std::memory_order_relaxed ) )
+    {
+      line.latency_max_ns.store( latency, std::memory_order_relaxed );
+    }
+
+    ( *handler )();
+  }
+
+
+  /**
+   * @brief Interrupt service thread. Lines are serviced lowest first.
+   */
+  static void isr_thread()
+  {
+    while( !s_isr_stop.load() )
+    {
+      bool serviced = false;
+
+      for( size_t port = 0; port < MAX_PORTS; port++ )
+      {
+        uint32_t bits = s_pending[ port ].exchange( 0, std::memory_order_acq_rel );
+        while( bits )
+        {
+          const size_t pin = static_cast<size_t>( __builtin_ctz( bits ) );
+          bits &= bits - 1;
+          service_line( port, pin );
+          serviced = true;
+        }
+      }
+
+      if( serviced )
+      {
+        continue;
+      }
+
+      /*-----------------------------------------------------------------------
+      Announce the sleep before the final check so no raise can slip between
+      -----------------------------------------------------------------------*/
+      s_isr_waiting.store( true, std::memory_order_seq_cst );
+      const uint32_t seq = s_isr_seq.load( std::memory_order_seq_cst );
+      if( !any_pending() && !s_isr_stop.load() )
+      {
+        mb::hw::sim::futex::wait( &s_isr_seq, seq );
+      }
+      s_isr_waiting.store( false, std::memory_order_relaxed );
+    }
+  }
+
+
+  /**
+   * @brief Starts the ISR thread if needed. s_irq_mtx must be held.
+   */
+  static void start_isr_thread()
+  {
+    if( s_isr_thread.joinable() )
+    {
+      return;
+    }
+
+    s_isr_stop.store( false );
+    s_isr_thread = std::thread( isr_thread );
+
+    if( const int priority = s_isr_priority.load(); priority )
+    {
+      apply_isr_priority( priority );
+    }
+  }
+
+
+  static void stop_isr_thread()
+  {
+    std::thread thread;
+    {
+      std::lock_guard<std::mutex> lock( s_irq_mtx );
+      thread = std::move( s_isr_thread );
+    }
+
+    if( !thread.joinable() )
+    {
+      return;
+    }
+
+    s_isr_stop.store( true );
+    s_isr_seq.fetch_add( 1, std::memory_order_seq_cst );
+    mb::hw::sim::futex::wake_all( &s_isr_seq );
+    thread.join();
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  uint32_t readPort( const Port_t port )
+  {
+    if( static_cast<size_t>( port ) >= MAX_PORTS )
+    {
+      return 0;
+    }
+
+    return port_word( static_cast<size_t>( port ) ).load( std::memory_order_acquire );
+  }
+
+
+  void writePort( const Port_t port, const uint32_t value, const uint32_t mask )
+  {
+    if( static_cast<size_t>( port ) >= MAX_PORTS )
+    {
+      return;
+    }
+
+    const size_t           idx  = static_cast<size_t>( port );
+    ShmRegion             *shm  = begin_update();
+    std::atomic<uint32_t> &word = port_word( idx );
+
+    uint32_t old_state = word.load( std::memory_order_relaxed );
+    uint32_t new_state = 0;
+    do
+    {
+      new_state = ( old_state & ~mask ) | ( value & mask );
+    } while( !word.compare_exchange_weak( old_state, new_state, std::memory_order_acq_rel, std::memory_order_relaxed ) );
+
+    end_update( shm, idx, old_state, new_state );
+  }
+
+
+  PinSettings getPinSettings( const Port_t port, const Pin_t pin )
+  {
+    if( !is_valid( port, pin ) )
+    {
+      return {};
+    }
+
+    const PinRecord &rec = pin_record( port, pin );
+    return PinSettings{ rec.configured.load(), rec.mode.load(),  rec.pull.load(),
+                        rec.drive.load(),      rec.speed.load(), rec.alternate.load() };
+  }
+
+
+  bool setIsrPriority( const int priority )
+  {
+    std::lock_guard<std::mutex> lock( s_irq_mtx );
+    s_isr_priority.store( priority );
+
+    if( !s_isr_thread.joinable() )
+    {
+      return true;
+    }
+
+    return apply_isr_priority( priority );
+  }
+
+
+  IrqStats getInterruptStats( const Port_t port, const Pin_t pin )
+  {
+    if( !is_valid( port, pin ) )
+    {
+      return {};
+    }
+
+    const IrqLine &line  = irq_line( port, pin );
+    IrqStats       stats = {};
+    stats.fired          = line.fired.load( std::memory_order_relaxed );
+    stats.missed         = line.missed.load( std::memory_order_relaxed );
+    stats.max_latency_ns = line.latency_max_ns.load( std::memory_order_relaxed );
+    if( stats.fired )
+    {
+      stats.avg_latency_ns = line.latency_total_ns.load( std::memory_order_relaxed ) / static_cast<int64_t>( stats.fired );
+    }
+
+    return stats;
+  }
+
+
+  void resetInterruptStats()
+  {
+    for( auto &port : s_irq_lines )
+    {
+      for( IrqLine &line : port )
+      {
+        line.fired.store( 0, std::memory_order_relaxed );
+        line.missed.store( 0, std::memory_order_relaxed );
+        line.latency_total_ns.store( 0, std::memory_order_relaxed );
+        line.latency_max_ns.store( 0, std::memory_order_relaxed );
+      }
+    }
+  }
+
+
+  bool openSharedMemoryBridge( const std::string &name )
+  {
+    if( s_shm.load() )
+    {
+      return false;
+    }
+
+    /*-------------------------------------------------------------------------
+    Create and map the region
+    -------------------------------------------------------------------------*/
+    const int fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666 );
+    if( fd < 0 )
+    {
+      LOG_ERROR( "Failed to open GPIO shared memory %s: %s", name.c_str(), strerror( errno ) );
+      return false;
+    }
+
+    if( ftruncate( fd, sizeof( ShmRegion ) ) != 0 )
+    {
+      LOG_ERROR( "Failed to size GPIO shared memory %s: %s", name.c_str(), strerror( errno ) );
+      close( fd );
+      shm_unlink( name.c_str() );
+      return false;
+    }
+
+    void *mem = mmap( nullptr, sizeof( ShmRegion ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if( mem == MAP_FAILED )
+    {
+      LOG_ERROR( "Failed to map GPIO shared memory %s: %s", name.c_str(), strerror( errno ) );
+      shm_unlink( name.c_str() );
+      return false;
+    }
+
+    /*-------------------------------------------------------------------------
+    The fresh mapping is zeroed, which is a valid initial state for all the
+    atomics. Fill in the header and move the live pin state over.
+    -------------------------------------------------------------------------*/
+    ShmRegion *shm     = static_cast<ShmRegion *>( mem );
+    shm->magic         = SHM_MAGIC;
+    shm->version       = SHM_VERSION;
+    shm->port_count    = MAX_PORTS;
+    shm->pins_per_port = PINS_PER_PORT;
+
+    for( size_t port = 0; port < MAX_PORTS; port++ )
+    {
+      shm->port_state[ port ].store( s_port_state[ port ].load() );
+    }
+
+    s_shm_name = name;
+    s_state.store( shm->port_state, std::memory_order_release );
+    s_shm.store( shm, std::memory_order_release );
+
+    s_shm_stop.store( false );
+    s_shm_thread = std::thread( shm_command_thread, shm );
+    return true;
+  }
+
+
+  void closeSharedMemoryBridge()
+  {
+    ShmRegion *shm = s_shm.exchange( nullptr );
+    if( !shm )
+    {
+      return;
+    }
+
+    s_shm_stop.store( true );
+    mb::hw::sim::futex::wake( &shm->cmd_head, 1, true );
+    if( s_shm_thread.joinable() )
+    {
+      s_shm_thread.join();
+    }
+
+    for( size_t port = 0; port < MAX_PORTS; port++ )
+    {
+      s_port_state[ port ].store( shm->port_state[ port ].load() );
+    }
+    s_state.store( s_port_state.data(), std::memory_order_release );
+
+    munmap( shm, sizeof( ShmRegion ) );
+    shm_unlink( s_shm_name.c_str() );
+    s_shm_name.clear();
+  }
+
+
+  void resetState()
+  {
+    stop_isr_thread();
+
+    {
+      std::lock_guard<std::mutex> lock( s_irq_mtx );
+      for( size_t port = 0; port < MAX_PORTS; port++ )
+      {
+        s_rising_mask[ port ].store( 0 );
+        s_falling_mask[ port ].store( 0 );
+        s_pending[ port ].store( 0 );
+
+        for( IrqLine &line : s_irq_lines[ port ] )
+        {
+          line.handler.reset();
+        }
+      }
+    }
+
+    /*-------------------------------------------------------------------------
+    Go through writePort() so a harness watching the edge log sees the reset
+    -------------------------------------------------------------------------*/
+    for( size_t port = 0; port < MAX_PORTS; port++ )
+    {
+      writePort( static_cast<Port_t>( port ), 0 );
+    }
+
+    for( auto &port : s_pin_config )
+    {
+      for( PinRecord &rec : port )
+      {
+        rec.configured.store( false );
+      }
+    }
+  }
+}    // namespace mb::hw::gpio::sim
+
 
 namespace mb::hw::gpio::intf
 {
+  using namespace mb::hw::gpio::sim;
+
   /*---------------------------------------------------------------------------
   Public Functions
   ---------------------------------------------------------------------------*/
@@ -26,70 +691,180 @@ namespace mb::hw::gpio::intf
 
   void driver_teardown()
   {
+    closeSharedMemoryBridge();
+    resetState();
   }
 
 
   bool init( const mb::hw::gpio::PinConfig &config )
   {
+    if( !is_valid( config.port, config.pin ) )
+    {
+      return false;
+    }
+
+    PinRecord &rec = pin_record( config.port, config.pin );
+    rec.mode.store( config.mode );
+    rec.pull.store( config.pull );
+    rec.drive.store( config.drive );
+    rec.speed.store( config.speed );
+    rec.alternate.store( config.alternate );
+    rec.configured.store( true );
     return true;
   }
 
 
   void write( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::State_t state )
   {
+    if( !is_valid( port, pin ) )
+    {
+      return;
+    }
+
+    const size_t           idx  = static_cast<size_t>( port );
+    ShmRegion             *shm  = begin_update();
+    std::atomic<uint32_t> &word = port_word( idx );
+    if( state == State_t::STATE_HIGH )
+    {
+      const uint32_t old_state = word.fetch_or( pin_mask( pin ), std::memory_order_acq_rel );
+      end_update( shm, idx, old_state, old_state | pin_mask( pin ) );
+    }
+    else
+    {
+      const uint32_t old_state = word.fetch_and( ~pin_mask( pin ), std::memory_order_acq_rel );
+      end_update( shm, idx, old_state, old_state & ~pin_mask( pin ) );
+    }
   }
 
 
   void toggle( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin )
   {
+    if( !is_valid( port, pin ) )
+    {
+      return;
+    }
+
+    const size_t   idx       = static_cast<size_t>( port );
+    ShmRegion     *shm       = begin_update();
+    const uint32_t old_state = port_word( idx ).fetch_xor( pin_mask( pin ), std::memory_order_acq_rel );
+    end_update( shm, idx, old_state, old_state ^ pin_mask( pin ) );
   }
 
 
   mb::hw::gpio::State_t read( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin )
   {
-    return State_t::STATE_LOW;
+    if( !is_valid( port, pin ) )
+    {
+      return State_t::STATE_LOW;
+    }
+
+    const uint32_t word = port_word( static_cast<size_t>( port ) ).load( std::memory_order_acquire );
+    return ( word & pin_mask( pin ) ) ? State_t::STATE_HIGH : State_t::STATE_LOW;
   }
 
 
   void setAlternate( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Alternate_t alternate )
   {
+    if( is_valid( port, pin ) )
+    {
+      pin_record( port, pin ).alternate.store( alternate );
+    }
   }
 
 
   void setPull( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Pull_t pull )
   {
+    if( is_valid( port, pin ) )
+    {
+      pin_record( port, pin ).pull.store( pull );
+    }
   }
 
 
   void setDrive( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Drive_t drive )
   {
+    if( is_valid( port, pin ) )
+    {
+      pin_record( port, pin ).drive.store( drive );
+    }
   }
 
 
   void setSpeed( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Speed_t speed )
   {
+    if( is_valid( port, pin ) )
+    {
+      pin_record( port, pin ).speed.store( speed );
+    }
   }
 
 
   void setMode( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Mode_t mode )
   {
+    if( is_valid( port, pin ) )
+    {
+      pin_record( port, pin ).mode.store( mode );
+    }
   }
 
 
   void attachInterrupt( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin, const mb::hw::gpio::Trigger_t trigger,
                         const mb::hw::gpio::Callback_t &callback )
   {
+    if( !is_valid( port, pin ) )
+    {
+      return;
+    }
+
+    const size_t   idx  = static_cast<size_t>( port );
+    const uint32_t mask = pin_mask( pin );
+
+    bool rising  = false;
+    bool falling = false;
+    trigger_edges( trigger, rising, falling );
+
+    {
+      std::lock_guard<std::mutex> lock( s_irq_mtx );
+      irq_line( port, pin ).handler = std::make_shared<const Callback_t>( callback );
+      start_isr_thread();
+    }
+
+    rising ? s_rising_mask[ idx ].fetch_or( mask ) : s_rising_mask[ idx ].fetch_and( ~mask );
+    falling ? s_falling_mask[ idx ].fetch_or( mask ) : s_falling_mask[ idx ].fetch_and( ~mask );
+
+    /*-------------------------------------------------------------------------
+    A level trigger whose level is already present fires right away
+    -------------------------------------------------------------------------*/
+    const bool high = port_word( idx ).load() & mask;
+    if( ( ( trigger == Trigger_t::TRIGGER_HIGH_LEVEL ) && high ) || ( ( trigger == Trigger_t::TRIGGER_LOW_LEVEL ) && !high ) )
+    {
+      raise_irq( idx, mask );
+    }
   }
 
 
   void detachInterrupt( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin )
   {
+    if( !is_valid( port, pin ) )
+    {
+      return;
+    }
+
+    const size_t   idx  = static_cast<size_t>( port );
+    const uint32_t mask = pin_mask( pin );
+
+    s_rising_mask[ idx ].fetch_and( ~mask );
+    s_falling_mask[ idx ].fetch_and( ~mask );
+    s_pending[ idx ].fetch_and( ~mask );
+
+    std::lock_guard<std::mutex> lock( s_irq_mtx );
+    irq_line( port, pin ).handler.reset();
   }
 
 
   uint32_t getInterruptLine( const mb::hw::gpio::Port_t port, const mb::hw::gpio::Pin_t pin )
   {
-    return 0;
+    return static_cast<uint32_t>( static_cast<size_t>( port ) * PINS_PER_PORT + static_cast<size_t>( pin ) );
   }
 
 }    // namespace mb::hw::gpio::intf
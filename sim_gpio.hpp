@@ -0,0 +1,231 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_gpio.hpp
+ *
+ *  Description:
+ *    Simulator specific interface to the GPIO driver
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_GPIO_HPP
+#define MBEDUTILS_SIM_GPIO_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mbedutils/interfaces/gpio_intf.hpp>
+#include <string>
+
+namespace mb::hw::gpio::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Number of GPIO ports the simulator can model
+   */
+  static constexpr size_t MAX_PORTS = 16;
+
+  /**
+   * @brief Pins per port, one bit each in the port's state word
+   */
+  static constexpr size_t PINS_PER_PORT = 32;
+
+  /**
+   * @brief Shared memory bridge layout identification
+   */
+  static constexpr uint32_t SHM_MAGIC   = 0x4F495047; /**< "GPIO" */
+  static constexpr uint32_t SHM_VERSION = 1;
+
+  /**
+   * @brief Entries in the shared memory command ring and edge log. Powers of two.
+   */
+  static constexpr size_t SHM_CMD_DEPTH  = 256;
+  static constexpr size_t SHM_EDGE_DEPTH = 65536;
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Last configuration applied to a pin through init() or the set*() calls
+   */
+  struct PinSettings
+  {
+    bool        configured; /**< init() has been called on the pin */
+    Mode_t      mode;
+    Pull_t      pull;
+    Drive_t     drive;
+    Speed_t     speed;
+    Alternate_t alternate;
+  };
+
+  /**
+   * @brief Delivery statistics of a single interrupt line
+   */
+  struct IrqStats
+  {
+    uint64_t fired;          /**< Handler invocations */
+    uint64_t missed;         /**< Edges lost because the line was still pending */
+    int64_t  avg_latency_ns; /**< Mean host time from edge to handler entry */
+    int64_t  max_latency_ns; /**< Worst host time from edge to handler entry */
+  };
+
+  /**
+   * @brief Pin update requested by a harness through the shared memory bridge
+   */
+  struct ShmCommand
+  {
+    uint32_t port;  /**< Port to update */
+    uint32_t value; /**< New levels, bit N for pin N */
+    uint32_t mask;  /**< Pins to update */
+    uint32_t reserved;
+  };
+
+  /**
+   * @brief A single pin transition in the shared memory edge log.
+   *
+   * Entry N of the log is written to slot N % SHM_EDGE_DEPTH. Its sequence is
+   * 2N + 1 while being written and 2N + 2 once complete. A reader copies the
+   * slot between two reads of the sequence and keeps it only if both equal
+   * 2N + 2; a larger value means the entry was overwritten.
+   */
+  struct ShmEdge
+  {
+    std::atomic<uint64_t> sequence;
+    int64_t               timestamp_ns; /**< Host CLOCK_MONOTONIC time of the edge */
+    uint16_t              port;
+    uint8_t               pin;
+    uint8_t               level;        /**< New level of the pin */
+    uint32_t              reserved;
+  };
+
+  /**
+   * @brief Layout of the GPIO shared memory region.
+   *
+   * port_state is the live pin state of the node, not a copy. Writers bump
+   * seq_begin before and seq_end after each update, so a consistent snapshot
+   * of several ports is: read seq_end, copy the ports, read seq_begin, and
+   * retry unless the two match.
+   *
+   * A harness drives pins by filling commands[ cmd_head % SHM_CMD_DEPTH ],
+   * incrementing cmd_head, and doing a shared FUTEX_WAKE on cmd_head. The node
+   * applies each command like writePort(), firing interrupts as usual, then
+   * advances cmd_tail. The ring is full when cmd_head - cmd_tail equals its
+   * depth. Every pin transition is appended to the edge log at edge_head.
+   */
+  struct ShmRegion
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t port_count;
+    uint32_t pins_per_port;
+
+    alignas( 64 ) std::atomic<uint64_t> seq_begin;
+    std::atomic<uint64_t>               seq_end;
+    std::atomic<uint32_t>               port_state[ MAX_PORTS ];
+
+    alignas( 64 ) std::atomic<uint32_t> cmd_head;
+    std::atomic<uint32_t>               cmd_tail;
+    ShmCommand                          commands[ SHM_CMD_DEPTH ];
+
+    alignas( 64 ) std::atomic<uint64_t> edge_head;
+    ShmEdge                             edges[ SHM_EDGE_DEPTH ];
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Reads the state of every pin on a port in one atomic load
+   *
+   * @param port      Port to read
+   * @return uint32_t Bit N holds the level of pin N
+   */
+  uint32_t readPort( const Port_t port );
+
+  /**
+   * @brief Atomically updates several pins on a port at once.
+   *
+   * Only pins selected by the mask change, so a harness can drive inputs
+   * without disturbing pins the firmware owns.
+   *
+   * @param port    Port to write
+   * @param value   New levels, bit N for pin N
+   * @param mask    Pins to update
+   */
+  void writePort( const Port_t port, const uint32_t value, const uint32_t mask = 0xFFFFFFFF );
+
+  /**
+   * @brief Gets the recorded configuration of a pin
+   *
+   * @param port    Port of the pin
+   * @param pin     Pin to query
+   * @return PinSettings
+   */
+  PinSettings getPinSettings( const Port_t port, const Pin_t pin );
+
+  /**
+   * @brief Sets the scheduling priority of the interrupt service thread.
+   *
+   * Interrupt handlers run on one dedicated thread, in line order, much like
+   * a single NVIC. A non-zero priority runs it under SCHED_FIFO so handlers
+   * preempt simulated tasks, which requires CAP_SYS_NICE or RLIMIT_RTPRIO.
+   *
+   * @param priority  SCHED_FIFO priority, or 0 for normal scheduling
+   * @return true     The priority was applied, or will be once the thread starts
+   */
+  bool setIsrPriority( const int priority );
+
+  /**
+   * @brief Gets the delivery statistics of a pin's interrupt line
+   *
+   * @param port    Port of the pin
+   * @param pin     Pin to query
+   * @return IrqStats
+   */
+  IrqStats getInterruptStats( const Port_t port, const Pin_t pin );
+
+  /**
+   * @brief Clears the delivery statistics of every interrupt line
+   */
+  void resetInterruptStats();
+
+  /**
+   * @brief Exposes the GPIO state of this node in a POSIX shared memory region.
+   *
+   * The current pin state moves into the region, and from then on every pin
+   * operation works on it directly. Open the bridge before tasks start
+   * toggling pins, since updates racing with the move can be lost.
+   *
+   * @param name    Shared memory object name, e.g. "/node0_gpio"
+   * @return true   The region is mapped and the command thread is running
+   */
+  bool openSharedMemoryBridge( const std::string &name );
+
+  /**
+   * @brief Moves the pin state back into the process and removes the region.
+   *
+   * Call only once tasks have stopped touching pins, e.g. during teardown.
+   */
+  void closeSharedMemoryBridge();
+
+  /**
+   * @brief Returns the GPIO driver to its power-on state for a warm reset.
+   *
+   * Stops the interrupt thread, drops every handler, clears pin levels and
+   * configuration. The shared memory bridge stays open, so a harness keeps
+   * its mapping across the reset. Call only once tasks have stopped.
+   */
+  void resetState();
+
+}    // namespace mb::hw::gpio::sim
+
+#endif /* !MBEDUTILS_SIM_GPIO_HPP */
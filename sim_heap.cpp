@@ -0,0 +1,601 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_heap.cpp
+ *
+ *  Description:
+ *    Two level segregated fit heap over a fixed size arena
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <mbedutils/logging.hpp>
+#include <mbedutils/threading.hpp>
+#include <mutex>
+#include <unordered_map>
+#include "sim_heap.hpp"
+#include "sim_thread.hpp"
+
+namespace mb::osal::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Header in front of every block, free or not.
+   *
+   * Blocks are laid out back to back. The low bits of size carry the state of
+   * this block and of the one physically before it, which is what lets free()
+   * coalesce in constant time.
+   */
+  struct Block
+  {
+    Block             *prev_phys; /**< Valid only while the previous block is free */
+    size_t             size;      /**< Payload bytes | BLOCK_FREE | PREV_FREE */
+    mb::thread::TaskId owner;     /**< Task that allocated the block */
+    const void        *site;      /**< Call site that allocated the block */
+  };
+
+  /**
+   * @brief Free list links, stored in the payload of free blocks
+   */
+  struct FreeLinks
+  {
+    Block *next;
+    Block *prev;
+  };
+
+  struct SiteRecord
+  {
+    uint64_t allocations;
+    uint64_t bytes;
+    size_t   in_use;
+  };
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t ALIGN       = 16;
+  static constexpr size_t SL_LOG2     = 5;
+  static constexpr size_t SL_COUNT    = 1u << SL_LOG2;
+  static constexpr size_t SMALL_BLOCK = SL_COUNT * ALIGN;
+  static constexpr size_t FL_SHIFT    = 9; /**< log2( SMALL_BLOCK ) */
+  static constexpr size_t FL_COUNT    = 24;
+  static constexpr size_t MAX_BLOCK   = ( static_cast<size_t>( 1 ) << ( FL_SHIFT + FL_COUNT - 1 ) ) - 1;
+  static constexpr size_t MIN_PAYLOAD = sizeof( FreeLinks );
+  static constexpr size_t HEADER_SIZE = sizeof( Block );
+
+  static constexpr size_t BLOCK_FREE = 1u << 0;
+  static constexpr size_t PREV_FREE  = 1u << 1;
+  static constexpr size_t FLAG_MASK  = BLOCK_FREE | PREV_FREE;
+
+  static_assert( ( HEADER_SIZE % ALIGN ) == 0, "Block header must keep payloads aligned" );
+  static_assert( ( static_cast<size_t>( 1 ) << FL_SHIFT ) == SMALL_BLOCK, "FL_SHIFT out of sync" );
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::mutex s_heap_lock;
+  static uint8_t   *s_memory   = nullptr;
+  static size_t     s_capacity = 0;
+
+  static uint32_t s_fl_bitmap = 0;
+  static uint32_t s_sl_bitmap[ FL_COUNT ];
+  static Block   *s_free_lists[ FL_COUNT ][ SL_COUNT ];
+
+  static size_t   s_in_use      = 0;
+  static size_t   s_peak        = 0;
+  static size_t   s_free_bytes  = 0;
+  static uint64_t s_allocations = 0;
+  static uint64_t s_failures    = 0;
+
+  static std::unordered_map<mb::thread::TaskId, TaskHeapStats> s_task_stats;
+  static std::unordered_map<const void *, SiteRecord>          s_site_stats;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static inline size_t msb( const size_t value )
+  {
+    return 63u - static_cast<size_t>( __builtin_clzll( value ) );
+  }
+
+
+  static inline size_t block_size( const Block *block )
+  {
+    return block->size & ~FLAG_MASK;
+  }
+
+
+  static inline void set_size( Block *block, const size_t size )
+  {
+    block->size = size | ( block->size & FLAG_MASK );
+  }
+
+
+  static inline uint8_t *payload( Block *block )
+  {
+    return reinterpret_cast<uint8_t *>( block ) + HEADER_SIZE;
+  }
+
+
+  static inline Block *next_phys( Block *block )
+  {
+    return reinterpret_cast<Block *>( payload( block ) + block_size( block ) );
+  }
+
+
+  static inline FreeLinks &links( Block *block )
+  {
+    return *reinterpret_cast<FreeLinks *>( payload( block ) );
+  }
+
+
+  static inline bool in_arena( const void *ptr )
+  {
+    const uint8_t *raw = static_cast<const uint8_t *>( ptr );
+    return s_memory && ( raw >= s_memory ) && ( raw < ( s_memory + s_capacity ) );
+  }
+
+
+  /**
+   * @brief Maps a block size onto its first and second level list
+   */
+  static void mapping( const size_t size, size_t &fl, size_t &sl )
+  {
+    if( size < SMALL_BLOCK )
+    {
+      fl = 0;
+      sl = size / ( SMALL_BLOCK / SL_COUNT );
+    }
+    else
+    {
+      const size_t top = msb( size );
+      sl               = ( size >> ( top - SL_LOG2 ) ) ^ SL_COUNT;
+      fl               = top - FL_SHIFT + 1;
+    }
+  }
+
+
+  static void insert_free( Block *block )
+  {
+    size_t fl, sl;
+    mapping( block_size( block ), fl, sl );
+
+    Block *head = s_free_lists[ fl ][ sl ];
+
+    links( block ).next = head;
+    links( block ).prev = nullptr;
+    if( head )
+    {
+      links( head ).prev = block;
+    }
+
+    s_free_lists[ fl ][ sl ] = block;
+    s_fl_bitmap |= 1u << fl;
+    s_sl_bitmap[ fl ] |= 1u << sl;
+    s_free_bytes += block_size( block );
+  }
+
+
+  static void remove_free( Block *block )
+  {
+    size_t fl, sl;
+    mapping( block_size( block ), fl, sl );
+
+    Block *next = links( block ).next;
+    Block *prev = links( block ).prev;
+
+    if( prev )
+    {
+      links( prev ).next = next;
+    }
+    else
+    {
+      s_free_lists[ fl ][ sl ] = next;
+    }
+
+    if( next )
+    {
+      links( next ).prev = prev;
+    }
+
+    if( !s_free_lists[ fl ][ sl ] )
+    {
+      s_sl_bitmap[ fl ] &= ~( 1u << sl );
+      if( !s_sl_bitmap[ fl ] )
+      {
+        s_fl_bitmap &= ~( 1u << fl );
+      }
+    }
+
+    s_free_bytes -= block_size( block );
+  }
+
+
+  /**
+   * @brief Finds a free block of at least the given size in O(1).
+   *
+   * The request is rounded up to the next list boundary first, so any block
+   * on the list found is guaranteed to be large enough.
+   */
+  static Block *find_free( const size_t size )
+  {
+    size_t target = size;
+    if( target >= SMALL_BLOCK )
+    {
+      target += ( static_cast<size_t>( 1 ) << ( msb( target ) - SL_LOG2 ) ) - 1;
+    }
+
+    size_t fl, sl;
+    mapping( target, fl, sl );
+    if( fl >= FL_COUNT )
+    {
+      return nullptr;
+    }
+
+    uint32_t sl_map = s_sl_bitmap[ fl ] & ( ~0u << sl );
+    if( !sl_map )
+    {
+      const uint32_t fl_map = s_fl_bitmap & ( ~0u << ( fl + 1 ) );
+      if( !fl_map )
+      {
+        return nullptr;
+      }
+
+      fl     = static_cast<size_t>( __builtin_ctz( fl_map ) );
+      sl_map = s_sl_bitmap[ fl ];
+    }
+
+    return s_free_lists[ fl ][ __builtin_ctz( sl_map ) ];
+  }
+
+
+  /**
+   * @brief Lays out the arena as one free block followed by a sentinel. Heap lock must be held.
+   */
+  static void format_arena()
+  {
+    s_fl_bitmap = 0;
+    memset( s_sl_bitmap, 0, sizeof( s_sl_bitmap ) );
+    memset( s_free_lists, 0, sizeof( s_free_lists ) );
+
+    s_in_use      = 0;
+    s_peak        = 0;
+    s_free_bytes  = 0;
+    s_allocations = 0;
+    s_failures    = 0;
+    s_task_stats.clear();
+    s_site_stats.clear();
+
+    if( !s_memory )
+    {
+      return;
+    }
+
+    Block *first     = reinterpret_cast<Block *>( s_memory );
+    first->prev_phys = nullptr;
+    first->size      = ( s_capacity - 2 * HEADER_SIZE ) | BLOCK_FREE;
+
+    Block *sentinel     = next_phys( first );
+    sentinel->prev_phys = first;
+    sentinel->size      = 0 | PREV_FREE;
+
+    insert_free( first );
+  }
+
+
+  static void *arena_alloc( const size_t size, const void *site )
+  {
+    if( size > MAX_BLOCK )
+    {
+      return nullptr;
+    }
+
+    const size_t need  = ( std::max( size, MIN_PAYLOAD ) + ALIGN - 1 ) & ~( ALIGN - 1 );
+    Block       *block = find_free( need );
+    if( !block )
+    {
+      return nullptr;
+    }
+
+    remove_free( block );
+
+    /*-------------------------------------------------------------------------
+    Split off the tail if it's big enough to be a block of its own
+    -------------------------------------------------------------------------*/
+    const size_t have = block_size( block );
+    if( have >= ( need + HEADER_SIZE + MIN_PAYLOAD ) )
+    {
+      Block *rest     = reinterpret_cast<Block *>( payload( block ) + need );
+      rest->prev_phys = block;
+      rest->size      = ( have - need - HEADER_SIZE ) | BLOCK_FREE;
+      set_size( block, need );
+
+      next_phys( rest )->prev_phys = rest;
+      insert_free( rest );
+    }
+    else
+    {
+      next_phys( block )->size &= ~PREV_FREE;
+    }
+
+    block->size &= ~BLOCK_FREE;
+    block->owner = mb::thread::sim::currentTaskId();
+    block->site  = site;
+
+    /*-------------------------------------------------------------------------
+    Book keeping
+    -------------------------------------------------------------------------*/
+    const size_t footprint = block_size( block ) + HEADER_SIZE;
+
+    s_allocations++;
+    s_in_use += footprint;
+    s_peak    = std::max( s_peak, s_in_use );
+
+    TaskHeapStats &task = s_task_stats[ block->owner ];
+    task.id             = block->owner;
+    task.in_use        += footprint;
+    task.peak           = std::max( task.peak, task.in_use );
+    task.allocations++;
+
+    SiteRecord &rec = s_site_stats[ site ];
+    rec.allocations++;
+    rec.bytes += size;
+    rec.in_use += footprint;
+
+    return payload( block );
+  }
+
+
+  static void arena_free( void *ptr )
+  {
+    Block *block = reinterpret_cast<Block *>( static_cast<uint8_t *>( ptr ) - HEADER_SIZE );
+    if( block->size & BLOCK_FREE )
+    {
+      LOG_ERROR( "Simulated heap: double free of %p", ptr );
+      return;
+    }
+
+    const size_t footprint = block_size( block ) + HEADER_SIZE;
+    s_in_use -= footprint;
+    s_task_stats[ block->owner ].in_use -= footprint;
+    s_site_stats[ block->site ].in_use -= footprint;
+
+    /*-------------------------------------------------------------------------
+    Coalesce with free neighbors on either side
+    -------------------------------------------------------------------------*/
+    block->size |= BLOCK_FREE;
+    Block *next = next_phys( block );
+
+    if( block->size & PREV_FREE )
+    {
+      Block *prev = block->prev_phys;
+      remove_free( prev );
+      set_size( prev, block_size( prev ) + HEADER_SIZE + block_size( block ) );
+      block           = prev;
+      next->prev_phys = block;
+    }
+
+    if( next->size & BLOCK_FREE )
+    {
+      remove_free( next );
+      set_size( block, block_size( block ) + HEADER_SIZE + block_size( next ) );
+      next            = next_phys( block );
+      next->prev_phys = block;
+    }
+
+    next->size |= PREV_FREE;
+    insert_free( block );
+  }
+
+
+  /**
+   * @brief Size of the largest free block. Heap lock must be held.
+   */
+  static size_t largest_free()
+  {
+    if( !s_fl_bitmap )
+    {
+      return 0;
+    }
+
+    const size_t fl = msb( s_fl_bitmap );
+    const size_t sl = msb( s_sl_bitmap[ fl ] );
+
+    size_t largest = 0;
+    for( Block *block = s_free_lists[ fl ][ sl ]; block; block = links( block ).next )
+    {
+      largest = std::max( largest, block_size( block ) );
+    }
+
+    return largest;
+  }
+
+
+  static std::string symbol_of( const void *site )
+  {
+    Dl_info info;
+    if( !dladdr( site, &info ) || !info.dli_sname )
+    {
+      return "";
+    }
+
+    int         status    = 0;
+    char       *demangled = abi::__cxa_demangle( info.dli_sname, nullptr, nullptr, &status );
+    std::string name      = ( status == 0 && demangled ) ? demangled : info.dli_sname;
+    free( demangled );
+    return name;
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool enableHeap( const size_t capacity )
+  {
+    const size_t aligned = ( capacity + ALIGN - 1 ) & ~( ALIGN - 1 );
+    if( ( aligned < ( 2 * HEADER_SIZE + MIN_PAYLOAD ) ) || ( aligned - 2 * HEADER_SIZE > MAX_BLOCK ) )
+    {
+      LOG_ERROR( "Simulated heap capacity of %zu bytes is out of range", capacity );
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+    if( s_in_use )
+    {
+      return false;
+    }
+
+    uint8_t *memory = static_cast<uint8_t *>( std::aligned_alloc( ALIGN, aligned ) );
+    if( !memory )
+    {
+      return false;
+    }
+
+    std::free( s_memory );
+    s_memory   = memory;
+    s_capacity = aligned;
+    format_arena();
+    return true;
+  }
+
+
+  bool disableHeap()
+  {
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+    if( s_in_use )
+    {
+      return false;
+    }
+
+    std::free( s_memory );
+    s_memory   = nullptr;
+    s_capacity = 0;
+    format_arena();
+    return true;
+  }
+
+
+  void resetHeap()
+  {
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+    format_arena();
+  }
+
+
+  __attribute__( ( noinline ) ) void *heapAlloc( const size_t size )
+  {
+    const void *site = __builtin_return_address( 0 );
+    void       *ptr  = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock( s_heap_lock );
+      if( !s_memory )
+      {
+        return std::malloc( size );
+      }
+
+      ptr = arena_alloc( size, site );
+      if( !ptr )
+      {
+        s_failures++;
+      }
+    }
+
+    /*-------------------------------------------------------------------------
+    Report exhaustion outside the lock, the hook may well log or allocate
+    -------------------------------------------------------------------------*/
+    if( !ptr )
+    {
+      mb::thread::intf::on_malloc_failed();
+    }
+
+    return ptr;
+  }
+
+
+  void heapFree( void *ptr )
+  {
+    if( !ptr )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+    if( in_arena( ptr ) )
+    {
+      arena_free( ptr );
+    }
+    else
+    {
+      std::free( ptr );
+    }
+  }
+
+
+  HeapStats getHeapStats()
+  {
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+
+    HeapStats stats     = {};
+    stats.capacity      = s_memory ? ( s_capacity - HEADER_SIZE ) : 0;
+    stats.in_use        = s_in_use;
+    stats.peak          = s_peak;
+    stats.free          = s_free_bytes;
+    stats.largest_free  = largest_free();
+    stats.allocations   = s_allocations;
+    stats.failures      = s_failures;
+    stats.fragmentation = s_free_bytes ? ( 1.0 - static_cast<double>( stats.largest_free ) / s_free_bytes ) : 0.0;
+    return stats;
+  }
+
+
+  std::vector<TaskHeapStats> getTaskHeapStats()
+  {
+    std::lock_guard<std::mutex> lock( s_heap_lock );
+
+    std::vector<TaskHeapStats> result;
+    for( const auto &entry : s_task_stats )
+    {
+      result.push_back( entry.second );
+    }
+
+    return result;
+  }
+
+
+  std::vector<HeapSiteStats> getHeapSiteStats()
+  {
+    std::vector<HeapSiteStats> result;
+    {
+      std::lock_guard<std::mutex> lock( s_heap_lock );
+      for( const auto &entry : s_site_stats )
+      {
+        result.push_back( HeapSiteStats{ entry.first, "", entry.second.allocations, entry.second.bytes, entry.second.in_use } );
+      }
+    }
+
+    std::sort( result.begin(), result.end(),
+               []( const HeapSiteStats &lhs, const HeapSiteStats &rhs ) { return lhs.allocations > rhs.allocations; } );
+
+    for( HeapSiteStats &site : result )
+    {
+      site.symbol = symbol_of( site.site );
+    }
+
+    return result;
+  }
+
+}    // namespace mb::osal::sim
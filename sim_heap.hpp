@@ -0,0 +1,133 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_heap.hpp
+ *
+ *  Description:
+ *    Simulated target heap with a fixed RAM budget
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_HEAP_HPP
+#define MBEDUTILS_SIM_HEAP_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <mbedutils/drivers/threading/thread.hpp>
+#include <string>
+#include <vector>
+
+namespace mb::osal::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct HeapStats
+  {
+    size_t   capacity;      /**< Usable bytes in the arena */
+    size_t   in_use;        /**< Bytes handed out, including block overhead */
+    size_t   peak;          /**< Highest in_use seen */
+    size_t   free;          /**< Bytes available across all free blocks */
+    size_t   largest_free;  /**< Largest single allocation that could succeed */
+    uint64_t allocations;   /**< Successful allocations */
+    uint64_t failures;      /**< Allocations that found no room */
+    double   fragmentation; /**< 1 - largest_free / free, 0 when unfragmented */
+  };
+
+  /**
+   * @brief Heap usage attributed to one task. Non-task threads share TASK_ID_INVALID.
+   */
+  struct TaskHeapStats
+  {
+    mb::thread::TaskId id;
+    size_t             in_use;
+    size_t             peak;
+    uint64_t           allocations;
+  };
+
+  /**
+   * @brief Heap usage attributed to one call site of heapAlloc()
+   */
+  struct HeapSiteStats
+  {
+    const void *site;        /**< Return address into the caller */
+    std::string symbol;      /**< Symbol containing the site, if it could be resolved */
+    uint64_t    allocations; /**< Allocations made from this site */
+    uint64_t    bytes;       /**< Total bytes requested from this site */
+    size_t      in_use;      /**< Bytes from this site not yet freed */
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Backs heapAlloc() with a fixed size arena matching the target RAM budget.
+   *
+   * Allocation uses a two level segregated fit allocator, so both alloc and
+   * free are O(1), much like the TLSF heaps used on target. When the arena
+   * can't satisfy a request, mb::thread::intf::on_malloc_failed() is called
+   * and nullptr returned. Until this is called, heapAlloc() goes straight to
+   * the host heap and nothing is tracked.
+   *
+   * @param capacity  Arena size in bytes
+   * @return true     The arena is ready. Fails if the current one is in use.
+   */
+  bool enableHeap( const size_t capacity );
+
+  /**
+   * @brief Releases the arena and routes heapAlloc() back to the host heap.
+   *
+   * @return true   The arena was released. Fails if allocations are outstanding.
+   */
+  bool disableHeap();
+
+  /**
+   * @brief Frees every block in the arena and clears all statistics, e.g. on a warm reset
+   */
+  void resetHeap();
+
+  /**
+   * @brief Allocates memory from the simulated heap
+   *
+   * @param size    Bytes requested
+   * @return void*  16 byte aligned memory, or nullptr if the heap is exhausted
+   */
+  void *heapAlloc( const size_t size );
+
+  /**
+   * @brief Returns memory from heapAlloc() to the heap
+   *
+   * @param ptr     Memory to free, may be nullptr
+   */
+  void heapFree( void *ptr );
+
+  /**
+   * @brief Gets the usage statistics of the arena
+   *
+   * @return HeapStats
+   */
+  HeapStats getHeapStats();
+
+  /**
+   * @brief Gets heap usage broken down by the task that allocated
+   *
+   * @return std::vector<TaskHeapStats>
+   */
+  std::vector<TaskHeapStats> getTaskHeapStats();
+
+  /**
+   * @brief Gets heap usage broken down by call site, most allocations first
+   *
+   * @return std::vector<HeapSiteStats>
+   */
+  std::vector<HeapSiteStats> getHeapSiteStats();
+
+}    // namespace mb::osal::sim
+
+#endif /* !MBEDUTILS_SIM_HEAP_HPP */
@@ -13,19 +13,56 @@ Includes
 -----------------------------------------------------------------------------*/
 #include "sim_io_pipe.hpp"
 #include "sim_queue.hpp"
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
 #include "zmq.hpp"
+#include <algorithm>
 #include <chrono>
 #include <mbedutils/logging.hpp>
 #include <iostream>
 
 namespace mb::hw::sim
 {
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t ZMQ_INLINE_BYTES = 33; /**< Payloads ZMQ stores inside the message, ZMQ_MAX_VSM_SIZE */
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static void recycle_payload( void *data, void *hint )
+  {
+    ( void )hint;
+    PooledBuffer::recycle( data );
+  }
+
+
+  /**
+   * @brief Picks the ZMQ context for an endpoint. inproc:// only connects
+   * sockets that were made from the same context.
+   */
+  static std::shared_ptr<zmq::context_t> context_for( const std::string &endpoint )
+  {
+    static std::shared_ptr<zmq::context_t> s_inproc_context = std::make_shared<zmq::context_t>( 1 );
+
+    if( endpoint.rfind( "inproc://", 0 ) == 0 )
+    {
+      return s_inproc_context;
+    }
+
+    return std::make_shared<zmq::context_t>( 1 );
+  }
+
   /*---------------------------------------------------------------------------
   Classes
   ---------------------------------------------------------------------------*/
 
   BidirectionalPipe::BidirectionalPipe( const std::string &endpoint, bool bind ) :
-      endpoint_( endpoint ), should_bind_( bind ), context_( 1 ), socket_( context_, zmq::socket_type::pair )
+      endpoint_( endpoint ), should_bind_( bind ), context_( context_for( endpoint ) ),
+      socket_( *context_, zmq::socket_type::pair )
   {
   }
 
@@ -73,12 +110,14 @@ namespace mb::hw::sim
         // Discard the message
       }
 
-      std::vector<uint8_t> data;
+      PooledBuffer data;
       while( send_queue_.pop( data ) )
       {
         // Discard the message
       }
 
+      held_ = {};
+
       /*-----------------------------------------------------------------------
       Start the send/receive threads
       -----------------------------------------------------------------------*/
@@ -110,24 +149,54 @@ namespace mb::hw::sim
     }
 
     socket_.close();
-    context_.close();
+
+    /*-------------------------------------------------------------------------
+    The shared inproc context is also held by context_for()
+    -------------------------------------------------------------------------*/
+    if( context_.use_count() == 1 )
+    {
+      context_->close();
+    }
+  }
+
+
+  void BidirectionalPipe::write( const void *data, const size_t size )
+  {
+    write( PooledBuffer( data, size ) );
   }
 
 
   void BidirectionalPipe::write( const std::vector<uint8_t> &data )
   {
-    send_queue_.push( data );
+    write( PooledBuffer( data.data(), data.size() ) );
+  }
+
+
+  void BidirectionalPipe::write( PooledBuffer &&buffer )
+  {
+    if( trace::enabled() )
+    {
+      trace::instant( trace::Category::PIPE, "pipe enqueue", buffer.size() );
+    }
+
+    submitted_.fetch_add( 1, std::memory_order_relaxed );
+    send_queue_.push( std::move( buffer ) );
   }
 
 
   void BidirectionalPipe::setReceiveCallback( ReceiveCallback callback )
   {
-    receive_callback_ = std::move( callback );
+    auto handler = callback ? std::make_shared<const ReceiveCallback>( std::move( callback ) ) : nullptr;
+
+    std::lock_guard<std::mutex> lock( callback_lock_ );
+    receive_callback_.swap( handler );
   }
 
 
   void BidirectionalPipe::receiveLoop()
   {
+    trace::setThreadName( "pipe rx " + endpoint_ );
+
     while( running_ )
     {
       try
@@ -142,12 +211,26 @@ namespace mb::hw::sim
           zmq::message_t message;
           if( socket_.recv( message, zmq::recv_flags::dontwait ) )
           {
-            if( receive_callback_ )
+            /*-----------------------------------------------------------------
+            Hold a reference so the handler can be swapped out mid call
+            -----------------------------------------------------------------*/
+            std::shared_ptr<const ReceiveCallback> handler;
+            {
+              std::lock_guard<std::mutex> lock( callback_lock_ );
+              handler = receive_callback_;
+            }
+
+            if( handler )
             {
               // std::cout << endpoint_ << ": RX " << message.size() << " bytes" << std::endl;
-              std::vector<uint8_t> data( static_cast<uint8_t *>( message.data() ),
-                                         static_cast<uint8_t *>( message.data() ) + message.size() );
-              receive_callback_( data );
+              const int64_t start = trace::enabled() ? trace::timestamp() : 0;
+
+              ( *handler )( static_cast<const uint8_t *>( message.data() ), message.size() );
+
+              if( start && trace::enabled() )
+              {
+                trace::complete( trace::Category::PIPE, "pipe receive", start, message.size() );
+              }
             }
           }
         }
@@ -163,23 +246,238 @@ namespace mb::hw::sim
   }
 
 
+  bool BidirectionalPipe::setImpairment( const LinkImpairment &config )
+  {
+    /*-------------------------------------------------------------------------
+    Reject settings the delivery math can't handle. Rates are written so that
+    NaN fails the check too.
+    -------------------------------------------------------------------------*/
+    if( ( config.latency_ns < 0 ) || ( config.jitter_ns < 0 ) )
+    {
+      LOG_ERROR( "%s: Negative link latency or jitter", endpoint_.c_str() );
+      return false;
+    }
+
+    if( ( config.bandwidth_bps != 0 ) && ( config.bits_per_byte == 0 ) )
+    {
+      LOG_ERROR( "%s: Link bandwidth needs a non-zero bits per byte", endpoint_.c_str() );
+      return false;
+    }
+
+    if( !( ( config.loss_rate >= 0.0 ) && ( config.loss_rate <= 1.0 ) ) ||
+        !( ( config.corrupt_rate >= 0.0 ) && ( config.corrupt_rate <= 1.0 ) ) )
+    {
+      LOG_ERROR( "%s: Link loss and corrupt rates must be within [0, 1]", endpoint_.c_str() );
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock( impair_lock_ );
+
+    impairment_ = config;
+    rng_.seed( config.seed );
+    tokens_    = static_cast<double>( config.burst_bytes );
+    refill_ns_ = mb::time::sim::nanos();
+    impaired_.store( true );
+    return true;
+  }
+
+
+  void BidirectionalPipe::clearImpairment()
+  {
+    std::lock_guard<std::mutex> lock( impair_lock_ );
+
+    impairment_ = LinkImpairment{};
+    impaired_.store( false );
+  }
+
+
+  LinkStats BidirectionalPipe::getLinkStats() const
+  {
+    LinkStats stats;
+    stats.submitted = submitted_.load();
+    stats.dropped   = dropped_.load();
+    stats.corrupted = corrupted_.load();
+    stats.delivered = delivered_.load();
+
+    return stats;
+  }
+
+
+  void BidirectionalPipe::transmit( PooledBuffer &&data )
+  {
+    try
+    {
+      const int64_t start = trace::enabled() ? trace::timestamp() : 0;
+      const size_t  size  = data.size();
+
+      /*-----------------------------------------------------------------------
+      Small payloads fit inside the message object itself, so copying them
+      is free. Larger ones are lent to ZMQ and come back to the pool once it
+      is done with them, possibly on the receiving end of an inproc pipe.
+      -----------------------------------------------------------------------*/
+      zmq::send_result_t sent;
+      if( size <= ZMQ_INLINE_BYTES )
+      {
+        sent = socket_.send( zmq::message_t( data.data(), size ), zmq::send_flags::dontwait );
+      }
+      else
+      {
+        uint8_t *memory = data.detach();
+        sent = socket_.send( zmq::message_t( memory, size, recycle_payload, nullptr ), zmq::send_flags::dontwait );
+      }
+
+      if( sent )
+      {
+        delivered_.fetch_add( 1, std::memory_order_relaxed );
+      }
+
+      if( start && trace::enabled() )
+      {
+        trace::complete( trace::Category::PIPE, "pipe send", start, size );
+      }
+      // std::cout << endpoint_ << ": TX " << data.size() << " bytes" << std::endl;
+    }
+    catch( const zmq::error_t &e )
+    {
+      std::cerr << endpoint_ << ": Send error: " << e.what() << std::endl;
+    }
+  }
+
+
+  /**
+   * @brief Applies the link impairment to one message and holds it until due.
+   *
+   * The token bucket is allowed to go negative. The deficit is exactly the
+   * backlog of bytes still being clocked out, so later messages queue up
+   * behind earlier ones just like on a real serial line.
+   */
+  void BidirectionalPipe::impair( PooledBuffer &&data )
+  {
+    std::lock_guard<std::mutex> lock( impair_lock_ );
+
+    const LinkImpairment &cfg = impairment_;
+    const int64_t         now = mb::time::sim::nanos();
+
+    /*-------------------------------------------------------------------------
+    Bandwidth: the message leaves once the bucket has paid for its last byte
+    -------------------------------------------------------------------------*/
+    int64_t depart_ns = now;
+    if( cfg.bandwidth_bps )
+    {
+      const double bytes_per_ns = static_cast<double>( cfg.bandwidth_bps ) / ( cfg.bits_per_byte * 1e9 );
+
+      tokens_    = std::min( static_cast<double>( cfg.burst_bytes ), tokens_ + ( now - refill_ns_ ) * bytes_per_ns );
+      refill_ns_ = now;
+      tokens_ -= static_cast<double>( data.size() );
+
+      if( tokens_ < 0.0 )
+      {
+        depart_ns += static_cast<int64_t>( -tokens_ / bytes_per_ns );
+      }
+    }
+
+    /*-------------------------------------------------------------------------
+    Loss and corruption. A lost message still took up its time on the link.
+    -------------------------------------------------------------------------*/
+    std::uniform_real_distribution<double> chance( 0.0, 1.0 );
+
+    if( ( cfg.loss_rate > 0.0 ) && ( chance( rng_ ) < cfg.loss_rate ) )
+    {
+      dropped_.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+
+    if( !data.empty() && ( cfg.corrupt_rate > 0.0 ) && ( chance( rng_ ) < cfg.corrupt_rate ) )
+    {
+      std::uniform_int_distribution<size_t> bit( 0, data.size() * 8 - 1 );
+      const size_t                          flip = bit( rng_ );
+
+      data.data()[ flip / 8 ] ^= static_cast<uint8_t>( 1u << ( flip % 8 ) );
+      corrupted_.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    /*-------------------------------------------------------------------------
+    Propagation delay
+    -------------------------------------------------------------------------*/
+    int64_t delay_ns = cfg.latency_ns;
+    if( cfg.jitter_ns > 0 )
+    {
+      const double spread = static_cast<double>( cfg.jitter_ns );
+      double       extra  = 0.0;
+
+      switch( cfg.jitter )
+      {
+        case JitterDistribution::NORMAL:
+          extra = std::normal_distribution<double>( 0.0, spread )( rng_ );
+          break;
+
+        case JitterDistribution::EXPONENTIAL:
+          extra = std::exponential_distribution<double>( 1.0 / spread )( rng_ );
+          break;
+
+        case JitterDistribution::UNIFORM:
+        default:
+          extra = std::uniform_real_distribution<double>( 0.0, spread )( rng_ );
+          break;
+      }
+
+      delay_ns = std::max<int64_t>( 0, delay_ns + static_cast<int64_t>( extra ) );
+    }
+
+    int64_t release_ns = depart_ns + delay_ns;
+    if( cfg.preserve_order || !impaired_.load() )
+    {
+      release_ns = std::max( release_ns, last_release_ns_ );
+    }
+
+    last_release_ns_ = std::max( last_release_ns_, release_ns );
+    held_.push( HeldMessage{ release_ns, next_seq_++, std::move( data ) } );
+  }
+
+
   void BidirectionalPipe::sendLoop()
   {
+    trace::setThreadName( "pipe tx " + endpoint_ );
+
     while( running_ )
     {
-      std::vector<uint8_t> data;
-      if( send_queue_.pop( data, std::chrono::milliseconds( 1 ) ) )
+      /*-----------------------------------------------------------------------
+      Wake up in time for the next held message. Release times are simulated,
+      so the host wait follows the time scale and holds while time is parked.
+      -----------------------------------------------------------------------*/
+      std::chrono::nanoseconds timeout = std::chrono::milliseconds( 1 );
+      if( !held_.empty() )
       {
-        try
+        const int64_t until_due = mb::time::sim::hostWaitStep( held_.top().release_ns );
+        timeout = std::chrono::nanoseconds( std::min<int64_t>( until_due, timeout.count() ) );
+      }
+
+      /*-----------------------------------------------------------------------
+      Unimpaired traffic goes straight out, unless it would overtake messages
+      still held from an earlier impairment.
+      -----------------------------------------------------------------------*/
+      PooledBuffer data;
+      if( send_queue_.pop( data, timeout ) )
+      {
+        if( impaired_.load( std::memory_order_relaxed ) || !held_.empty() )
         {
-          socket_.send( zmq::buffer( data ), zmq::send_flags::dontwait );
-          // std::cout << endpoint_ << ": TX " << data.size() << " bytes" << std::endl;
+          impair( std::move( data ) );
         }
-        catch( const zmq::error_t &e )
+        else
         {
-          std::cerr << endpoint_ << ": Send error: " << e.what() << std::endl;
+          transmit( std::move( data ) );
         }
       }
+
+      const int64_t now = mb::time::sim::nanos();
+      while( !held_.empty() && ( held_.top().release_ns <= now ) )
+      {
+        /*---------------------------------------------------------------------
+        Safe to move out of the top, it is popped right after
+        ---------------------------------------------------------------------*/
+        transmit( std::move( const_cast<HeldMessage &>( held_.top() ).data ) );
+        held_.pop();
+      }
     }
   }
 
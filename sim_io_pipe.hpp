@@ -20,39 +20,169 @@ Includes
 #include <string>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include "sim_buffer_pool.hpp"
 #include "sim_queue.hpp"
 
 namespace mb::hw::sim
 {
+  /*---------------------------------------------------------------------------
+  Enumerations
+  ---------------------------------------------------------------------------*/
+
+  enum class JitterDistribution : uint8_t
+  {
+    UNIFORM,     /**< Evenly spread over [0, jitter] */
+    NORMAL,      /**< Zero mean, jitter is the standard deviation */
+    EXPONENTIAL, /**< Long tailed, jitter is the mean */
+  };
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Imperfections applied to messages leaving a pipe. All times and rates are simulated.
+   */
+  struct LinkImpairment
+  {
+    int64_t            latency_ns     = 0;                           /**< Fixed delay added to every message */
+    int64_t            jitter_ns      = 0;                           /**< Spread of the random extra delay */
+    JitterDistribution jitter         = JitterDistribution::UNIFORM; /**< Shape of the random extra delay */
+    bool               preserve_order = true;                        /**< Never let jitter reorder messages */
+    uint64_t           bandwidth_bps  = 0;                           /**< Link rate in bits per second, 0 is unlimited */
+    uint32_t           bits_per_byte  = 8;                           /**< Bits on the wire per byte, 10 for UART 8N1 */
+    size_t             burst_bytes    = 0;                           /**< Bytes that may go out back to back at full speed */
+    double             loss_rate      = 0.0;                         /**< Probability a message is dropped */
+    double             corrupt_rate   = 0.0;                         /**< Probability a message gets one bit flipped */
+    uint64_t           seed           = 1;                           /**< Random number seed, for reproducible runs */
+  };
+
+  struct LinkStats
+  {
+    uint64_t submitted; /**< Messages written to the pipe */
+    uint64_t dropped;   /**< Messages lost to the loss rate */
+    uint64_t corrupted; /**< Messages that had a bit flipped */
+    uint64_t delivered; /**< Messages accepted by the socket */
+  };
+
   /*---------------------------------------------------------------------------
   Classes
   ---------------------------------------------------------------------------*/
   class BidirectionalPipe
   {
   public:
-    using ReceiveCallback = std::function<void( const std::vector<uint8_t> & )>;
+    /**
+     * @brief Receives one message. The memory is only valid during the call.
+     */
+    using ReceiveCallback = std::function<void( const uint8_t *data, const size_t size )>;
 
+    /**
+     * @brief Creates a pipe on a ZMQ PAIR socket.
+     *
+     * Pipes on inproc:// endpoints share one process-wide context, so nodes
+     * simulated in the same process can be wired together without sockets.
+     *
+     * @param endpoint  ZMQ endpoint string
+     * @param bind      True to bind the endpoint, false to connect to it
+     */
     BidirectionalPipe( const std::string &endpoint, bool bind );
     ~BidirectionalPipe();
 
     bool start();
     void stop();
+    void write( const void *data, const size_t size );
     void write( const std::vector<uint8_t> &data );
+    void write( PooledBuffer &&buffer );
+
+    /**
+     * @brief Installs the handler for incoming messages. Safe from any thread.
+     *
+     * A call already running on the receive thread finishes with the handler
+     * it started with, which stays alive until then.
+     *
+     * @param callback  Handler, or nullptr to drop incoming messages
+     */
     void setReceiveCallback( ReceiveCallback callback );
 
+    /**
+     * @brief Degrades outgoing traffic to model a real link.
+     *
+     * Messages are delayed by the latency, jitter and bandwidth settings, held
+     * in a time ordered heap on the send thread, and released to the socket
+     * when due. Replaces any earlier impairment and reseeds the generator.
+     *
+     * Settings are rejected, and the link left as it was, if latency or jitter
+     * is negative, bandwidth is set with zero bits per byte, or a rate is
+     * outside [0, 1].
+     *
+     * @param config  Link behavior to apply
+     * @return true   The impairment was applied
+     */
+    bool setImpairment( const LinkImpairment &config );
+
+    /**
+     * @brief Returns to instant, lossless delivery. Messages already held still go out on time.
+     */
+    void clearImpairment();
+
+    /**
+     * @brief Gets the counters of the send path
+     *
+     * @return LinkStats
+     */
+    LinkStats getLinkStats() const;
+
   private:
+    struct HeldMessage
+    {
+      int64_t      release_ns;
+      uint64_t     seq;
+      PooledBuffer data;
+    };
+
+    struct LaterRelease
+    {
+      bool operator()( const HeldMessage &lhs, const HeldMessage &rhs ) const
+      {
+        return ( lhs.release_ns != rhs.release_ns ) ? ( lhs.release_ns > rhs.release_ns ) : ( lhs.seq > rhs.seq );
+      }
+    };
+
+    using HeldQueue = std::priority_queue<HeldMessage, std::vector<HeldMessage>, LaterRelease>;
+
     void receiveLoop();
     void sendLoop();
+    void transmit( PooledBuffer &&data );
+    void impair( PooledBuffer &&data );
+
+    std::string                            endpoint_;
+    bool                                   should_bind_;
+    std::shared_ptr<zmq::context_t>        context_;
+    zmq::socket_t                          socket_;
+    std::atomic<bool>                      running_{ false };
+    std::thread                            receive_thread_;
+    std::thread                            send_thread_;
+    ThreadSafeQueue<PooledBuffer>          send_queue_;
+    std::mutex                             callback_lock_;
+    std::shared_ptr<const ReceiveCallback> receive_callback_;
 
-    std::string                           endpoint_;
-    bool                                  should_bind_;
-    zmq::context_t                        context_;
-    zmq::socket_t                         socket_;
-    std::atomic<bool>                     running_{ false };
-    std::thread                           receive_thread_;
-    std::thread                           send_thread_;
-    ThreadSafeQueue<std::vector<uint8_t>> send_queue_;
-    ReceiveCallback                       receive_callback_;
+    std::mutex            impair_lock_;
+    std::atomic<bool>     impaired_{ false };
+    LinkImpairment        impairment_;
+    std::mt19937_64       rng_;
+    double                tokens_          = 0.0;
+    int64_t               refill_ns_       = 0;
+    int64_t               last_release_ns_ = 0;
+    uint64_t              next_seq_        = 0;
+    HeldQueue             held_;
+    std::atomic<uint64_t> submitted_{ 0 };
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::atomic<uint64_t> corrupted_{ 0 };
+    std::atomic<uint64_t> delivered_{ 0 };
   };
 }    // namespace mb::hw::sim
 
@@ -0,0 +1,304 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_lock_profiler.cpp
+ *
+ *  Description:
+ *    Contention profiler for the simulated OSAL lock primitives
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mbedutils/threading.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sim_lock_profiler.hpp"
+#include "sim_osal.hpp"
+
+namespace mb::hw::sim::lockprof
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct Record
+  {
+    LockKind kind;
+    uint64_t acquisitions;
+    uint64_t contended;
+    int64_t  wait_total_ns;
+    int64_t  wait_max_ns;
+    int64_t  hold_total_ns;
+    int64_t  hold_max_ns;
+  };
+
+  /**
+   * @brief Statistics gathered by a single thread.
+   *
+   * Only the owning thread writes into a buffer, so its lock is uncontended
+   * outside of reporting. This keeps the profiler from serializing the very
+   * locks it is trying to measure.
+   */
+  struct ThreadBuffer
+  {
+    std::mutex                           lock;
+    std::string                          name;
+    std::unordered_map<uint64_t, Record> records;
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  std::atomic<bool> g_enabled{ false };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::atomic<uint64_t>                      s_next_id{ 1 };
+  static std::mutex                                 s_registry_lock;
+  static std::vector<std::shared_ptr<ThreadBuffer>> s_buffers;
+  static std::unordered_map<uint64_t, const char *> s_tags;
+  static std::atomic<bool>                          s_report_registered{ false };
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Gets the calling thread's buffer, creating it on first use
+   */
+  static ThreadBuffer &local_buffer()
+  {
+    thread_local std::shared_ptr<ThreadBuffer> tls_buffer;
+
+    if( !tls_buffer )
+    {
+      tls_buffer       = std::make_shared<ThreadBuffer>();
+      tls_buffer->name = std::string( mb::thread::this_thread::get_name() );
+      if( tls_buffer->name.empty() )
+      {
+        tls_buffer->name = "<host thread>";
+      }
+
+      std::lock_guard<std::mutex> lock( s_registry_lock );
+      s_buffers.push_back( tls_buffer );
+    }
+
+    return *tls_buffer;
+  }
+
+
+  static Record &local_record( ThreadBuffer &buffer, const uint64_t id, const LockKind kind )
+  {
+    return buffer.records.try_emplace( id, Record{ kind, 0, 0, 0, 0, 0, 0 } ).first->second;
+  }
+
+
+  static const char *kind_to_str( const LockKind kind )
+  {
+    switch( kind )
+    {
+      case LockKind::MUTEX:
+        return "mutex";
+
+      case LockKind::RECURSIVE_MUTEX:
+        return "rmutex";
+
+      case LockKind::SEMAPHORE:
+        return "smphr";
+
+      default:
+        return "unknown";
+    }
+  }
+
+
+  static void report_at_exit()
+  {
+    mb::osal::sim::reportLockProfile( std::cerr );
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  uint64_t registerLock()
+  {
+    return s_next_id.fetch_add( 1, std::memory_order_relaxed );
+  }
+
+
+  void setTag( const uint64_t id, const char *tag )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+    s_tags[ id ] = tag;
+  }
+
+
+  void onAcquire( const uint64_t id, const LockKind kind, const bool contended, const int64_t wait_ns )
+  {
+    ThreadBuffer               &buffer = local_buffer();
+    std::lock_guard<std::mutex> lock( buffer.lock );
+    Record                     &record = local_record( buffer, id, kind );
+
+    record.acquisitions++;
+    if( contended )
+    {
+      record.contended++;
+      record.wait_total_ns += wait_ns;
+      record.wait_max_ns = std::max( record.wait_max_ns, wait_ns );
+    }
+  }
+
+
+  void onRelease( const uint64_t id, const LockKind kind, const int64_t hold_ns )
+  {
+    ThreadBuffer               &buffer = local_buffer();
+    std::lock_guard<std::mutex> lock( buffer.lock );
+    Record                     &record = local_record( buffer, id, kind );
+
+    record.hold_total_ns += hold_ns;
+    record.hold_max_ns = std::max( record.hold_max_ns, hold_ns );
+  }
+
+
+  int64_t timestamp()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+  }
+}    // namespace mb::hw::sim::lockprof
+
+
+namespace mb::osal::sim
+{
+  using namespace mb::hw::sim::lockprof;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void enableLockProfiling( const bool enable, const bool report_at_exit )
+  {
+    g_enabled.store( enable, std::memory_order_relaxed );
+
+    if( report_at_exit && !s_report_registered.exchange( true ) )
+    {
+      std::atexit( mb::hw::sim::lockprof::report_at_exit );
+    }
+  }
+
+
+  std::vector<LockProfileEntry> getLockProfile()
+  {
+    struct Accumulator
+    {
+      LockProfileEntry entry;
+      int64_t          owner_weight;
+    };
+
+    std::unordered_map<uint64_t, Accumulator> merged;
+    std::lock_guard<std::mutex>               registry_lock( s_registry_lock );
+
+    /*-------------------------------------------------------------------------
+    Merge each thread's view of every lock. The owner is taken to be whichever
+    thread held the lock the longest (or acquired it most, for semaphores).
+    -------------------------------------------------------------------------*/
+    for( auto &buffer : s_buffers )
+    {
+      std::lock_guard<std::mutex> buffer_lock( buffer->lock );
+      for( auto &[ id, record ] : buffer->records )
+      {
+        auto &acc        = merged[ id ];
+        auto &entry      = acc.entry;
+        entry.id         = id;
+        entry.kind       = kind_to_str( record.kind );
+        entry.acquisitions += record.acquisitions;
+        entry.contended += record.contended;
+        entry.wait_total_ns += record.wait_total_ns;
+        entry.wait_max_ns = std::max( entry.wait_max_ns, record.wait_max_ns );
+        entry.hold_total_ns += record.hold_total_ns;
+        entry.hold_max_ns = std::max( entry.hold_max_ns, record.hold_max_ns );
+
+        const int64_t weight = record.hold_total_ns ? record.hold_total_ns : static_cast<int64_t>( record.acquisitions );
+        if( entry.owner.empty() || ( weight > acc.owner_weight ) )
+        {
+          entry.owner      = buffer->name;
+          acc.owner_weight = weight;
+        }
+      }
+    }
+
+    std::vector<LockProfileEntry> result;
+    result.reserve( merged.size() );
+    for( auto &[ id, acc ] : merged )
+    {
+      auto tag_iter = s_tags.find( id );
+      if( tag_iter != s_tags.end() && tag_iter->second )
+      {
+        acc.entry.tag = tag_iter->second;
+      }
+
+      result.push_back( std::move( acc.entry ) );
+    }
+
+    /*-------------------------------------------------------------------------
+    Hottest locks first: most time spent waiting, then most contention
+    -------------------------------------------------------------------------*/
+    std::sort( result.begin(), result.end(), []( const LockProfileEntry &a, const LockProfileEntry &b ) {
+      if( a.wait_total_ns != b.wait_total_ns )
+      {
+        return a.wait_total_ns > b.wait_total_ns;
+      }
+      return a.contended > b.contended;
+    } );
+
+    return result;
+  }
+
+
+  void resetLockProfile()
+  {
+    std::lock_guard<std::mutex> registry_lock( s_registry_lock );
+    for( auto &buffer : s_buffers )
+    {
+      std::lock_guard<std::mutex> buffer_lock( buffer->lock );
+      buffer->records.clear();
+    }
+  }
+
+
+  void reportLockProfile( std::ostream &stream, const size_t max_entries )
+  {
+    auto profile = getLockProfile();
+
+    stream << "Lock contention profile (" << profile.size() << " locks)\n";
+    stream << std::left << std::setw( 8 ) << "kind" << std::setw( 24 ) << "tag" << std::setw( 20 ) << "owner" << std::right
+           << std::setw( 12 ) << "acquires" << std::setw( 12 ) << "contended" << std::setw( 14 ) << "wait_tot_us"
+           << std::setw( 14 ) << "wait_max_us" << std::setw( 14 ) << "hold_tot_us" << std::setw( 14 ) << "hold_max_us" << "\n";
+
+    for( size_t i = 0; i < profile.size() && i < max_entries; i++ )
+    {
+      const auto &entry = profile[ i ];
+      const auto  tag   = entry.tag.empty() ? ( "#" + std::to_string( entry.id ) ) : entry.tag;
+
+      stream << std::left << std::setw( 8 ) << entry.kind << std::setw( 24 ) << tag << std::setw( 20 ) << entry.owner
+             << std::right << std::setw( 12 ) << entry.acquisitions << std::setw( 12 ) << entry.contended << std::setw( 14 )
+             << entry.wait_total_ns / 1000 << std::setw( 14 ) << entry.wait_max_ns / 1000 << std::setw( 14 )
+             << entry.hold_total_ns / 1000 << std::setw( 14 ) << entry.hold_max_ns / 1000 << "\n";
+    }
+
+    stream.flush();
+  }
+}    // namespace mb::osal::sim
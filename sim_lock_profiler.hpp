@@ -0,0 +1,95 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_lock_profiler.hpp
+ *
+ *  Description:
+ *    Contention profiler hooks for the simulated OSAL lock primitives
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_LOCK_PROFILER_HPP
+#define MBEDUTILS_SIM_LOCK_PROFILER_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cstdint>
+
+namespace mb::hw::sim::lockprof
+{
+  /*---------------------------------------------------------------------------
+  Enumerations
+  ---------------------------------------------------------------------------*/
+
+  enum class LockKind : uint8_t
+  {
+    MUTEX,
+    RECURSIVE_MUTEX,
+    SEMAPHORE
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  extern std::atomic<bool> g_enabled;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Checks if lock profiling is turned on. Cheap enough for hot paths.
+   */
+  static inline bool enabled()
+  {
+    return g_enabled.load( std::memory_order_relaxed );
+  }
+
+  /**
+   * @brief Assigns a unique profiling identity to a newly created lock
+   *
+   * @return uint64_t Identifier to pass to the other hooks
+   */
+  uint64_t registerLock();
+
+  /**
+   * @brief Attaches a human readable tag to a lock, typically its creation site
+   *
+   * @param id    Identifier from registerLock()
+   * @param tag   String with static storage duration
+   */
+  void setTag( const uint64_t id, const char *tag );
+
+  /**
+   * @brief Records a completed acquisition in the calling thread's buffer
+   *
+   * @param id        Identifier from registerLock()
+   * @param kind      What type of primitive the lock is
+   * @param contended True if the caller had to wait for the lock
+   * @param wait_ns   How long the caller waited
+   */
+  void onAcquire( const uint64_t id, const LockKind kind, const bool contended, const int64_t wait_ns );
+
+  /**
+   * @brief Records how long a lock was held before being released
+   *
+   * @param id        Identifier from registerLock()
+   * @param kind      What type of primitive the lock is
+   * @param hold_ns   Time between acquisition and release
+   */
+  void onRelease( const uint64_t id, const LockKind kind, const int64_t hold_ns );
+
+  /**
+   * @brief Timestamp source used for all profiler measurements
+   *
+   * @return int64_t Monotonic time in nanoseconds
+   */
+  int64_t timestamp();
+
+}    // namespace mb::hw::sim::lockprof
+
+#endif /* !MBEDUTILS_SIM_LOCK_PROFILER_HPP */
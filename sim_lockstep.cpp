@@ -0,0 +1,578 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_lockstep.cpp
+ *
+ *  Description:
+ *    Lockstep synchronization of simulated time across simulator processes
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mbedutils/logging.hpp>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <vector>
+#include <zmq.hpp>
+#include "sim_buffer_pool.hpp"
+#include "sim_lockstep.hpp"
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
+
+namespace mb::hw::sim::lockstep
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct Envelope
+  {
+    LockstepHeader header;
+    int64_t        deliver_ns;
+    PooledBuffer   payload;
+  };
+
+  /**
+   * @brief Total order used for both relaying and delivery. Host timing never enters into it.
+   */
+  struct EarlierSent
+  {
+    bool operator()( const Envelope &lhs, const Envelope &rhs ) const
+    {
+      if( lhs.header.sim_ns != rhs.header.sim_ns )
+      {
+        return lhs.header.sim_ns < rhs.header.sim_ns;
+      }
+
+      return ( lhs.header.src != rhs.header.src ) ? ( lhs.header.src < rhs.header.src )
+                                                  : ( lhs.header.sequence < rhs.header.sequence );
+    }
+  };
+
+  struct LaterDelivery
+  {
+    bool operator()( const Envelope &lhs, const Envelope &rhs ) const
+    {
+      if( lhs.deliver_ns != rhs.deliver_ns )
+      {
+        return lhs.deliver_ns > rhs.deliver_ns;
+      }
+
+      return EarlierSent()( rhs, lhs );
+    }
+  };
+
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  using Inbox = std::priority_queue<Envelope, std::vector<Envelope>, LaterDelivery>;
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::atomic<bool> s_coordinator_running{ false };
+  static std::thread       s_coordinator_thread;
+
+  static std::mutex              s_node_lock;
+  static std::condition_variable s_node_cv;
+  static std::thread             s_agent_thread;
+  static std::atomic<bool>       s_agent_running{ false };
+  static std::atomic<bool>       s_run_active{ false };
+  static NodeConfig              s_node_cfg;
+  static int64_t                 s_base_ns;
+  static uint64_t                s_next_sequence;
+  static std::vector<Envelope>   s_outbox;
+  static ReceiveCallback         s_callback;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static LockstepHeader make_header( const MessageType type, const uint32_t src, const uint32_t dst, const int64_t sim_ns,
+                                     const uint64_t sequence )
+  {
+    LockstepHeader header;
+    header.magic    = LOCKSTEP_MAGIC;
+    header.type     = type;
+    header.reserved = 0;
+    header.src      = src;
+    header.dst      = dst;
+    header.sim_ns   = sim_ns;
+    header.sequence = sequence;
+
+    return header;
+  }
+
+
+  static bool parse( const zmq::message_t &frame, LockstepHeader &header )
+  {
+    if( frame.size() < sizeof( LockstepHeader ) )
+    {
+      return false;
+    }
+
+    memcpy( &header, frame.data(), sizeof( LockstepHeader ) );
+    return header.magic == LOCKSTEP_MAGIC;
+  }
+
+
+  static zmq::message_t make_frame( const LockstepHeader &header, const PooledBuffer *payload = nullptr )
+  {
+    const size_t   payload_size = payload ? payload->size() : 0;
+    zmq::message_t frame( sizeof( LockstepHeader ) + payload_size );
+
+    memcpy( frame.data(), &header, sizeof( LockstepHeader ) );
+    if( payload_size )
+    {
+      memcpy( static_cast<uint8_t *>( frame.data() ) + sizeof( LockstepHeader ), payload->data(), payload_size );
+    }
+
+    return frame;
+  }
+
+
+  static PooledBuffer payload_of( const zmq::message_t &frame )
+  {
+    return PooledBuffer( static_cast<const uint8_t *>( frame.data() ) + sizeof( LockstepHeader ),
+                         frame.size() - sizeof( LockstepHeader ) );
+  }
+
+
+  static void send_to( zmq::socket_t &socket, const std::string &identity, zmq::message_t &&frame )
+  {
+    socket.send( zmq::message_t( identity.data(), identity.size() ), zmq::send_flags::sndmore );
+    socket.send( std::move( frame ), zmq::send_flags::none );
+  }
+
+
+  static void broadcast( zmq::socket_t &socket, const std::map<uint32_t, std::string> &peers, const LockstepHeader &header )
+  {
+    for( const auto &peer : peers )
+    {
+      send_to( socket, peer.second, make_frame( header ) );
+    }
+  }
+
+
+  /**
+   * @brief Hands every message that is due to the receive handler
+   */
+  static void deliver_due( Inbox &inbox, const int64_t now )
+  {
+    while( !inbox.empty() && ( inbox.top().deliver_ns <= now ) )
+    {
+      ReceiveCallback callback;
+      {
+        std::lock_guard<std::mutex> lock( s_node_lock );
+        callback = s_callback;
+      }
+
+      const Envelope &msg = inbox.top();
+      if( callback )
+      {
+        callback( msg.header.src, msg.header.sim_ns, msg.payload.data(), msg.payload.size() );
+      }
+
+      inbox.pop();
+    }
+  }
+
+
+  /**
+   * @brief Lets simulated time run up to the granted horizon, then reports back
+   *
+   * @param socket    Connection to the coordinator
+   * @param inbox     Messages waiting for their delivery time
+   * @param horizon   Lockstep time granted
+   * @param quantum   Number of the granted quantum
+   */
+  static void run_quantum( zmq::socket_t &socket, Inbox &inbox, const int64_t horizon, const uint64_t quantum )
+  {
+    mb::time::sim::setTimeHorizon( s_base_ns + horizon );
+
+    while( s_agent_running.load() )
+    {
+      const int64_t now = mb::time::sim::nanos() - s_base_ns;
+      deliver_due( inbox, now );
+
+      if( now >= horizon )
+      {
+        break;
+      }
+
+      const int64_t wake_at = inbox.empty() ? horizon : std::min( inbox.top().deliver_ns, horizon );
+      mb::time::sim::sleepUntil( s_base_ns + wake_at );
+    }
+
+    /*-------------------------------------------------------------------------
+    Everything sent this quantum must reach the coordinator before DONE does
+    -------------------------------------------------------------------------*/
+    std::vector<Envelope> outbox;
+    {
+      std::lock_guard<std::mutex> lock( s_node_lock );
+      outbox.swap( s_outbox );
+    }
+
+    for( auto &msg : outbox )
+    {
+      socket.send( make_frame( msg.header, &msg.payload ), zmq::send_flags::none );
+    }
+
+    socket.send( make_frame( make_header( MSG_DONE, s_node_cfg.node_id, 0, horizon, quantum ) ), zmq::send_flags::none );
+  }
+
+
+  static void agent_loop()
+  {
+    trace::setThreadName( "lockstep " + std::to_string( s_node_cfg.node_id ) );
+
+    zmq::context_t context( 1 );
+    zmq::socket_t  socket( context, zmq::socket_type::dealer );
+    Inbox          inbox;
+    int64_t        quantum_start = 0;
+
+    try
+    {
+      socket.set( zmq::sockopt::routing_id, "node-" + std::to_string( s_node_cfg.node_id ) );
+      socket.set( zmq::sockopt::linger, 0 );
+      socket.connect( s_node_cfg.endpoint );
+      socket.send( make_frame( make_header( MSG_HELLO, s_node_cfg.node_id, 0, 0, 0 ) ), zmq::send_flags::none );
+
+      while( s_agent_running.load() )
+      {
+        zmq::pollitem_t items[] = { { socket, 0, ZMQ_POLLIN, 0 } };
+        zmq::poll( items, 1, std::chrono::milliseconds( 10 ) );
+
+        zmq::message_t frame;
+        LockstepHeader header;
+        if( !( items[ 0 ].revents & ZMQ_POLLIN ) || !socket.recv( frame, zmq::recv_flags::dontwait ) ||
+            !parse( frame, header ) )
+        {
+          continue;
+        }
+
+        if( header.type == MSG_DATA )
+        {
+          /*-------------------------------------------------------------------
+          A latency shorter than the quantum can put delivery in the past
+          -------------------------------------------------------------------*/
+          const int64_t deliver_ns = std::max( header.sim_ns + s_node_cfg.latency_ns, quantum_start );
+          inbox.push( Envelope{ header, deliver_ns, payload_of( frame ) } );
+        }
+        else if( header.type == MSG_GRANT )
+        {
+          if( !s_run_active.load() )
+          {
+            {
+              std::lock_guard<std::mutex> lock( s_node_lock );
+              s_run_active.store( true );
+            }
+            s_node_cv.notify_all();
+          }
+
+          run_quantum( socket, inbox, header.sim_ns, header.sequence );
+          quantum_start = header.sim_ns;
+        }
+        else if( header.type == MSG_STOP )
+        {
+          s_run_active.store( false );
+          break;
+        }
+      }
+
+      /*-----------------------------------------------------------------------
+      Leaving while the run is still going, let the others carry on without us
+      -----------------------------------------------------------------------*/
+      s_run_active.store( false );
+      if( !s_agent_running.load() )
+      {
+        socket.send( make_frame( make_header( MSG_BYE, s_node_cfg.node_id, 0, 0, 0 ) ), zmq::send_flags::dontwait );
+      }
+    }
+    catch( const zmq::error_t &e )
+    {
+      LOG_ERROR( "Lockstep node %u failed: %s", s_node_cfg.node_id, e.what() );
+      s_run_active.store( false );
+    }
+
+    /*-------------------------------------------------------------------------
+    No more grants will come, whether the run was stopped or the link failed.
+    Let time run freely so tasks sleeping past the last horizon wake up.
+    -------------------------------------------------------------------------*/
+    mb::time::sim::setTimeHorizon( mb::time::sim::NO_TIME_HORIZON );
+
+    socket.close();
+    context.close();
+  }
+
+  static bool coordinator_loop( const CoordinatorConfig &cfg )
+  {
+    zmq::context_t context( 1 );
+    zmq::socket_t  socket( context, zmq::socket_type::router );
+    bool           result = false;
+
+    std::map<uint32_t, std::string> peers;
+    std::set<uint32_t>              done;
+    std::vector<Envelope>           batch;
+    uint64_t                        quantum = 0;
+    int64_t                         horizon = 0;
+    bool                            started = false;
+
+    try
+    {
+      socket.set( zmq::sockopt::linger, 0 );
+      socket.bind( cfg.endpoint );
+
+      while( s_coordinator_running.load() )
+      {
+        zmq::pollitem_t items[] = { { socket, 0, ZMQ_POLLIN, 0 } };
+        zmq::poll( items, 1, std::chrono::milliseconds( 10 ) );
+
+        zmq::message_t identity;
+        zmq::message_t frame;
+        LockstepHeader header;
+        if( !( items[ 0 ].revents & ZMQ_POLLIN ) || !socket.recv( identity, zmq::recv_flags::dontwait ) ||
+            !identity.more() || !socket.recv( frame, zmq::recv_flags::none ) || !parse( frame, header ) )
+        {
+          continue;
+        }
+
+        switch( header.type )
+        {
+          case MSG_HELLO:
+            if( started )
+            {
+              LOG_ERROR( "Lockstep node %u joined after the run started", header.src );
+              break;
+            }
+
+            peers[ header.src ] = identity.to_string();
+            if( peers.size() == cfg.node_count )
+            {
+              started = true;
+              horizon = cfg.quantum_ns;
+              broadcast( socket, peers, make_header( MSG_GRANT, 0, 0, horizon, quantum ) );
+            }
+            break;
+
+          case MSG_DATA:
+            batch.push_back( Envelope{ header, 0, payload_of( frame ) } );
+            break;
+
+          case MSG_DONE:
+            if( header.sequence == quantum )
+            {
+              done.insert( header.src );
+            }
+            break;
+
+          case MSG_BYE:
+            peers.erase( header.src );
+            done.erase( header.src );
+            break;
+
+          default:
+            break;
+        }
+
+        if( !started )
+        {
+          continue;
+        }
+
+        if( peers.empty() )
+        {
+          result = true;
+          break;
+        }
+
+        if( done.size() < peers.size() )
+        {
+          continue;
+        }
+
+        /*---------------------------------------------------------------------
+        Barrier reached. Relay this quantum's messages in a host independent
+        order, then open the next quantum or end the run.
+        ---------------------------------------------------------------------*/
+        std::sort( batch.begin(), batch.end(), EarlierSent() );
+        for( auto &msg : batch )
+        {
+          auto peer = peers.find( msg.header.dst );
+          if( peer != peers.end() )
+          {
+            send_to( socket, peer->second, make_frame( msg.header, &msg.payload ) );
+          }
+        }
+
+        batch.clear();
+        done.clear();
+        quantum++;
+
+        if( cfg.end_ns && ( horizon >= cfg.end_ns ) )
+        {
+          broadcast( socket, peers, make_header( MSG_STOP, 0, 0, horizon, quantum ) );
+          result = true;
+          break;
+        }
+
+        horizon += cfg.quantum_ns;
+        broadcast( socket, peers, make_header( MSG_GRANT, 0, 0, horizon, quantum ) );
+      }
+    }
+    catch( const zmq::error_t &e )
+    {
+      LOG_ERROR( "Lockstep coordinator on %s failed: %s", cfg.endpoint.c_str(), e.what() );
+    }
+
+    socket.close();
+    context.close();
+    s_coordinator_running.store( false );
+    return result;
+  }
+
+
+  static bool valid( const CoordinatorConfig &cfg )
+  {
+    if( !cfg.node_count || ( cfg.quantum_ns <= 0 ) )
+    {
+      LOG_ERROR( "Lockstep coordinator needs at least one node and a positive quantum" );
+      return false;
+    }
+
+    return true;
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool runCoordinator( const CoordinatorConfig &cfg )
+  {
+    if( !valid( cfg ) || s_coordinator_running.exchange( true ) )
+    {
+      return false;
+    }
+
+    return coordinator_loop( cfg );
+  }
+
+
+  bool startCoordinator( const CoordinatorConfig &cfg )
+  {
+    if( !valid( cfg ) || s_coordinator_thread.joinable() || s_coordinator_running.exchange( true ) )
+    {
+      return false;
+    }
+
+    s_coordinator_thread = std::thread( [ cfg ]() { coordinator_loop( cfg ); } );
+    return true;
+  }
+
+
+  void stopCoordinator()
+  {
+    s_coordinator_running.store( false );
+
+    if( s_coordinator_thread.joinable() )
+    {
+      s_coordinator_thread.join();
+    }
+  }
+
+
+  bool join( const NodeConfig &cfg, const uint32_t timeout_ms )
+  {
+    if( s_agent_running.load() || s_agent_thread.joinable() )
+    {
+      return false;
+    }
+
+    /*-------------------------------------------------------------------------
+    Park time where it is now, that point becomes lockstep time zero
+    -------------------------------------------------------------------------*/
+    s_base_ns = mb::time::sim::setTimeHorizon( mb::time::sim::nanos() );
+
+    s_node_cfg      = cfg;
+    s_next_sequence = 0;
+    s_outbox.clear();
+    s_run_active.store( false );
+    s_agent_running.store( true );
+    s_agent_thread = std::thread( agent_loop );
+
+    std::unique_lock<std::mutex> lock( s_node_lock );
+    if( !s_node_cv.wait_for( lock, std::chrono::milliseconds( timeout_ms ), []() { return s_run_active.load(); } ) )
+    {
+      lock.unlock();
+      LOG_ERROR( "Lockstep run on %s didn't start in time", cfg.endpoint.c_str() );
+      leave();
+      return false;
+    }
+
+    return true;
+  }
+
+
+  void leave()
+  {
+    s_agent_running.store( false );
+
+    /*-------------------------------------------------------------------------
+    Release the lockstep thread and every task if time is parked
+    -------------------------------------------------------------------------*/
+    mb::time::sim::setTimeHorizon( mb::time::sim::NO_TIME_HORIZON );
+
+    if( s_agent_thread.joinable() )
+    {
+      s_agent_thread.join();
+    }
+  }
+
+
+  bool running()
+  {
+    return s_run_active.load();
+  }
+
+
+  int64_t now()
+  {
+    return mb::time::sim::nanos() - s_base_ns;
+  }
+
+
+  bool send( const uint32_t dst, const void *data, const size_t size )
+  {
+    if( !s_agent_running.load() )
+    {
+      return false;
+    }
+
+    const int64_t sent_ns = now();
+
+    std::lock_guard<std::mutex> lock( s_node_lock );
+    s_outbox.push_back(
+        Envelope{ make_header( MSG_DATA, s_node_cfg.node_id, dst, sent_ns, s_next_sequence++ ), 0, PooledBuffer( data, size ) } );
+    return true;
+  }
+
+
+  void onReceive( ReceiveCallback callback )
+  {
+    std::lock_guard<std::mutex> lock( s_node_lock );
+    s_callback = std::move( callback );
+  }
+
+}    // namespace mb::hw::sim::lockstep
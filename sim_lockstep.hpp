@@ -0,0 +1,189 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_lockstep.hpp
+ *
+ *  Description:
+ *    Lockstep synchronization of simulated time across simulator processes
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_LOCKSTEP_HPP
+#define MBEDUTILS_SIM_LOCKSTEP_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace mb::hw::sim::lockstep
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr uint32_t LOCKSTEP_MAGIC = 0x4B434F4C; /**< "LOCK" on the wire */
+
+  /**
+   * @brief Kinds of message exchanged between nodes and the coordinator
+   */
+  enum MessageType : uint16_t
+  {
+    MSG_HELLO = 0, /**< Node -> coordinator: node wants to take part */
+    MSG_GRANT = 1, /**< Coordinator -> node: advance to sim_ns, quantum number in sequence */
+    MSG_DONE  = 2, /**< Node -> coordinator: reached the horizon of quantum sequence */
+    MSG_DATA  = 3, /**< Timestamped payload from src to dst, relayed at the barrier */
+    MSG_STOP  = 4, /**< Coordinator -> node: the run is over */
+    MSG_BYE   = 5, /**< Node -> coordinator: node is leaving */
+  };
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Leading header of every lockstep message, little endian.
+   *
+   * MSG_DATA is followed by the payload bytes in the same frame. All times are
+   * lockstep time, which starts at zero on every node when it joins.
+   */
+  struct __attribute__( ( packed ) ) LockstepHeader
+  {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t src;
+    uint32_t dst;
+    int64_t  sim_ns;
+    uint64_t sequence;
+  };
+
+  struct CoordinatorConfig
+  {
+    std::string endpoint;   /**< ZMQ endpoint to bind, ipc:// or tcp:// */
+    uint32_t    node_count; /**< Nodes that must join before time starts */
+    int64_t     quantum_ns; /**< Simulated time granted per barrier */
+    int64_t     end_ns;     /**< Stop once this lockstep time is reached, 0 to run until every node leaves */
+  };
+
+  struct NodeConfig
+  {
+    std::string endpoint;   /**< ZMQ endpoint of the coordinator */
+    uint32_t    node_id;    /**< Unique id of this process within the run */
+    int64_t     latency_ns; /**< Simulated delay of every message. At least one quantum keeps delivery causal. */
+  };
+
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Handler for messages from other nodes
+   *
+   * @param src       Node that sent the message
+   * @param sent_ns   Lockstep time the message was sent at
+   * @param data      Payload bytes
+   * @param size      Number of payload bytes
+   */
+  using ReceiveCallback = std::function<void( const uint32_t src, const int64_t sent_ns, const uint8_t *data, const size_t size )>;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Runs the coordinator on the calling thread until the run ends.
+   *
+   * Waits for node_count nodes to join, then grants simulated time one quantum
+   * at a time. The next quantum is only granted once every node reports it
+   * reached the current horizon, so no node ever gets more than one quantum
+   * ahead of another. Messages sent during a quantum are held back until the
+   * barrier, sorted by (send time, sender, sequence) and relayed before the next
+   * grant, which makes their order independent of host scheduling.
+   *
+   * @param cfg     Coordinator settings
+   * @return true   The run ended normally
+   */
+  bool runCoordinator( const CoordinatorConfig &cfg );
+
+  /**
+   * @brief Runs the coordinator on a background thread
+   *
+   * @param cfg     Coordinator settings
+   * @return true   The coordinator thread started
+   */
+  bool startCoordinator( const CoordinatorConfig &cfg );
+
+  /**
+   * @brief Stops a coordinator started by either runCoordinator() or startCoordinator()
+   */
+  void stopCoordinator();
+
+  /**
+   * @brief Joins a lockstep run. Blocks until every node has joined.
+   *
+   * Simulated time is parked from this point on and only advances as the
+   * coordinator grants it, see mb::time::sim::setTimeHorizon(). Sleeps, delays
+   * and the timer service all follow the granted time.
+   *
+   * @param cfg         Node settings
+   * @param timeout_ms  How long to wait for the run to start
+   * @return true       The run started and time is advancing
+   */
+  bool join( const NodeConfig &cfg, const uint32_t timeout_ms = 5000 );
+
+  /**
+   * @brief Leaves the run. Simulated time runs freely again afterwards.
+   *
+   * Still needed after the coordinator stops the run, to join the lockstep
+   * thread before the next join().
+   */
+  void leave();
+
+  /**
+   * @brief Checks if this process is taking part in a run that hasn't ended
+   *
+   * Once the coordinator stops the run, or the link to it fails, this returns
+   * false and simulated time is released to run freely, as after leave().
+   *
+   * @return true   Joined, and the coordinator hasn't stopped the run
+   */
+  bool running();
+
+  /**
+   * @brief Gets the lockstep time, shared by every node in the run
+   *
+   * @return int64_t  Simulated nanoseconds since the run started
+   */
+  int64_t now();
+
+  /**
+   * @brief Sends a message to another node. Safe from any thread.
+   *
+   * The message is stamped with the current lockstep time and delivered once
+   * the receiver reaches that time plus the configured latency.
+   *
+   * @param dst     Node to deliver to
+   * @param data    Payload bytes
+   * @param size    Number of payload bytes
+   * @return true   The message was queued
+   */
+  bool send( const uint32_t dst, const void *data, const size_t size );
+
+  /**
+   * @brief Installs the handler for messages from other nodes.
+   *
+   * The handler runs on the lockstep thread, in (delivery time, sender,
+   * sequence) order, as soon as simulated time reaches the delivery time.
+   *
+   * @param callback  Function to invoke, or nullptr to drop incoming messages
+   */
+  void onReceive( ReceiveCallback callback );
+
+}    // namespace mb::hw::sim::lockstep
+
+#endif /* !MBEDUTILS_SIM_LOCKSTEP_HPP */
@@ -3,7 +3,7 @@
  *    sim_mutex.cpp
  *
  *  Description:
- *    Implementation of the mutex interface using the C++ standard library
+ *    Implementation of the mutex interface using POSIX thread mutexes
  *
  *  2024 | Brandon Braun | brandonbraun653@protonmail.com
  *****************************************************************************/
@@ -11,23 +11,281 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
-#include <chrono>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
 #include <mbedutils/interfaces/mutex_intf.hpp>
-#include <memory>
-#include <mutex>
-#include <thread>
-#include <unordered_map>
+#include <pthread.h>
+#include <stdexcept>
+#include "sim_futex.hpp"
+#include "sim_lock_profiler.hpp"
+#include "sim_node.hpp"
+#include "sim_osal.hpp"
+#include "sim_pool.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
 
 namespace mb::osal
 {
+  namespace prof  = mb::hw::sim::lockprof;
+  namespace trace = mb::hw::sim::trace;
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Simulated mutex backed by a raw pthread mutex.
+   *
+   * Using pthreads directly rather than the STL lets us select the locking
+   * protocol (priority inheritance) and gives native timed locking.
+   */
+  struct SimMutex
+  {
+    pthread_mutex_t mtx;
+    const bool      recursive;
+    const bool      prio_inherit;
+    uint64_t        profile_id = prof::registerLock();
+    int64_t         hold_start = 0;
+    uint32_t        depth      = 0;
+
+    SimMutex( const bool is_recursive, const bool use_prio_inherit ) :
+        recursive( is_recursive ), prio_inherit( use_prio_inherit )
+    {
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init( &attr );
+      pthread_mutexattr_settype( &attr, recursive ? PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_NORMAL );
+
+      if( prio_inherit )
+      {
+        pthread_mutexattr_setprotocol( &attr, PTHREAD_PRIO_INHERIT );
+      }
+
+      const int err = pthread_mutex_init( &mtx, &attr );
+      pthread_mutexattr_destroy( &attr );
+
+      if( err )
+      {
+        throw std::runtime_error( "Failed to initialize pthread mutex" );
+      }
+    }
+
+    ~SimMutex()
+    {
+      pthread_mutex_destroy( &mtx );
+    }
+
+    void lock()
+    {
+      if( pthread_mutex_trylock( &mtx ) != 0 )
+      {
+        mb::thread::sim::BlockedScope blocked;
+        pthread_mutex_lock( &mtx );
+      }
+    }
+
+    bool try_lock()
+    {
+      return pthread_mutex_trylock( &mtx ) == 0;
+    }
+
+    bool try_lock_for( const size_t timeout_ms )
+    {
+      mb::thread::sim::BlockedScope blocked;
+      const int64_t sim_deadline = mb::time::sim::nanos() + static_cast<int64_t>( timeout_ms ) * 1000000LL;
+
+      /*-----------------------------------------------------------------------
+      Wait in host steps that follow simulated time, so a lockstep horizon
+      holds the timeout back just like it does a sleep.
+      -----------------------------------------------------------------------*/
+      while( true )
+      {
+        const int64_t host_ns = mb::time::sim::hostWaitStep( sim_deadline );
+        if( !host_ns )
+        {
+          return try_lock();
+        }
+
+        if( try_lock_host( host_ns ) )
+        {
+          return true;
+        }
+      }
+    }
+
+    /**
+     * @brief Waits for the lock for a host duration
+     *
+     * @param host_ns   Host nanoseconds to wait at most
+     * @return true     The lock was acquired
+     */
+    bool try_lock_host( const int64_t host_ns )
+    {
+      const timespec deadline = mb::hw::sim::futex::deadline_from_now( host_ns );
+
+      /*-----------------------------------------------------------------------
+      Older kernels can't do PI futexes against CLOCK_MONOTONIC, so fall back
+      to a CLOCK_REALTIME deadline when the monotonic variant is refused.
+      -----------------------------------------------------------------------*/
+      int err = pthread_mutex_clocklock( &mtx, CLOCK_MONOTONIC, &deadline );
+      if( err == EINVAL )
+      {
+        timespec rt_deadline;
+        clock_gettime( CLOCK_REALTIME, &rt_deadline );
+
+        const int64_t total_ns = static_cast<int64_t>( rt_deadline.tv_nsec ) + host_ns;
+        rt_deadline.tv_sec += static_cast<time_t>( total_ns / 1000000000LL );
+        rt_deadline.tv_nsec = static_cast<long>( total_ns % 1000000000LL );
+
+        err = pthread_mutex_timedlock( &mtx, &rt_deadline );
+      }
+
+      return err == 0;
+    }
+
+    void unlock()
+    {
+      pthread_mutex_unlock( &mtx );
+    }
+  };
+
   /*---------------------------------------------------------------------------
   Private Data
   ---------------------------------------------------------------------------*/
-  static std::mutex s_mtx_map_lock;
-  static std::mutex s_rmtx_map_lock;
+  // Pools are leaked on purpose, tasks may still hold their mutexes at exit
+  static auto             &s_mtx_pool  = *new mb::hw::sim::ObjectPool<SimMutex>();
+  static auto             &s_rmtx_pool = *new mb::hw::sim::ObjectPool<SimMutex>();
+  static std::atomic<bool> s_prio_inherit{ false };
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static inline prof::LockKind kind_of( const SimMutex *mtx )
+  {
+    return mtx->recursive ? prof::LockKind::RECURSIVE_MUTEX : prof::LockKind::MUTEX;
+  }
+
+
+  /**
+   * @brief Checks if anything wants lock timing. The profiler and tracer share one clock.
+   */
+  static inline bool observed()
+  {
+    return prof::enabled() || trace::enabled();
+  }
+
+  /**
+   * @brief Bookkeeping done once a lock has been obtained
+   *
+   * @param mtx       Lock that was acquired
+   * @param start     Timestamp when the acquisition began, zero if not observed
+   * @param contended True if the caller had to wait
+   */
+  static inline void on_locked( SimMutex *mtx, const int64_t start, const bool contended )
+  {
+    if( !start )
+    {
+      if( mtx->depth++ == 0 )
+      {
+        mtx->hold_start = 0;
+      }
+      return;
+    }
+
+    const int64_t now = prof::timestamp();
+    if( mtx->depth++ == 0 )
+    {
+      mtx->hold_start = now;
+    }
+
+    if( prof::enabled() )
+    {
+      prof::onAcquire( mtx->profile_id, kind_of( mtx ), contended, contended ? ( now - start ) : 0 );
+    }
+
+    if( contended && trace::enabled() )
+    {
+      trace::complete( trace::Category::LOCK, "mutex wait", start, mtx->profile_id );
+    }
+  }
+
+
+  static void lock_impl( SimMutex *mtx )
+  {
+    if( !observed() )
+    {
+      mtx->lock();
+      on_locked( mtx, 0, false );
+      return;
+    }
+
+    const int64_t start = prof::timestamp();
+    if( mtx->try_lock() )
+    {
+      on_locked( mtx, start, false );
+    }
+    else
+    {
+      mtx->lock();
+      on_locked( mtx, start, true );
+    }
+  }
+
+
+  static bool try_lock_impl( SimMutex *mtx )
+  {
+    if( !mtx->try_lock() )
+    {
+      return false;
+    }
 
-  static std::vector<std::mutex *>           s_mtx_vector;
-  static std::vector<std::recursive_mutex *> s_rmtx_vector;
+    on_locked( mtx, observed() ? prof::timestamp() : 0, false );
+    return true;
+  }
+
+
+  static bool try_lock_for_impl( SimMutex *mtx, const size_t timeout )
+  {
+    const int64_t start = observed() ? prof::timestamp() : 0;
+
+    if( mtx->try_lock() )
+    {
+      on_locked( mtx, start, false );
+      return true;
+    }
+
+    if( !mtx->try_lock_for( timeout ) )
+    {
+      return false;
+    }
+
+    on_locked( mtx, start, true );
+    return true;
+  }
+
+
+  static void unlock_impl( SimMutex *mtx )
+  {
+    /*-------------------------------------------------------------------------
+    Only measure holds that began while profiling or tracing was active
+    -------------------------------------------------------------------------*/
+    if( ( --mtx->depth == 0 ) && mtx->hold_start )
+    {
+      if( prof::enabled() )
+      {
+        prof::onRelease( mtx->profile_id, kind_of( mtx ), prof::timestamp() - mtx->hold_start );
+      }
+
+      if( trace::enabled() )
+      {
+        trace::complete( trace::Category::LOCK, "mutex hold", mtx->hold_start, mtx->profile_id );
+      }
+    }
+
+    mtx->unlock();
+  }
 
   /*---------------------------------------------------------------------------
   Public Functions
@@ -35,29 +293,23 @@ namespace mb::osal
 
   void initMutexDriver()
   {
-    s_mtx_vector.clear();
-    s_rmtx_vector.clear();
+    /*-------------------------------------------------------------------------
+    The pools are ready from static initialization. Nothing is torn down here,
+    other nodes and firmware statics may still hold their mutexes. The warm
+    reset releases a node's own through releaseBootMutexes().
+    -------------------------------------------------------------------------*/
   }
 
   bool createMutex( mb_mutex_t &mutex )
   {
-    std::lock_guard<std::mutex> lock( s_mtx_map_lock );
-
-    s_mtx_vector.push_back( new std::mutex() );
-    mutex = s_mtx_vector.back();
-
-    return true;
+    mutex = s_mtx_pool.allocateTagged( mb::hw::sim::currentNode().bootTag(), false, s_prio_inherit.load() );
+    return mutex != nullptr;
   }
 
   void destroyMutex( mb_mutex_t &mutex )
   {
-    std::lock_guard<std::mutex> lock( s_mtx_map_lock );
-
-    auto it = std::find( s_mtx_vector.begin(), s_mtx_vector.end(), mutex );
-    if( it != s_mtx_vector.end() )
+    if( s_mtx_pool.release( static_cast<SimMutex *>( mutex ) ) )
     {
-      delete *it;
-      s_mtx_vector.erase( it );
       mutex = nullptr;
     }
   }
@@ -74,53 +326,34 @@ namespace mb::osal
 
   void lockMutex( mb_mutex_t mutex )
   {
-    static_cast<std::mutex *>( mutex )->lock();
+    lock_impl( static_cast<SimMutex *>( mutex ) );
   }
 
   bool tryLockMutex( mb_mutex_t mutex )
   {
-    return static_cast<std::mutex *>( mutex )->try_lock();
+    return try_lock_impl( static_cast<SimMutex *>( mutex ) );
   }
 
   bool tryLockMutex( mb_mutex_t mutex, const size_t timeout )
   {
-    // Not directly supported by std::mutex, so we simulate it
-    auto start = std::chrono::steady_clock::now();
-    while( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( timeout ) )
-    {
-      if( static_cast<std::mutex *>( mutex )->try_lock() )
-      {
-        return true;
-      }
-      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-    }
-    return false;
+    return try_lock_for_impl( static_cast<SimMutex *>( mutex ), timeout );
   }
 
   void unlockMutex( mb_mutex_t mutex )
   {
-    static_cast<std::mutex *>( mutex )->unlock();
+    unlock_impl( static_cast<SimMutex *>( mutex ) );
   }
 
   bool createRecursiveMutex( mb_recursive_mutex_t &mutex )
   {
-    std::lock_guard<std::mutex> lock( s_rmtx_map_lock );
-
-    s_rmtx_vector.push_back( new std::recursive_mutex() );
-    mutex = s_rmtx_vector.back();
-
-    return true;
+    mutex = s_rmtx_pool.allocateTagged( mb::hw::sim::currentNode().bootTag(), true, s_prio_inherit.load() );
+    return mutex != nullptr;
   }
 
   void destroyRecursiveMutex( mb_recursive_mutex_t &mutex )
   {
-    std::lock_guard<std::mutex> lock( s_rmtx_map_lock );
-
-    auto it = std::find( s_rmtx_vector.begin(), s_rmtx_vector.end(), mutex );
-    if( it != s_rmtx_vector.end() )
+    if( s_rmtx_pool.release( static_cast<SimMutex *>( mutex ) ) )
     {
-      delete *it;
-      s_rmtx_vector.erase( it );
       mutex = nullptr;
     }
   }
@@ -137,31 +370,102 @@ namespace mb::osal
 
   void lockRecursiveMutex( mb_recursive_mutex_t mutex )
   {
-    static_cast<std::recursive_mutex *>( mutex )->lock();
+    lock_impl( static_cast<SimMutex *>( mutex ) );
   }
 
   bool tryLockRecursiveMutex( mb_recursive_mutex_t mutex )
   {
-    return static_cast<std::recursive_mutex *>( mutex )->try_lock();
+    return try_lock_impl( static_cast<SimMutex *>( mutex ) );
   }
 
   bool tryLockRecursiveMutex( mb_recursive_mutex_t mutex, const size_t timeout )
   {
-    // Not directly supported by std::recursive_mutex, so we simulate it
-    auto start = std::chrono::steady_clock::now();
-    while( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( timeout ) )
+    return try_lock_for_impl( static_cast<SimMutex *>( mutex ), timeout );
+  }
+
+  void unlockRecursiveMutex( mb_recursive_mutex_t mutex )
+  {
+    unlock_impl( static_cast<SimMutex *>( mutex ) );
+  }
+}    // namespace mb::osal
+
+
+namespace mb::osal::sim
+{
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void setMutexPoolCapacity( const size_t capacity )
+  {
+    s_mtx_pool.setCapacity( capacity );
+  }
+
+
+  void setRecursiveMutexPoolCapacity( const size_t capacity )
+  {
+    s_rmtx_pool.setCapacity( capacity );
+  }
+
+
+  size_t releaseBootMutexes()
+  {
+    const mb::hw::sim::Node &node = mb::hw::sim::currentNode();
+    if( !node.bootCount() )
     {
-      if( static_cast<std::recursive_mutex *>( mutex )->try_lock() )
+      return 0;
+    }
+
+    /*-------------------------------------------------------------------------
+    A mutex still held by a cancelled task can't be destroyed, so it leaks
+    -------------------------------------------------------------------------*/
+    const uint64_t tag  = node.bootTag();
+    auto           idle = [ tag ]( const uint64_t owner, SimMutex &mtx ) {
+      if( ( owner != tag ) || !mtx.try_lock() )
       {
-        return true;
+        return false;
       }
-      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-    }
-    return false;
+
+      mtx.unlock();
+      return true;
+    };
+
+    return s_mtx_pool.releaseIf( idle ) + s_rmtx_pool.releaseIf( idle );
   }
 
-  void unlockRecursiveMutex( mb_recursive_mutex_t mutex )
+
+  mb::hw::sim::PoolStats getMutexPoolStats()
   {
-    static_cast<std::recursive_mutex *>( mutex )->unlock();
+    return s_mtx_pool.stats();
   }
-}    // namespace mb::osal
+
+
+  mb::hw::sim::PoolStats getRecursiveMutexPoolStats()
+  {
+    return s_rmtx_pool.stats();
+  }
+
+
+  void tagMutex( mb_mutex_t mutex, const char *tag )
+  {
+    mb::hw::sim::lockprof::setTag( static_cast<SimMutex *>( mutex )->profile_id, tag );
+  }
+
+
+  void tagRecursiveMutex( mb_recursive_mutex_t mutex, const char *tag )
+  {
+    mb::hw::sim::lockprof::setTag( static_cast<SimMutex *>( mutex )->profile_id, tag );
+  }
+
+
+  void enablePriorityInheritance( const bool enable )
+  {
+    s_prio_inherit.store( enable );
+  }
+
+
+  bool priorityInheritanceEnabled()
+  {
+    return s_prio_inherit.load();
+  }
+}    // namespace mb::osal::sim
@@ -0,0 +1,176 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_node.cpp
+ *
+ *  Description:
+ *    Scoping of simulator driver state to individual simulated boards
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <mbedutils/logging.hpp>
+#include <stdexcept>
+#include <vector>
+#include "sim_node.hpp"
+
+namespace mb::hw::sim
+{
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::atomic<size_t> s_next_slot{ 0 };
+  static std::mutex          s_registry_lock;
+  static thread_local Node  *tls_node = nullptr;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Registry of every node, index matches the node id.
+   *
+   * Nodes are deliberately never freed. Their driver state can own threads
+   * that are still running while the process exits.
+   */
+  static std::vector<Node *> &registry()
+  {
+    static std::vector<Node *> *s_nodes = new std::vector<Node *>{ &defaultNode() };
+    return *s_nodes;
+  }
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  Node::Node( const NodeId id, const std::string &name ) : id_( id ), name_( name ), boot_( 0 )
+  {
+    for( auto &state : states_ )
+    {
+      state.store( nullptr, std::memory_order_relaxed );
+    }
+  }
+
+
+  NodeId Node::id() const
+  {
+    return id_;
+  }
+
+
+  const std::string &Node::name() const
+  {
+    return name_;
+  }
+
+
+  uint32_t Node::bootCount() const
+  {
+    return boot_.load( std::memory_order_acquire );
+  }
+
+
+  uint64_t Node::bootTag() const
+  {
+    return ( static_cast<uint64_t>( id_ ) << 32 ) | bootCount();
+  }
+
+
+  void Node::beginBoot()
+  {
+    boot_.fetch_add( 1, std::memory_order_acq_rel );
+  }
+
+
+  size_t Node::allocateSlot()
+  {
+    const size_t slot = s_next_slot.fetch_add( 1 );
+    if( slot >= MAX_NODE_STATES )
+    {
+      LOG_ERROR( "Out of node state slots, raise MAX_NODE_STATES" );
+      throw std::runtime_error( "Out of node state slots" );
+    }
+
+    return slot;
+  }
+
+
+  void *Node::create( const size_t slot, void *( *make )() )
+  {
+    std::lock_guard<std::mutex> lock( lock_ );
+
+    void *ptr = states_[ slot ].load( std::memory_order_acquire );
+    if( !ptr )
+    {
+      ptr = make();
+      states_[ slot ].store( ptr, std::memory_order_release );
+    }
+
+    return ptr;
+  }
+
+
+  NodeScope::NodeScope( Node &node ) : previous_( tls_node )
+  {
+    tls_node = &node;
+  }
+
+
+  NodeScope::~NodeScope()
+  {
+    tls_node = previous_;
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  Node &createNode( const std::string &name )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+
+    auto &nodes = registry();
+    Node *node  = new Node( static_cast<NodeId>( nodes.size() ), name );
+    nodes.push_back( node );
+    return *node;
+  }
+
+
+  Node *findNode( const NodeId id )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+
+    auto &nodes = registry();
+    return ( id < nodes.size() ) ? nodes[ id ] : nullptr;
+  }
+
+
+  size_t nodeCount()
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+    return registry().size();
+  }
+
+
+  Node &defaultNode()
+  {
+    static Node *s_default = new Node( DEFAULT_NODE_ID, "default" );
+    return *s_default;
+  }
+
+
+  Node &currentNode()
+  {
+    return tls_node ? *tls_node : defaultNode();
+  }
+
+
+  void setCurrentNode( Node &node )
+  {
+    tls_node = &node;
+  }
+
+}    // namespace mb::hw::sim
@@ -0,0 +1,187 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_node.hpp
+ *
+ *  Description:
+ *    Scoping of simulator driver state to individual simulated boards
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_NODE_HPP
+#define MBEDUTILS_SIM_NODE_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace mb::hw::sim
+{
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  using NodeId = uint32_t;
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr NodeId DEFAULT_NODE_ID = 0;  /**< Node used by threads that never picked one */
+  static constexpr size_t MAX_NODE_STATES = 16; /**< Distinct driver state types a node can hold */
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief One simulated board.
+   *
+   * Drivers keep their module state in a node rather than in globals, so
+   * several boards can share a process without seeing each other's tasks or
+   * serial channels. Every thread has a current node. Tasks inherit the node
+   * of the thread that created them, and anything else falls back to the
+   * default node, which preserves the one-board-per-process behavior.
+   */
+  class Node
+  {
+  public:
+    Node( const NodeId id, const std::string &name );
+    Node( const Node & )            = delete;
+    Node &operator=( const Node & ) = delete;
+
+    NodeId             id() const;
+    const std::string &name() const;
+
+    /**
+     * @brief Gets how many in-process warm resets this node has been through
+     *
+     * @return uint32_t   Zero until the first warm reset
+     */
+    uint32_t bootCount() const;
+
+    /**
+     * @brief Labels objects created by this node during its current boot
+     *
+     * @return uint64_t   Node id in the upper half, boot count in the lower
+     */
+    uint64_t bootTag() const;
+
+    /**
+     * @brief Starts the next boot. Called by the warm reset before re-entering the firmware.
+     */
+    void beginBoot();
+
+    /**
+     * @brief Gets this node's instance of a driver state, creating it on first use
+     *
+     * @tparam T    Default constructible state type, one per driver
+     * @return T&
+     */
+    template<typename T>
+    T &state()
+    {
+      const size_t slot = slotOf<T>();
+
+      void *ptr = states_[ slot ].load( std::memory_order_acquire );
+      if( !ptr )
+      {
+        ptr = create( slot, []() -> void * { return new T(); } );
+      }
+
+      return *static_cast<T *>( ptr );
+    }
+
+  private:
+    template<typename T>
+    static size_t slotOf()
+    {
+      static const size_t slot = allocateSlot();
+      return slot;
+    }
+
+    static size_t allocateSlot();
+    void         *create( const size_t slot, void *( *make )() );
+
+    const NodeId                                     id_;
+    const std::string                                name_;
+    std::atomic<uint32_t>                            boot_;
+    std::mutex                                       lock_;
+    std::array<std::atomic<void *>, MAX_NODE_STATES> states_;
+  };
+
+
+  /**
+   * @brief Makes a node current on the calling thread for the scope's lifetime
+   */
+  class NodeScope
+  {
+  public:
+    explicit NodeScope( Node &node );
+    ~NodeScope();
+
+    NodeScope( const NodeScope & )            = delete;
+    NodeScope &operator=( const NodeScope & ) = delete;
+
+  private:
+    Node *previous_;
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Creates a new simulated board. Nodes live until the process exits.
+   *
+   * @param name    Label used in diagnostics
+   * @return Node&
+   */
+  Node &createNode( const std::string &name );
+
+  /**
+   * @brief Looks up a node by id
+   *
+   * @param id      Id of the node
+   * @return Node*  nullptr if no such node exists
+   */
+  Node *findNode( const NodeId id );
+
+  /**
+   * @brief Gets how many nodes exist, the default node included
+   *
+   * @return size_t
+   */
+  size_t nodeCount();
+
+  /**
+   * @brief Gets the node that existed before any were created
+   *
+   * @return Node&
+   */
+  Node &defaultNode();
+
+  /**
+   * @brief Gets the node the calling thread is acting on behalf of
+   *
+   * @return Node&
+   */
+  Node &currentNode();
+
+  /**
+   * @brief Changes the node the calling thread acts on behalf of
+   *
+   * @param node    New current node
+   */
+  void setCurrentNode( Node &node );
+
+}    // namespace mb::hw::sim
+
+#endif /* !MBEDUTILS_SIM_NODE_HPP */
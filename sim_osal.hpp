@@ -0,0 +1,163 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_osal.hpp
+ *
+ *  Description:
+ *    Simulator specific configuration of the OSAL drivers
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_OSAL_HPP
+#define MBEDUTILS_SIM_OSAL_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <mbedutils/interfaces/mutex_intf.hpp>
+#include <mbedutils/interfaces/smphr_intf.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "sim_pool.hpp"
+
+namespace mb::osal::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Contention statistics for a single lock, merged across all threads
+   */
+  struct LockProfileEntry
+  {
+    uint64_t    id;            /**< Unique profiling identity of the lock */
+    std::string kind;          /**< mutex, rmutex, or smphr */
+    std::string tag;           /**< Optional creation-site tag */
+    std::string owner;         /**< Task that held the lock the longest */
+    uint64_t    acquisitions;  /**< Number of successful acquisitions */
+    uint64_t    contended;     /**< Acquisitions that had to wait */
+    int64_t     wait_total_ns; /**< Total time spent waiting to acquire */
+    int64_t     wait_max_ns;   /**< Longest single wait */
+    int64_t     hold_total_ns; /**< Total time the lock was held */
+    int64_t     hold_max_ns;   /**< Longest single hold */
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Limits how many mutexes may exist at once.
+   *
+   * Use this to match the size of the static OSAL pools on the target so that
+   * exhaustion shows up in simulation too. Creation fails once the limit is
+   * reached. A capacity of zero means unlimited, which is the default.
+   *
+   * @param capacity  Maximum number of live objects
+   */
+  void setMutexPoolCapacity( const size_t capacity );
+
+  /**
+   * @copydoc setMutexPoolCapacity
+   */
+  void setRecursiveMutexPoolCapacity( const size_t capacity );
+
+  /**
+   * @copydoc setMutexPoolCapacity
+   */
+  void setSmphrPoolCapacity( const size_t capacity );
+
+  /**
+   * @brief Gets usage statistics for the pool backing each object type
+   *
+   * @return mb::hw::sim::PoolStats
+   */
+  mb::hw::sim::PoolStats getMutexPoolStats();
+  mb::hw::sim::PoolStats getRecursiveMutexPoolStats();
+  mb::hw::sim::PoolStats getSmphrPoolStats();
+
+  /**
+   * @brief Destroys the current node's locks created during its current boot.
+   *
+   * The in-process warm reset calls these once the node's tasks are gone.
+   * Objects that are still locked or waited on are left alone, since their
+   * memory is still in use. So are objects of other nodes, and objects
+   * created before the node's first warm reset, which can't be told apart
+   * from firmware statics that keep their handles across resets.
+   *
+   * @return size_t   Number of objects destroyed
+   */
+  size_t releaseBootMutexes();
+  size_t releaseBootSmphrs();
+
+  /**
+   * @brief Turns the lock contention profiler on or off.
+   *
+   * While enabled, every mutex, recursive mutex and semaphore acquisition is
+   * recorded into a buffer owned by the calling thread. Disabled, the cost is
+   * a single relaxed atomic load per lock operation.
+   *
+   * @param enable          True to start recording
+   * @param report_at_exit  Print the hottest locks to stderr at process exit
+   */
+  void enableLockProfiling( const bool enable, const bool report_at_exit = false );
+
+  /**
+   * @brief Attaches a creation-site tag to a lock so it is identifiable in reports
+   *
+   * @param mutex  Lock to tag
+   * @param tag    String with static storage duration
+   */
+  void tagMutex( mb_mutex_t mutex, const char *tag );
+  void tagRecursiveMutex( mb_recursive_mutex_t mutex, const char *tag );
+  void tagSmphr( mb_smphr_t smphr, const char *tag );
+
+  /**
+   * @brief Gets the profile of every lock seen so far, hottest first.
+   *
+   * Locks are ranked by total time spent waiting on them, then by the number
+   * of contended acquisitions.
+   *
+   * @return std::vector<LockProfileEntry>
+   */
+  std::vector<LockProfileEntry> getLockProfile();
+
+  /**
+   * @brief Discards all recorded lock statistics
+   */
+  void resetLockProfile();
+
+  /**
+   * @brief Writes a table of the hottest locks to the given stream
+   *
+   * @param stream       Where to write the report
+   * @param max_entries  Limit on the number of locks listed
+   */
+  void reportLockProfile( std::ostream &stream, const size_t max_entries = 20 );
+
+  /**
+   * @brief Builds subsequently created mutexes with the priority inheritance protocol.
+   *
+   * This mirrors the RTOS behavior on target, where a low priority task holding
+   * a lock is boosted to the priority of the highest waiter. It only has a
+   * visible effect when simulated tasks run with real-time scheduling, see
+   * mb::thread::sim::enableRealtimePriorities(). Existing mutexes keep the
+   * protocol they were created with.
+   *
+   * @param enable  True to use PTHREAD_PRIO_INHERIT for new mutexes
+   */
+  void enablePriorityInheritance( const bool enable );
+
+  /**
+   * @brief Checks if new mutexes will be created with priority inheritance
+   */
+  bool priorityInheritanceEnabled();
+
+}    // namespace mb::osal::sim
+
+#endif /* !MBEDUTILS_SIM_OSAL_HPP */
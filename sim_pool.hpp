@@ -0,0 +1,320 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_pool.hpp
+ *
+ *  Description:
+ *    Slab based object pool used to back simulated OSAL objects
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_POOL_HPP
+#define MBEDUTILS_SIM_POOL_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace mb::hw::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct PoolStats
+  {
+    size_t in_use;   /**< Objects currently allocated */
+    size_t peak;     /**< Highest number of objects allocated at once */
+    size_t reserved; /**< Slots backed by slab memory */
+    size_t capacity; /**< Maximum number of objects, zero if unlimited */
+  };
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Thread safe, slab allocated object pool with O(1) alloc/release.
+   *
+   * Objects live in fixed size slabs that are never freed until the pool is
+   * destroyed, so the pointer handed out doubles as a stable handle. Each slot
+   * remembers its own index, which lets release() push it back onto the free
+   * list without searching. Slabs are aligned to their power of two size, so
+   * masking a handle yields its slab base, and a hash lookup of that base
+   * validates the handle without ever dereferencing it.
+   *
+   * Every slot also carries a caller defined tag, e.g. who created the object,
+   * so a subset of the live objects can be released in one pass.
+   *
+   * Destroying the pool does not destroy objects that are still live. Pools
+   * backing OSAL objects should be leaked rather than made static, because
+   * threads may still use those objects while the process exits.
+   *
+   * @tparam T   Type of object stored in the pool
+   */
+  template<typename T>
+  class ObjectPool
+  {
+  public:
+    explicit ObjectPool( const size_t slab_size = 32 ) :
+        slab_size_( slab_size ? slab_size : 1 ), slab_span_( span_of( slab_size_ ) ), in_use_( 0 ), peak_( 0 ), capacity_( 0 )
+    {
+    }
+
+    ~ObjectPool() = default;
+
+    ObjectPool( const ObjectPool & )            = delete;
+    ObjectPool &operator=( const ObjectPool & ) = delete;
+
+    /**
+     * @brief Limit the number of live objects, mirroring a static RTOS pool.
+     *
+     * @param capacity  Maximum live objects. Zero removes the limit.
+     */
+    void setCapacity( const size_t capacity )
+    {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      capacity_ = capacity;
+    }
+
+    /**
+     * @brief Pre-allocate enough slabs to hold the given number of objects
+     *
+     * @param count  Number of slots that should be available without growing
+     */
+    void reserve( const size_t count )
+    {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      while( ( slabs_.size() * slab_size_ ) < count )
+      {
+        grow();
+      }
+    }
+
+    /**
+     * @brief Construct a new object in a free slot
+     *
+     * @return T*  Pointer to the object, or nullptr if the pool is at capacity
+     */
+    template<typename... Args>
+    T *allocate( Args &&...args )
+    {
+      return allocateTagged( 0, std::forward<Args>( args )... );
+    }
+
+    /**
+     * @brief Construct a new object in a free slot and label it
+     *
+     * @param tag  Value handed back to the predicate of releaseIf()
+     * @return T*  Pointer to the object, or nullptr if the pool is at capacity
+     */
+    template<typename... Args>
+    T *allocateTagged( const uint64_t tag, Args &&...args )
+    {
+      Slot *slot = nullptr;
+
+      {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( capacity_ && ( in_use_ >= capacity_ ) )
+        {
+          return nullptr;
+        }
+
+        if( free_list_.empty() )
+        {
+          grow();
+        }
+
+        slot = slot_at( free_list_.back() );
+        free_list_.pop_back();
+        slot->in_use = true;
+        slot->tag    = tag;
+
+        in_use_++;
+        if( in_use_ > peak_ )
+        {
+          peak_ = in_use_;
+        }
+      }
+
+      return new( slot->storage ) T( std::forward<Args>( args )... );
+    }
+
+    /**
+     * @brief Destroy an object and return its slot to the pool
+     *
+     * @param object  Object previously returned from allocate()
+     * @return true   The object belonged to this pool and was released
+     * @return false  The handle was invalid or already released
+     */
+    bool release( T *object )
+    {
+      if( !object )
+      {
+        return false;
+      }
+
+      Slot *slot = reinterpret_cast<Slot *>( object );
+
+      {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        if( !owns( slot ) || !slot->in_use )
+        {
+          return false;
+        }
+
+        slot->in_use = false;
+      }
+
+      object->~T();
+
+      std::lock_guard<std::mutex> lock( mutex_ );
+      free_list_.push_back( slot->index );
+      in_use_--;
+      return true;
+    }
+
+    /**
+     * @brief Destroy the live objects a predicate picks and return their slots
+     *
+     * The predicate runs with the pool locked, so it must not call back into
+     * the pool. Handles to released objects become invalid.
+     *
+     * @param pred    Called as pred( tag, object ), true to release the object
+     * @return size_t Number of objects released
+     */
+    template<typename Pred>
+    size_t releaseIf( Pred &&pred )
+    {
+      std::lock_guard<std::mutex> lock( mutex_ );
+
+      size_t released = 0;
+      for( uint32_t idx = 0; idx < static_cast<uint32_t>( slabs_.size() * slab_size_ ); idx++ )
+      {
+        Slot *slot   = slot_at( idx );
+        T    *object = reinterpret_cast<T *>( slot->storage );
+        if( !slot->in_use || !pred( slot->tag, *object ) )
+        {
+          continue;
+        }
+
+        object->~T();
+        slot->in_use = false;
+        free_list_.push_back( idx );
+        released++;
+      }
+
+      in_use_ -= released;
+      return released;
+    }
+
+    PoolStats stats()
+    {
+      std::lock_guard<std::mutex> lock( mutex_ );
+      return PoolStats{ in_use_, peak_, slabs_.size() * slab_size_, capacity_ };
+    }
+
+  private:
+    /*-------------------------------------------------------------------------
+    The storage must stay the first member so an object pointer can be turned
+    back into its slot without any lookups.
+    -------------------------------------------------------------------------*/
+    struct Slot
+    {
+      alignas( T ) unsigned char storage[ sizeof( T ) ];
+      uint64_t tag;
+      uint32_t index;
+      bool     in_use;
+    };
+
+    struct SlabDeleter
+    {
+      size_t span;
+
+      void operator()( Slot *slab ) const
+      {
+        ::operator delete( slab, std::align_val_t( span ) );
+      }
+    };
+
+    using SlabPtr = std::unique_ptr<Slot, SlabDeleter>;
+
+    /**
+     * @brief Smallest power of two that holds a whole slab
+     */
+    static size_t span_of( const size_t slab_size )
+    {
+      size_t span = alignof( Slot );
+      while( span < ( slab_size * sizeof( Slot ) ) )
+      {
+        span <<= 1;
+      }
+
+      return span;
+    }
+
+    void grow()
+    {
+      const uint32_t base = static_cast<uint32_t>( slabs_.size() * slab_size_ );
+      Slot          *slab = static_cast<Slot *>( ::operator new( slab_span_, std::align_val_t( slab_span_ ) ) );
+
+      slabs_.push_back( SlabPtr( slab, SlabDeleter{ slab_span_ } ) );
+      slab_bases_.insert( reinterpret_cast<uintptr_t>( slab ) );
+
+      /*-----------------------------------------------------------------------
+      Push in reverse so the lowest index is handed out first
+      -----------------------------------------------------------------------*/
+      for( size_t i = slab_size_; i > 0; i-- )
+      {
+        Slot *slot   = new( &slab[ i - 1 ] ) Slot;
+        slot->tag    = 0;
+        slot->index  = base + static_cast<uint32_t>( i - 1 );
+        slot->in_use = false;
+        free_list_.push_back( base + static_cast<uint32_t>( i - 1 ) );
+      }
+    }
+
+    Slot *slot_at( const uint32_t index ) const
+    {
+      return &slabs_[ index / slab_size_ ].get()[ index % slab_size_ ];
+    }
+
+    bool owns( const Slot *slot ) const
+    {
+      /*-----------------------------------------------------------------------
+      Only compare addresses, a foreign handle must never be dereferenced
+      -----------------------------------------------------------------------*/
+      const auto addr   = reinterpret_cast<uintptr_t>( slot );
+      const auto base   = addr & ~static_cast<uintptr_t>( slab_span_ - 1 );
+      const auto offset = addr - base;
+
+      if( ( offset >= ( slab_size_ * sizeof( Slot ) ) ) || ( ( offset % sizeof( Slot ) ) != 0 ) )
+      {
+        return false;
+      }
+
+      return slab_bases_.count( base ) != 0;
+    }
+
+    const size_t                  slab_size_;
+    const size_t                  slab_span_;
+    std::mutex                    mutex_;
+    std::vector<SlabPtr>          slabs_;
+    std::unordered_set<uintptr_t> slab_bases_;
+    std::vector<uint32_t>         free_list_;
+    size_t                        in_use_;
+    size_t                        peak_;
+    size_t                        capacity_;
+  };
+}    // namespace mb::hw::sim
+
+#endif /* !MBEDUTILS_SIM_POOL_HPP */
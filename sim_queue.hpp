@@ -15,9 +15,11 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
-#include <queue>
-#include <mutex>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
 
 namespace mb::hw::sim
 {
@@ -28,35 +30,82 @@ namespace mb::hw::sim
   /**
    * @brief  Simple thread safe queue implementation
    *
-   * @tparam T   Type of data to store in the queue
+   * Items live in a ring of preallocated slots. The ring only grows, doubling,
+   * when a push finds it full, so once it has seen its peak depth pushing and
+   * popping costs no allocations.
+   *
+   * @tparam T   Type of data to store in the queue, must be default constructible
    */
   template<typename T>
   class ThreadSafeQueue
   {
   public:
+    /**
+     * @param capacity  Slots to preallocate, rounded up to a power of two
+     */
+    explicit ThreadSafeQueue( const size_t capacity = 256 ) : head_( 0 ), count_( 0 )
+    {
+      size_t slots = 1;
+      while( slots < capacity )
+      {
+        slots <<= 1;
+      }
+
+      ring_.resize( slots );
+    }
+
     void push( T item )
     {
       std::lock_guard<std::mutex> lock( mutex_ );
-      queue_.push( std::move( item ) );
+      if( count_ == ring_.size() )
+      {
+        grow();
+      }
+
+      ring_[ ( head_ + count_ ) & ( ring_.size() - 1 ) ] = std::move( item );
+      count_++;
       cv_.notify_one();
     }
 
-    bool pop( T &item, std::chrono::milliseconds timeout = std::chrono::milliseconds( 100 ) )
+    bool pop( T &item, std::chrono::nanoseconds timeout = std::chrono::milliseconds( 100 ) )
     {
       std::unique_lock<std::mutex> lock( mutex_ );
-      if( !cv_.wait_for( lock, timeout, [ this ] { return !queue_.empty(); } ) )
+      if( !cv_.wait_for( lock, timeout, [ this ] { return count_ != 0; } ) )
       {
         return false;
       }
-      item = std::move( queue_.front() );
-      queue_.pop();
+
+      /*-----------------------------------------------------------------------
+      Moving out leaves the slot empty, so nothing the caller owns lingers in
+      the ring after it is consumed.
+      -----------------------------------------------------------------------*/
+      item  = std::move( ring_[ head_ ] );
+      head_ = ( head_ + 1 ) & ( ring_.size() - 1 );
+      count_--;
       return true;
     }
 
   private:
-    std::queue<T>           queue_;
+    std::vector<T>          ring_;
+    size_t                  head_;
+    size_t                  count_;
     mutable std::mutex      mutex_;
     std::condition_variable cv_;
+
+    /**
+     * @brief Doubles the ring, unwrapping the items so the oldest lands in slot 0
+     */
+    void grow()
+    {
+      std::vector<T> larger( ring_.size() * 2 );
+      for( size_t idx = 0; idx < count_; idx++ )
+      {
+        larger[ idx ] = std::move( ring_[ ( head_ + idx ) & ( ring_.size() - 1 ) ] );
+      }
+
+      ring_.swap( larger );
+      head_ = 0;
+    }
   };
 }    // namespace mb::hw::sim
 
@@ -17,6 +17,8 @@ Includes
 #include <mutex>
 #include <unordered_map>
 #include "sim_io_pipe.hpp"
+#include "sim_node.hpp"
+#include "sim_vcd.hpp"
 
 namespace mb::hw::serial::sim
 {
@@ -32,12 +34,23 @@ namespace mb::hw::serial::sim
     mb::hw::serial::intf::TXCompleteCallback        tx_callback;
   };
 
+  /**
+   * @brief Serial channels of one simulated node
+   */
+  struct SerialState
+  {
+    std::recursive_mutex                                       mtx;
+    std::unordered_map<size_t, std::unique_ptr<SerialChannel>> channels;
+  };
+
   /*---------------------------------------------------------------------------
-  Private Data
+  Private Functions
   ---------------------------------------------------------------------------*/
 
-  static std::recursive_mutex                                       s_channel_impl_mtx;
-  static std::unordered_map<size_t, std::unique_ptr<SerialChannel>> s_channel_impl;
+  static inline SerialState &serial_state()
+  {
+    return mb::hw::sim::currentNode().state<SerialState>();
+  }
 
   /*---------------------------------------------------------------------------
   Public Functions
@@ -45,10 +58,12 @@ namespace mb::hw::serial::sim
 
   void configure( const size_t channel, const std::string &endpoint, const bool bind = true )
   {
+    auto &state = serial_state();
+
     /*-------------------------------------------------------------------------
     Ensure the channel is not already configured
     -------------------------------------------------------------------------*/
-    if( s_channel_impl.find( channel ) != s_channel_impl.end() )
+    if( state.channels.find( channel ) != state.channels.end() )
     {
       throw std::runtime_error( "Channel already configured" );
     }
@@ -56,15 +71,85 @@ namespace mb::hw::serial::sim
     /*-------------------------------------------------------------------------
     Create the new pipe
     -------------------------------------------------------------------------*/
-    std::lock_guard lock( s_channel_impl_mtx );
+    std::lock_guard lock( state.mtx );
     auto            new_channel = std::make_unique<SerialChannel>( SerialChannel{
         std::make_unique<std::recursive_timed_mutex>(), std::make_unique<mb::hw::sim::BidirectionalPipe>( endpoint, bind ) } );
 
     /*-------------------------------------------------------------------------
     Start the pipe
     -------------------------------------------------------------------------*/
-    s_channel_impl[ channel ] = std::move( new_channel );
-    mbed_assert( s_channel_impl[ channel ]->pipe->start() );
+    state.channels[ channel ] = std::move( new_channel );
+    mbed_assert( state.channels[ channel ]->pipe->start() );
+  }
+
+
+  void resetState()
+  {
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+    for( auto &[ channel, impl ] : state.channels )
+    {
+      impl->pipe->setReceiveCallback( nullptr );
+      impl->rx_callback = nullptr;
+      impl->tx_callback = nullptr;
+
+      /*-----------------------------------------------------------------------
+      A lock still held by a cancelled task can't be unlocked or destroyed, so
+      leak it and hand out a fresh one.
+      -----------------------------------------------------------------------*/
+      if( impl->lock->try_lock() )
+      {
+        impl->lock->unlock();
+      }
+      else
+      {
+        impl->lock.release();
+        impl->lock = std::make_unique<std::recursive_timed_mutex>();
+      }
+    }
+  }
+
+
+  bool setLinkImpairment( const size_t channel, const mb::hw::sim::LinkImpairment &config )
+  {
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+
+    auto iter = state.channels.find( channel );
+    if( iter == state.channels.end() )
+    {
+      return false;
+    }
+
+    return iter->second->pipe->setImpairment( config );
+  }
+
+
+  void clearLinkImpairment( const size_t channel )
+  {
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+
+    auto iter = state.channels.find( channel );
+    if( iter != state.channels.end() )
+    {
+      iter->second->pipe->clearImpairment();
+    }
+  }
+
+
+  mb::hw::sim::LinkStats getLinkStats( const size_t channel )
+  {
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+
+    auto iter = state.channels.find( channel );
+    if( iter == state.channels.end() )
+    {
+      return mb::hw::sim::LinkStats{};
+    }
+
+    return iter->second->pipe->getLinkStats();
   }
 }    // namespace mb::hw::serial::sim
 
@@ -78,25 +163,27 @@ namespace mb::hw::serial::intf
 
   bool lock( const size_t channel, const size_t timeout )
   {
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return false;
     }
 
-    return s_channel_impl[ channel ]->lock->try_lock_for( std::chrono::milliseconds( timeout ) );
+    return state.channels[ channel ]->lock->try_lock_for( std::chrono::milliseconds( timeout ) );
   }
 
 
   void unlock( const size_t channel )
   {
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return;
     }
 
-    s_channel_impl[ channel ]->lock->unlock();
+    state.channels[ channel ]->lock->unlock();
   }
 
 
@@ -120,11 +207,13 @@ namespace mb::hw::serial::intf
 
   int write_async( const size_t channel, const void *data, const size_t length )
   {
+    auto &state = serial_state();
+
     /*-------------------------------------------------------------------------
     Ensure the input channel is valid
     -------------------------------------------------------------------------*/
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return -1;
     }
@@ -132,14 +221,19 @@ namespace mb::hw::serial::intf
     /*-------------------------------------------------------------------------
     Write the data to the pipe
     -------------------------------------------------------------------------*/
-    s_channel_impl[ channel ]->pipe->write( std::vector<uint8_t>( ( const uint8_t * )data, ( const uint8_t * )data + length ) );
+    state.channels[ channel ]->pipe->write( data, length );
+
+    if( mb::hw::sim::vcd::enabled() )
+    {
+      mb::hw::sim::vcd::recordSerial( channel, mb::hw::sim::vcd::Direction::TX, data, length );
+    }
 
     /*-------------------------------------------------------------------------
     Invoke the user callback if it exists
     -------------------------------------------------------------------------*/
-    if( s_channel_impl[ channel ]->tx_callback )
+    if( state.channels[ channel ]->tx_callback )
     {
-      s_channel_impl[ channel ]->tx_callback( channel, length );
+      state.channels[ channel ]->tx_callback( channel, length );
     }
 
     return length;
@@ -148,13 +242,14 @@ namespace mb::hw::serial::intf
 
   void on_tx_complete( const size_t channel, mb::hw::serial::intf::TXCompleteCallback callback )
   {
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return;
     }
 
-    s_channel_impl[ channel ]->tx_callback = callback;
+    state.channels[ channel ]->tx_callback = callback;
   }
 
 
@@ -166,11 +261,13 @@ namespace mb::hw::serial::intf
 
   int read_async( const size_t channel, void *data, const size_t length, const size_t timeout )
   {
+    auto &state = serial_state();
+
     /*-------------------------------------------------------------------------
     Ensure the input channel is valid
     -------------------------------------------------------------------------*/
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return -1;
     }
@@ -178,21 +275,29 @@ namespace mb::hw::serial::intf
     /*-------------------------------------------------------------------------
     Read the data from the pipe as a lambda callback
     -------------------------------------------------------------------------*/
-    auto user_rx_callback = s_channel_impl[ channel ]->rx_callback;
+    auto  user_rx_callback = state.channels[ channel ]->rx_callback;
+    auto *node             = &mb::hw::sim::currentNode();
+
+    state.channels[ channel ]->pipe->setReceiveCallback(
+        [ channel, data, length, user_rx_callback, node ]( const uint8_t *data_in, const size_t size ) {
+          mb::hw::sim::NodeScope scope( *node );
 
-    s_channel_impl[ channel ]->pipe->setReceiveCallback(
-        [ channel, data, length, user_rx_callback ]( const std::vector<uint8_t> &data_in ) {
-          if( data_in.size() > length )
+          if( size > length )
           {
-            std::cerr << "Read data length " << data_in.size() << " too large for buffer of size " << length << std::endl;
+            std::cerr << "Read data length " << size << " too large for buffer of size " << length << std::endl;
             return;
           }
 
-          std::copy( data_in.begin(), data_in.end(), ( uint8_t * )data );
+          std::copy( data_in, data_in + size, ( uint8_t * )data );
+
+          if( mb::hw::sim::vcd::enabled() )
+          {
+            mb::hw::sim::vcd::recordSerial( channel, mb::hw::sim::vcd::Direction::RX, data_in, size );
+          }
 
           if( user_rx_callback )
           {
-            user_rx_callback( channel, data_in.size() );
+            user_rx_callback( channel, size );
           }
         } );
 
@@ -202,13 +307,14 @@ namespace mb::hw::serial::intf
 
   void on_rx_complete( const size_t channel, mb::hw::serial::intf::RXCompleteCallback callback )
   {
-    std::lock_guard lock( s_channel_impl_mtx );
-    if( s_channel_impl.find( channel ) == s_channel_impl.end() )
+    auto &state = serial_state();
+    std::lock_guard lock( state.mtx );
+    if( state.channels.find( channel ) == state.channels.end() )
     {
       return;
     }
 
-    s_channel_impl[ channel ]->rx_callback = callback;
+    state.channels[ channel ]->rx_callback = callback;
   }
 
 
@@ -17,6 +17,7 @@ Includes
 -----------------------------------------------------------------------------*/
 #include <cstddef>
 #include <string>
+#include "sim_io_pipe.hpp"
 
 namespace mb::hw::serial::sim
 {
@@ -35,6 +36,38 @@ namespace mb::hw::serial::sim
    */
   void configure( const size_t channel, const std::string &endpoint, const bool bind = true );
 
+  /**
+   * @brief Returns the serial channels to their power-on state for a warm reset.
+   *
+   * Pending reads and user callbacks are dropped, but the pipes stay up so
+   * peers on the other end of the ZMQ sockets never see the link go down.
+   */
+  void resetState();
+
+  /**
+   * @brief Degrades the data a channel sends, e.g. to model a UART or radio link
+   *
+   * @param channel   Which serial channel to impair
+   * @param config    Link behavior, see mb::hw::sim::LinkImpairment
+   * @return true     The channel exists and the settings were valid and applied
+   */
+  bool setLinkImpairment( const size_t channel, const mb::hw::sim::LinkImpairment &config );
+
+  /**
+   * @brief Returns a channel to instant, lossless delivery
+   *
+   * @param channel   Which serial channel to restore
+   */
+  void clearLinkImpairment( const size_t channel );
+
+  /**
+   * @brief Gets the send path counters of a channel
+   *
+   * @param channel   Which serial channel to query
+   * @return mb::hw::sim::LinkStats   All zero if the channel doesn't exist
+   */
+  mb::hw::sim::LinkStats getLinkStats( const size_t channel );
+
 }  // namespace mb::hw::serial::sim
 
 #endif  /* !MBEDUTILS_SIM_SERIAL_HPP */
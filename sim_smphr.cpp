@@ -3,7 +3,8 @@
  *    sim_smphr.cpp
  *
  *  Description:
- *    Implementation of the semaphore interface using the C++ standard library
+ *    Implementation of the semaphore interface using an atomic counter and
+ *    the Linux futex syscall
  *
  *  2024 | Brandon Braun | brandonbraun653@protonmail.com
  *****************************************************************************/
@@ -12,43 +13,173 @@
 Includes
 -----------------------------------------------------------------------------*/
 
-#include <chrono>
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <mbedutils/interfaces/smphr_intf.hpp>
-#include <memory>
-#include <semaphore>
-#include <thread>
-#include <unordered_map>
+#include "sim_futex.hpp"
+#include "sim_lock_profiler.hpp"
+#include "sim_node.hpp"
+#include "sim_osal.hpp"
+#include "sim_pool.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
 
 namespace mb::osal
 {
-  struct SemaphoreWrapper
+  namespace prof  = mb::hw::sim::lockprof;
+  namespace futex = mb::hw::sim::futex;
+  namespace trace = mb::hw::sim::trace;
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Counting semaphore built directly on a futex word.
+   *
+   * The count itself is the futex word, so reading it is a single load and
+   * releasing never takes a lock, making it safe to call from simulated ISRs.
+   * The kernel is only entered when a thread actually has to sleep, or when a
+   * release finds sleepers to wake.
+   */
+  class FutexSemaphore
   {
-    std::counting_semaphore<> smphr;
-    SemaphoreWrapper( size_t maxCount, size_t initialCount ) : smphr( initialCount )
+  public:
+    FutexSemaphore( const size_t maxCount, const size_t initialCount ) :
+        profile_id( prof::registerLock() ), count_( 0 ), waiters_( 0 ), max_( clamp( maxCount ) )
+    {
+      count_.store( static_cast<uint32_t>( std::min<size_t>( initialCount, max_ ) ), std::memory_order_relaxed );
+    }
+
+    size_t available() const
+    {
+      return count_.load( std::memory_order_acquire );
+    }
+
+    bool has_waiters() const
+    {
+      return waiters_.load( std::memory_order_acquire ) != 0;
+    }
+
+    bool try_acquire()
+    {
+      uint32_t current = count_.load( std::memory_order_relaxed );
+      while( current > 0 )
+      {
+        if( count_.compare_exchange_weak( current, current - 1, std::memory_order_acquire, std::memory_order_relaxed ) )
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    /**
+     * @brief Adds one to the count, saturating at the configured maximum
+     */
+    void release()
+    {
+      uint32_t current = count_.load( std::memory_order_relaxed );
+      do
+      {
+        if( current >= max_ )
+        {
+          return;
+        }
+      } while( !count_.compare_exchange_weak( current, current + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) );
+
+      /*-----------------------------------------------------------------------
+      Pairs with the waiter registering itself before sleeping: either we see
+      the waiter here, or its futex_wait sees the new count and won't sleep.
+      -----------------------------------------------------------------------*/
+      if( waiters_.load( std::memory_order_seq_cst ) )
+      {
+        futex::wake( &count_, 1 );
+      }
+    }
+
+    /**
+     * @brief Acquires the semaphore, sleeping in the kernel if needed
+     *
+     * @param deadline  Absolute CLOCK_MONOTONIC timeout, or nullptr to wait forever
+     * @return true     The semaphore was acquired
+     */
+    bool acquire( const timespec *deadline = nullptr )
+    {
+      if( try_acquire() )
+      {
+        return true;
+      }
+
+      mb::thread::sim::BlockedScope blocked;
+      while( !try_acquire() )
+      {
+        waiters_.fetch_add( 1, std::memory_order_seq_cst );
+        const int err = futex::wait( &count_, 0, deadline );
+        waiters_.fetch_sub( 1, std::memory_order_relaxed );
+
+        if( err == ETIMEDOUT )
+        {
+          return try_acquire();
+        }
+
+        mb::thread::sim::cancellationPoint();
+      }
+
+      return true;
+    }
+
+    const uint64_t profile_id;
+
+  private:
+    /*-------------------------------------------------------------------------
+    A max count of zero (or one beyond the futex word) means no limit
+    -------------------------------------------------------------------------*/
+    static uint32_t clamp( const size_t value )
     {
+      constexpr size_t limit = std::numeric_limits<uint32_t>::max();
+      return static_cast<uint32_t>( ( value == 0 || value > limit ) ? limit : value );
     }
+
+    std::atomic<uint32_t> count_;
+    std::atomic<uint32_t> waiters_;
+    const uint32_t        max_;
   };
 
-  // Maps to keep track of semaphores
-  std::unordered_map<mb_smphr_t, std::unique_ptr<SemaphoreWrapper>> semaphore_map;
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  // Pool that owns all semaphores. Leaked on purpose, tasks may still wait on them at exit.
+  static auto &s_smphr_pool = *new mb::hw::sim::ObjectPool<FutexSemaphore>();
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
 
   void initSmphrDriver()
   {
-    // No specific initialization needed for STL semaphores
+    /*-------------------------------------------------------------------------
+    The pool is ready from static initialization. Nothing is torn down here,
+    other nodes and firmware statics may still hold their semaphores. The
+    warm reset releases a node's own through releaseBootSmphrs().
+    -------------------------------------------------------------------------*/
   }
 
   bool createSmphr( mb_smphr_t &s, const size_t maxCount, const size_t initialCount )
   {
-    auto new_smphr     = std::make_unique<SemaphoreWrapper>( maxCount, initialCount );
-    s                  = new_smphr.get();
-    semaphore_map[ s ] = std::move( new_smphr );
-    return true;
+    s = s_smphr_pool.allocateTagged( mb::hw::sim::currentNode().bootTag(), maxCount, initialCount );
+    return s != nullptr;
   }
 
   void destroySmphr( mb_smphr_t &s )
   {
-    semaphore_map.erase( s );
+    s_smphr_pool.release( static_cast<FutexSemaphore *>( s ) );
     s = nullptr;
   }
 
@@ -64,23 +195,18 @@ namespace mb::osal
 
   size_t getSmphrAvailable( mb_smphr_t &s )
   {
-    // Not directly supported by std::counting_semaphore, so we simulate it
-    // by trying to acquire and then release the semaphore
-    size_t count = 0;
-    while( static_cast<SemaphoreWrapper *>( s )->smphr.try_acquire() )
-    {
-      ++count;
-    }
-    for( size_t i = 0; i < count; ++i )
-    {
-      static_cast<SemaphoreWrapper *>( s )->smphr.release();
-    }
-    return count;
+    return static_cast<FutexSemaphore *>( s )->available();
   }
 
   void releaseSmphr( mb_smphr_t &s )
   {
-    static_cast<SemaphoreWrapper *>( s )->smphr.release();
+    auto smphr = static_cast<FutexSemaphore *>( s );
+    smphr->release();
+
+    if( trace::enabled() )
+    {
+      trace::instant( trace::Category::LOCK, "smphr give", smphr->profile_id );
+    }
   }
 
   void releaseSmphrFromISR( mb_smphr_t &s )
@@ -90,28 +216,139 @@ namespace mb::osal
 
   void acquireSmphr( mb_smphr_t &s )
   {
-    static_cast<SemaphoreWrapper *>( s )->smphr.acquire();
+    auto smphr = static_cast<FutexSemaphore *>( s );
+
+    if( !prof::enabled() && !trace::enabled() )
+    {
+      smphr->acquire();
+    }
+    else if( smphr->try_acquire() )
+    {
+      if( prof::enabled() )
+      {
+        prof::onAcquire( smphr->profile_id, prof::LockKind::SEMAPHORE, false, 0 );
+      }
+    }
+    else
+    {
+      const int64_t start = prof::timestamp();
+      smphr->acquire();
+
+      if( prof::enabled() )
+      {
+        prof::onAcquire( smphr->profile_id, prof::LockKind::SEMAPHORE, true, prof::timestamp() - start );
+      }
+
+      if( trace::enabled() )
+      {
+        trace::complete( trace::Category::LOCK, "smphr wait", start, smphr->profile_id );
+      }
+    }
   }
 
   bool tryAcquireSmphr( mb_smphr_t &s )
   {
-    return static_cast<SemaphoreWrapper *>( s )->smphr.try_acquire();
+    auto smphr = static_cast<FutexSemaphore *>( s );
+    if( !smphr->try_acquire() )
+    {
+      return false;
+    }
+
+    if( prof::enabled() )
+    {
+      prof::onAcquire( smphr->profile_id, prof::LockKind::SEMAPHORE, false, 0 );
+    }
+
+    return true;
   }
 
   bool tryAcquireSmphr( mb_smphr_t &s, const size_t timeout )
   {
-    auto start = std::chrono::steady_clock::now();
-    do
+    auto smphr = static_cast<FutexSemaphore *>( s );
+    if( smphr->try_acquire() )
     {
-      if( static_cast<SemaphoreWrapper *>( s )->smphr.try_acquire() )
+      if( prof::enabled() )
       {
-        return true;
+        prof::onAcquire( smphr->profile_id, prof::LockKind::SEMAPHORE, false, 0 );
       }
+      return true;
+    }
 
-      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    const int64_t start        = ( prof::enabled() || trace::enabled() ) ? prof::timestamp() : 0;
+    const int64_t sim_deadline = mb::time::sim::nanos() + static_cast<int64_t>( timeout ) * 1000000LL;
 
-    } while( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( timeout ) );
+    /*-------------------------------------------------------------------------
+    Wait in host steps that follow simulated time, so a lockstep horizon holds
+    the timeout back just like it does a sleep.
+    -------------------------------------------------------------------------*/
+    while( true )
+    {
+      const int64_t host_ns = mb::time::sim::hostWaitStep( sim_deadline );
+      if( !host_ns )
+      {
+        if( !smphr->try_acquire() )
+        {
+          return false;
+        }
+        break;
+      }
 
-    return false;
+      const timespec deadline = futex::deadline_from_now( host_ns );
+      if( smphr->acquire( &deadline ) )
+      {
+        break;
+      }
+    }
+
+    if( start && prof::enabled() )
+    {
+      prof::onAcquire( smphr->profile_id, prof::LockKind::SEMAPHORE, true, prof::timestamp() - start );
+    }
+
+    if( start && trace::enabled() )
+    {
+      trace::complete( trace::Category::LOCK, "smphr wait", start, smphr->profile_id );
+    }
+
+    return true;
   }
 }    // namespace mb::osal
+
+
+namespace mb::osal::sim
+{
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void setSmphrPoolCapacity( const size_t capacity )
+  {
+    s_smphr_pool.setCapacity( capacity );
+  }
+
+
+  size_t releaseBootSmphrs()
+  {
+    const mb::hw::sim::Node &node = mb::hw::sim::currentNode();
+    if( !node.bootCount() )
+    {
+      return 0;
+    }
+
+    const uint64_t tag = node.bootTag();
+    return s_smphr_pool.releaseIf(
+        [ tag ]( const uint64_t owner, FutexSemaphore &smphr ) { return ( owner == tag ) && !smphr.has_waiters(); } );
+  }
+
+
+  mb::hw::sim::PoolStats getSmphrPoolStats()
+  {
+    return s_smphr_pool.stats();
+  }
+
+
+  void tagSmphr( mb_smphr_t smphr, const char *tag )
+  {
+    mb::hw::sim::lockprof::setTag( static_cast<mb::osal::FutexSemaphore *>( smphr )->profile_id, tag );
+  }
+}    // namespace mb::osal::sim
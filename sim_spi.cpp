@@ -11,10 +11,587 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <mbedutils/interfaces/spi_intf.hpp>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "sim_spi.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct QueuedTransfer
+  {
+    Transaction     txn;
+    std::thread::id owner; /**< Thread that queued the transfer */
+  };
+
+  /**
+   * @brief Transfer queue and worker behind a port's asynchronous engine.
+   *
+   * Synchronous transfers share the wire with the queue. They wait out a
+   * queued transfer in flight and any chip select framed sequence another
+   * thread has open, and the worker holds off while one is running.
+   */
+  struct AsyncEngine
+  {
+    std::mutex                 mtx;
+    std::condition_variable    cv;
+    std::deque<QueuedTransfer> pending;
+    std::thread                worker;
+    bool                       stop        = false;
+    bool                       busy        = false;
+    size_t                     sync_active = 0;
+    bool                       frame_open  = false;
+    std::thread::id            frame_owner = {};
+    int64_t                    last_end    = 0;
+    AsyncStats                 stats       = {};
+  };
+
+  /**
+   * @brief State of a single simulated SPI bus.
+   *
+   * The owner lock is the port exclusion handed out by intf::lock(). The guard
+   * protects the device table and serializes calls into the models, which
+   * lets the asynchronous worker run transfers for a task holding the port.
+   */
+  struct SpiBus
+  {
+    std::recursive_mutex                                           owner;
+    size_t                                                         lock_depth = 0;
+    std::mutex                                                     guard;
+    bool                                                           initialized = false;
+    mb::hw::spi::SpiConfig                                         config      = {};
+    std::unordered_map<ChipSelect_t, std::shared_ptr<DeviceModel>> devices;
+    DeviceModel                                                   *active = nullptr;
+    std::atomic<uint32_t>                                          clock_hz{ 0 };
+    std::unique_ptr<AsyncEngine>                                   async;
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::array<SpiBus, MAX_PORTS> s_bus;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static inline SpiBus *get_bus( const Port_t port )
+  {
+    const size_t idx = static_cast<size_t>( port );
+    return ( idx < MAX_PORTS ) ? &s_bus[ idx ] : nullptr;
+  }
+
+
+  /**
+   * @brief Simulated time needed to shift a number of bytes at the bus clock
+   */
+  static inline int64_t bus_time_ns( const SpiBus &bus, const size_t length )
+  {
+    const uint64_t hz = bus.clock_hz.load( std::memory_order_relaxed );
+    if( !hz )
+    {
+      return 0;
+    }
+
+    return static_cast<int64_t>( ( static_cast<uint64_t>( length ) * 8u * 1000000000ull + hz - 1 ) / hz );
+  }
+
+
+  /**
+   * @brief Releases the selected device. Bus guard must be held.
+   */
+  static void release_selection( SpiBus &bus )
+  {
+    if( bus.active )
+    {
+      DeviceModel *dev = bus.active;
+      bus.active       = nullptr;
+      dev->deselect();
+    }
+  }
+
+
+  /**
+   * @brief Drops the selected device mid frame, without latching anything. Bus guard must be held.
+   */
+  static void abort_selection( SpiBus &bus )
+  {
+    if( bus.active )
+    {
+      DeviceModel *dev = bus.active;
+      bus.active       = nullptr;
+      dev->abort();
+    }
+  }
+
+
+  /**
+   * @brief Selects the device on a chip select. Bus guard must be held.
+   */
+  static bool select_device( SpiBus &bus, const ChipSelect_t cs )
+  {
+    auto iter = bus.devices.find( cs );
+    if( iter == bus.devices.end() )
+    {
+      return false;
+    }
+
+    if( bus.active != iter->second.get() )
+    {
+      release_selection( bus );
+      bus.active = iter->second.get();
+      bus.active->select();
+    }
+
+    return true;
+  }
+
+
+  /**
+   * @brief Finds the device a transfer should reach. Bus guard must be held.
+   *
+   * A lone device on the port is implicitly selected on first use, which
+   * covers drivers that toggle their chip select through GPIO.
+   */
+  static DeviceModel *active_device( SpiBus &bus )
+  {
+    if( !bus.active && ( bus.devices.size() == 1 ) )
+    {
+      bus.active = bus.devices.begin()->second.get();
+      bus.active->select();
+    }
+
+    return bus.active;
+  }
+
+
+  /**
+   * @brief Clocks bytes through whatever device is selected. Bus guard must be held.
+   */
+  static void clock_bytes( SpiBus &bus, const uint8_t *tx, uint8_t *rx, const size_t length )
+  {
+    if( DeviceModel *dev = active_device( bus ); dev )
+    {
+      dev->transfer( tx, rx, length );
+    }
+    else if( rx )
+    {
+      /*-----------------------------------------------------------------------
+      Nothing is driving MISO, so it floats high
+      -----------------------------------------------------------------------*/
+      memset( rx, IDLE_BYTE, length );
+    }
+  }
+
+
+  /**
+   * @brief Runs a blocking transfer against the selected device on the port
+   *
+   * @param port    Port to transfer on
+   * @param tx      Bytes to send, nullptr to clock out IDLE_BYTE
+   * @param rx      Where to store received bytes, nullptr to discard
+   * @param length  Number of bytes
+   * @return int    Bytes transferred, or -1 if the port is invalid
+   */
+  static int dispatch( const Port_t port, const uint8_t *tx, uint8_t *rx, const size_t length )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return -1;
+    }
+
+    AsyncEngine *eng = nullptr;
+    {
+      std::lock_guard<std::mutex> guard( bus->guard );
+      eng = bus->async.get();
+    }
+
+    /*-------------------------------------------------------------------------
+    Claim the wire from the asynchronous engine, if the port has one
+    -------------------------------------------------------------------------*/
+    if( eng )
+    {
+      const auto self = std::this_thread::get_id();
+
+      mb::thread::sim::BlockedScope blocked;
+      std::unique_lock<std::mutex>  lock( eng->mtx );
+      eng->cv.wait( lock, [ eng, self ] {
+        return eng->stop || ( !eng->busy && ( !eng->frame_open || ( eng->frame_owner == self ) ) );
+      } );
+      eng->sync_active++;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard( bus->guard );
+      clock_bytes( *bus, tx, rx, length );
+    }
+
+    if( const int64_t wire_ns = bus_time_ns( *bus, length ); wire_ns )
+    {
+      mb::time::sim::sleepFor( wire_ns );
+    }
+
+    if( eng )
+    {
+      {
+        std::lock_guard<std::mutex> lock( eng->mtx );
+        eng->sync_active--;
+      }
+      eng->cv.notify_all();
+    }
+
+    return static_cast<int>( length );
+  }
+
+
+  /**
+   * @brief Executes one queued transfer, including its chip select framing
+   */
+  static int run_transaction( SpiBus &bus, const Transaction &txn )
+  {
+    std::lock_guard<std::mutex> guard( bus.guard );
+
+    if( txn.assert_cs && !select_device( bus, txn.chip_select ) )
+    {
+      return -1;
+    }
+
+    clock_bytes( bus, static_cast<const uint8_t *>( txn.tx ), static_cast<uint8_t *>( txn.rx ), txn.length );
+
+    if( txn.release_cs )
+    {
+      release_selection( bus );
+    }
+
+    return static_cast<int>( txn.length );
+  }
+
+
+  /**
+   * @brief Worker servicing a port's transfer queue
+   */
+  static void async_worker( const Port_t port, SpiBus *bus, AsyncEngine *eng )
+  {
+    std::unique_lock<std::mutex> lock( eng->mtx );
+
+    while( true )
+    {
+      eng->cv.wait( lock, [ eng ] { return eng->stop || ( !eng->pending.empty() && !eng->sync_active ); } );
+      if( eng->stop )
+      {
+        break;
+      }
+
+      Transaction     txn   = std::move( eng->pending.front().txn );
+      std::thread::id owner = eng->pending.front().owner;
+      eng->pending.pop_front();
+      eng->busy = true;
+      lock.unlock();
+
+      /*-----------------------------------------------------------------------
+      Move the data, then hold the bus for its time on the wire
+      -----------------------------------------------------------------------*/
+      const int64_t start  = mb::time::sim::nanos();
+      const int     result = run_transaction( *bus, txn );
+
+      if( const int64_t wire_ns = bus_time_ns( *bus, txn.length ); wire_ns && ( result >= 0 ) )
+      {
+        mb::time::sim::sleepUntil( start + wire_ns );
+      }
+
+      const int64_t end = mb::time::sim::nanos();
+
+      /*-----------------------------------------------------------------------
+      Deliver the completion "interrupt"
+      -----------------------------------------------------------------------*/
+      if( txn.callback )
+      {
+        txn.callback( port, result );
+      }
+
+      lock.lock();
+      if( txn.release_cs || ( result < 0 ) )
+      {
+        eng->frame_open = false;
+      }
+      else if( txn.assert_cs )
+      {
+        eng->frame_open  = true;
+        eng->frame_owner = owner;
+      }
+
+      eng->stats.completed++;
+      eng->stats.bus_busy_ns += end - start;
+      if( eng->last_end )
+      {
+        eng->stats.bus_idle_ns += std::max<int64_t>( 0, start - eng->last_end );
+      }
+      eng->last_end = end;
+      eng->busy     = false;
+      eng->cv.notify_all();
+    }
+  }
+
+
+  /**
+   * @brief Gets the port's asynchronous engine, starting it on first use
+   */
+  static AsyncEngine *get_engine( const Port_t port, SpiBus &bus )
+  {
+    std::lock_guard<std::mutex> guard( bus.guard );
+
+    if( !bus.async )
+    {
+      bus.async         = std::make_unique<AsyncEngine>();
+      bus.async->worker = std::thread( async_worker, port, &bus, bus.async.get() );
+    }
+
+    return bus.async.get();
+  }
+
+
+  /**
+   * @brief Stops a port's asynchronous engine, dropping anything still queued
+   */
+  static void stop_engine( SpiBus &bus )
+  {
+    std::unique_ptr<AsyncEngine> eng;
+    {
+      std::lock_guard<std::mutex> guard( bus.guard );
+      eng = std::move( bus.async );
+    }
+
+    if( !eng )
+    {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock( eng->mtx );
+      eng->stop = true;
+      eng->pending.clear();
+    }
+
+    eng->cv.notify_all();
+    if( eng->worker.joinable() )
+    {
+      eng->worker.join();
+    }
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool attachDevice( const Port_t port, const ChipSelect_t cs, std::shared_ptr<DeviceModel> model )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus || !model )
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+
+    auto iter = bus->devices.find( cs );
+    if( ( iter != bus->devices.end() ) && ( iter->second.get() == bus->active ) )
+    {
+      abort_selection( *bus );
+    }
+
+    bus->devices[ cs ] = std::move( model );
+    return true;
+  }
+
+
+  void detachDevice( const Port_t port, const ChipSelect_t cs )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+
+    auto iter = bus->devices.find( cs );
+    if( iter == bus->devices.end() )
+    {
+      return;
+    }
+
+    if( iter->second.get() == bus->active )
+    {
+      abort_selection( *bus );
+    }
+
+    bus->devices.erase( iter );
+  }
+
+
+  bool select( const Port_t port, const ChipSelect_t cs )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    return select_device( *bus, cs );
+  }
+
+
+  void deselect( const Port_t port )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    release_selection( *bus );
+  }
+
+
+  void setBusClock( const Port_t port, const uint32_t hz )
+  {
+    if( SpiBus *bus = get_bus( port ); bus )
+    {
+      bus->clock_hz.store( hz, std::memory_order_relaxed );
+    }
+  }
+
+
+  bool queueTransfer( const Port_t port, const Transaction &txn )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return false;
+    }
+
+    AsyncEngine *eng = get_engine( port, *bus );
+    {
+      std::lock_guard<std::mutex> lock( eng->mtx );
+      if( eng->stop )
+      {
+        return false;
+      }
+
+      eng->pending.push_back( QueuedTransfer{ txn, std::this_thread::get_id() } );
+      eng->stats.queued++;
+      eng->stats.max_depth = std::max( eng->stats.max_depth, eng->pending.size() + ( eng->busy ? 1 : 0 ) );
+    }
+
+    eng->cv.notify_all();
+    return true;
+  }
+
+
+  void flushQueue( const Port_t port )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    AsyncEngine *eng = nullptr;
+    {
+      std::lock_guard<std::mutex> guard( bus->guard );
+      eng = bus->async.get();
+    }
+
+    if( eng )
+    {
+      mb::thread::sim::BlockedScope blocked;
+      std::unique_lock<std::mutex>  lock( eng->mtx );
+      eng->cv.wait( lock, [ eng ] { return eng->stop || ( eng->pending.empty() && !eng->busy ); } );
+    }
+  }
+
+
+  AsyncStats getAsyncStats( const Port_t port )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return {};
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    if( !bus->async )
+    {
+      return {};
+    }
+
+    std::lock_guard<std::mutex> lock( bus->async->mtx );
+    return bus->async->stats;
+  }
+
+
+  void resetAsyncStats( const Port_t port )
+  {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    if( bus->async )
+    {
+      std::lock_guard<std::mutex> lock( bus->async->mtx );
+      bus->async->stats    = {};
+      bus->async->last_end = 0;
+    }
+  }
+
+
+  bool resetState()
+  {
+    bool released = true;
+    for( SpiBus &bus : s_bus )
+    {
+      stop_engine( bus );
+
+      std::lock_guard<std::mutex> guard( bus.guard );
+      abort_selection( bus );
+      bus.config      = {};
+      bus.initialized = false;
+
+      if( bus.lock_depth )
+      {
+        released = false;
+      }
+    }
+
+    return released;
+  }
+}    // namespace mb::hw::spi::sim
+
 
 namespace mb::hw::spi::intf
 {
+  using namespace mb::hw::spi::sim;
+
   /*---------------------------------------------------------------------------
   Public Functions
   ---------------------------------------------------------------------------*/
@@ -26,44 +603,107 @@ namespace mb::hw::spi::intf
 
   void driver_teardown()
   {
+    resetState();
+
+    for( SpiBus &bus : s_bus )
+    {
+      std::lock_guard<std::mutex> guard( bus.guard );
+      bus.devices.clear();
+    }
   }
 
 
   void init( const mb::hw::spi::SpiConfig &config )
   {
+    SpiBus *bus = get_bus( config.port );
+    if( !bus )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    bus->config      = config;
+    bus->initialized = true;
   }
 
 
   void deinit( const mb::hw::spi::Port_t port )
   {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard( bus->guard );
+    release_selection( *bus );
+    bus->initialized = false;
   }
 
 
   int write( const mb::hw::spi::Port_t port, const void *data, const size_t length )
   {
-    return length;
+    return dispatch( port, static_cast<const uint8_t *>( data ), nullptr, length );
   }
 
 
   int read( const mb::hw::spi::Port_t port, void *data, const size_t length )
   {
-    return length;
+    return dispatch( port, nullptr, static_cast<uint8_t *>( data ), length );
   }
 
 
   int transfer( const mb::hw::spi::Port_t port, const void *tx, void *rx, const size_t length )
   {
-    return length;
+    return dispatch( port, static_cast<const uint8_t *>( tx ), static_cast<uint8_t *>( rx ), length );
   }
 
 
   void lock( const mb::hw::spi::Port_t port )
   {
+    SpiBus *bus = get_bus( port );
+    if( !bus )
+    {
+      return;
+    }
+
+    if( !bus->owner.try_lock() )
+    {
+      mb::thread::sim::BlockedScope blocked;
+      bus->owner.lock();
+    }
+
+    bus->lock_depth++;
   }
 
 
   void unlock( const mb::hw::spi::Port_t port )
   {
+    SpiBus *bus = get_bus( port );
+    if( !bus || ( bus->lock_depth == 0 ) )
+    {
+      return;
+    }
+
+    /*-------------------------------------------------------------------------
+    Leaving the outermost critical section ends the transaction on the wire
+    -------------------------------------------------------------------------*/
+    if( --bus->lock_depth == 0 )
+    {
+      std::lock_guard<std::mutex> guard( bus->guard );
+      release_selection( *bus );
+
+      if( bus->async )
+      {
+        {
+          std::lock_guard<std::mutex> lock( bus->async->mtx );
+          bus->async->frame_open = false;
+        }
+        bus->async->cv.notify_all();
+      }
+    }
+
+    bus->owner.unlock();
   }
 
 }    // namespace mb::hw::spi::intf
@@ -0,0 +1,245 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_spi.hpp
+ *
+ *  Description:
+ *    Simulator specific interface to the SPI driver
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_SPI_HPP
+#define MBEDUTILS_SIM_SPI_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mbedutils/interfaces/spi_intf.hpp>
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  using ChipSelect_t = size_t;
+
+  /**
+   * @brief Completion handler for an asynchronous transfer
+   *
+   * @param port    Port the transfer ran on
+   * @param result  Bytes transferred, or negative on failure
+   */
+  using CompletionCallback = std::function<void( const Port_t port, const int result )>;
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Number of SPI ports the simulator can model
+   */
+  static constexpr size_t MAX_PORTS = 16;
+
+  /**
+   * @brief Value clocked out on MOSI for reads, and seen on MISO with no device
+   */
+  static constexpr uint8_t IDLE_BYTE = 0xFF;
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief A transfer queued on the asynchronous engine.
+   *
+   * Like a DMA descriptor, the buffers are used in place and must stay valid
+   * until the completion callback runs.
+   */
+  struct Transaction
+  {
+    const void        *tx          = nullptr; /**< Bytes to send, nullptr to clock out IDLE_BYTE */
+    void              *rx          = nullptr; /**< Where to store received bytes, nullptr to discard */
+    size_t             length      = 0;       /**< Number of bytes to clock */
+    bool               assert_cs   = false;   /**< Select chip_select before the transfer */
+    bool               release_cs  = false;   /**< Deselect the device once the transfer is done */
+    ChipSelect_t       chip_select = 0;       /**< Device to select when assert_cs is set */
+    CompletionCallback callback    = nullptr; /**< Invoked once the transfer completes */
+  };
+
+  /**
+   * @brief Throughput statistics of a port's asynchronous engine
+   */
+  struct AsyncStats
+  {
+    uint64_t queued;      /**< Transfers submitted */
+    uint64_t completed;   /**< Transfers finished */
+    size_t   max_depth;   /**< Deepest the queue has been */
+    int64_t  bus_busy_ns; /**< Simulated time spent clocking data */
+    int64_t  bus_idle_ns; /**< Simulated time the bus sat idle between transfers */
+  };
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Behavioral model of a device sitting on a simulated SPI bus.
+   *
+   * Models are invoked directly on the calling thread with the caller's own
+   * buffers, so there is no copying or IPC between the driver and the model.
+   * The bus serializes all calls into a model attached to it.
+   */
+  class DeviceModel
+  {
+  public:
+    virtual ~DeviceModel() = default;
+
+    /**
+     * @brief Called when the device's chip select is asserted
+     */
+    virtual void select()
+    {
+    }
+
+    /**
+     * @brief Called when the device's chip select is released
+     */
+    virtual void deselect()
+    {
+    }
+
+    /**
+     * @brief Called instead of deselect() when a frame is cut short
+     *
+     * Happens on a warm reset, or when the model is detached or replaced mid
+     * frame. Nothing clocked in so far should take effect. Defaults to
+     * deselect().
+     */
+    virtual void abort()
+    {
+      deselect();
+    }
+
+    /**
+     * @brief Clocks bytes through the device while it is selected
+     *
+     * @param tx      Bytes driven on MOSI, or nullptr to clock out IDLE_BYTE
+     * @param rx      Buffer to fill from MISO, or nullptr if it is discarded
+     * @param length  Number of bytes to clock
+     */
+    virtual void transfer( const uint8_t *tx, uint8_t *rx, const size_t length ) = 0;
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Attaches a device model to a port behind a chip select.
+   *
+   * If it is the only device on the port, transfers reach it without an
+   * explicit select() call, which suits drivers that drive the chip select
+   * themselves. Any model already on the same chip select is replaced.
+   *
+   * @param port    SPI port the device sits on
+   * @param cs      Chip select line of the device
+   * @param model   Device model to attach
+   * @return true   The device was attached
+   */
+  bool attachDevice( const Port_t port, const ChipSelect_t cs, std::shared_ptr<DeviceModel> model );
+
+  /**
+   * @brief Removes a device model from a port
+   *
+   * @param port    SPI port the device sits on
+   * @param cs      Chip select line of the device
+   */
+  void detachDevice( const Port_t port, const ChipSelect_t cs );
+
+  /**
+   * @brief Asserts the chip select of a device on the port.
+   *
+   * Any other selected device on the port is deselected first. The selection
+   * is released by deselect(), or automatically when the port is unlocked.
+   *
+   * @param port    SPI port the device sits on
+   * @param cs      Chip select line to assert
+   * @return true   A device exists on that chip select and is now selected
+   */
+  bool select( const Port_t port, const ChipSelect_t cs );
+
+  /**
+   * @brief Releases whichever chip select is asserted on the port
+   *
+   * @param port    SPI port to deselect
+   */
+  void deselect( const Port_t port );
+
+  /**
+   * @brief Sets the SCK rate used to model time on the wire.
+   *
+   * With a non-zero clock every transfer, blocking or queued, occupies the
+   * bus for the simulated time it would take to shift its bytes out. Zero,
+   * the default, makes transfers complete instantly.
+   *
+   * @param port    SPI port to configure
+   * @param hz      Bus clock in Hz
+   */
+  void setBusClock( const Port_t port, const uint32_t hz );
+
+  /**
+   * @brief Queues a transfer on the port's asynchronous engine.
+   *
+   * A per-port worker runs queued transfers back to back against the attached
+   * devices, then invokes each completion callback from that worker, much like
+   * a DMA complete interrupt. Callbacks may queue further transfers.
+   *
+   * @param port    SPI port to transfer on
+   * @param txn     Transfer description
+   * @return true   The transfer was queued
+   */
+  bool queueTransfer( const Port_t port, const Transaction &txn );
+
+  /**
+   * @brief Blocks until every queued transfer on the port has completed
+   *
+   * @param port    SPI port to wait on
+   */
+  void flushQueue( const Port_t port );
+
+  /**
+   * @brief Gets the asynchronous engine statistics for a port
+   *
+   * @param port    SPI port to query
+   * @return AsyncStats
+   */
+  AsyncStats getAsyncStats( const Port_t port );
+
+  /**
+   * @brief Clears the asynchronous engine statistics for a port
+   *
+   * @param port    SPI port to reset
+   */
+  void resetAsyncStats( const Port_t port );
+
+  /**
+   * @brief Returns every port to its power-on state for a warm reset.
+   *
+   * Drops queued transactions, deselects any device and marks the ports as
+   * uninitialized. Attached device models stay attached and keep their
+   * contents, just like external chips across an MCU reset.
+   *
+   * @return true   All ports were released. False if a port is still locked
+   *                by a task that no longer exists, which can't be undone.
+   */
+  bool resetState();
+
+}    // namespace mb::hw::spi::sim
+
+#endif /* !MBEDUTILS_SIM_SPI_HPP */
@@ -0,0 +1,239 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_spi_bridge.cpp
+ *
+ *  Description:
+ *    Forwards a simulated SPI device to a model running in another process
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mbedutils/logging.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "sim_io_pipe.hpp"
+#include "sim_spi_bridge.hpp"
+#include "sim_thread.hpp"
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Buffered write data that forces a flush even without a read
+   */
+  static constexpr size_t MAX_BATCH_BYTES = 64 * 1024;
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Device model that proxies every operation to a remote process
+   */
+  class RemoteDevice : public DeviceModel
+  {
+  public:
+    RemoteDevice( const Port_t port, const ChipSelect_t cs, const std::string &endpoint, const bool bind,
+                  const uint32_t timeout_ms ) :
+        mPort( port ), mChipSelect( cs ), mTimeout( timeout_ms ), mPipe( endpoint, bind ), mSequence( 0 ),
+        mExpected( 0 ), mReplied( false )
+    {
+      begin_batch();
+      mPipe.setReceiveCallback( [ this ]( const uint8_t *data, const size_t size ) { on_receive( data, size ); } );
+    }
+
+    ~RemoteDevice() override
+    {
+      mPipe.stop();
+    }
+
+    bool start()
+    {
+      return mPipe.start();
+    }
+
+    void select() override
+    {
+      append_op( BRIDGE_OP_SELECT, nullptr, 0, 0 );
+    }
+
+    void deselect() override
+    {
+      append_op( BRIDGE_OP_DESELECT, nullptr, 0, 0 );
+      flush( nullptr, 0 );
+    }
+
+    void transfer( const uint8_t *tx, uint8_t *rx, const size_t length ) override
+    {
+      append_op( BRIDGE_OP_TRANSFER, tx, tx ? length : 0, rx ? length : 0 );
+
+      if( rx )
+      {
+        flush( rx, length );
+      }
+      else if( mBatch.size() >= MAX_BATCH_BYTES )
+      {
+        flush( nullptr, 0 );
+      }
+    }
+
+  private:
+    const Port_t       mPort;
+    const ChipSelect_t mChipSelect;
+    const uint32_t     mTimeout;
+
+    mb::hw::sim::BidirectionalPipe mPipe;
+    std::vector<uint8_t>           mBatch;
+    uint32_t                       mOpCount;
+    uint32_t                       mSequence;
+
+    std::mutex              mReplyMtx;
+    std::condition_variable mReplyCV;
+    uint32_t                mExpected;
+    bool                    mReplied;
+    std::vector<uint8_t>    mReply;
+
+    /**
+     * @brief Starts a new request with room for its header
+     */
+    void begin_batch()
+    {
+      mBatch.clear();
+      mBatch.resize( sizeof( BridgeHeader ) );
+      mOpCount = 0;
+    }
+
+    void append_op( const BridgeOpType type, const uint8_t *tx, const size_t tx_length, const size_t rx_length )
+    {
+      BridgeOp op = {};
+      op.type      = type;
+      op.tx_length = static_cast<uint32_t>( tx_length );
+      op.rx_length = static_cast<uint32_t>( rx_length );
+
+      const uint8_t *raw = reinterpret_cast<const uint8_t *>( &op );
+      mBatch.insert( mBatch.end(), raw, raw + sizeof( op ) );
+      if( tx_length )
+      {
+        mBatch.insert( mBatch.end(), tx, tx + tx_length );
+      }
+
+      mOpCount++;
+    }
+
+    /**
+     * @brief Sends the batched operations, waiting for MISO data if needed
+     *
+     * @param rx      Destination of the reply data, nullptr if none is needed
+     * @param length  Number of reply bytes expected
+     */
+    void flush( uint8_t *rx, const size_t length )
+    {
+      if( !mOpCount )
+      {
+        return;
+      }
+
+      BridgeHeader hdr = {};
+      hdr.magic        = BRIDGE_MAGIC;
+      hdr.sequence     = ++mSequence;
+      hdr.port         = static_cast<uint16_t>( mPort );
+      hdr.flags        = rx ? BRIDGE_FLAG_REPLY : 0;
+      hdr.chip_select  = static_cast<uint32_t>( mChipSelect );
+      hdr.op_count     = mOpCount;
+      memcpy( mBatch.data(), &hdr, sizeof( hdr ) );
+
+      if( rx )
+      {
+        std::lock_guard<std::mutex> lock( mReplyMtx );
+        mExpected = hdr.sequence;
+        mReplied  = false;
+      }
+
+      mPipe.write( mBatch );
+      begin_batch();
+
+      if( !rx )
+      {
+        return;
+      }
+
+      /*-----------------------------------------------------------------------
+      Wait for the device model to answer
+      -----------------------------------------------------------------------*/
+      mb::thread::sim::BlockedScope blocked;
+      std::unique_lock<std::mutex>  lock( mReplyMtx );
+
+      const bool answered =
+          mReplyCV.wait_for( lock, std::chrono::milliseconds( mTimeout ), [ this ] { return mReplied; } );
+
+      if( answered && ( mReply.size() >= length ) )
+      {
+        memcpy( rx, mReply.data() + ( mReply.size() - length ), length );
+      }
+      else
+      {
+        LOG_ERROR( "SPI bridge on port %d cs %d: no reply from device model", static_cast<int>( mPort ),
+                   static_cast<int>( mChipSelect ) );
+        memset( rx, IDLE_BYTE, length );
+      }
+
+      mExpected = 0;
+    }
+
+    void on_receive( const uint8_t *data, const size_t size )
+    {
+      if( size < sizeof( BridgeHeader ) )
+      {
+        return;
+      }
+
+      BridgeHeader hdr;
+      memcpy( &hdr, data, sizeof( hdr ) );
+
+      if( ( hdr.magic != BRIDGE_MAGIC ) || !( hdr.flags & BRIDGE_FLAG_RESPONSE ) )
+      {
+        return;
+      }
+
+      /*-----------------------------------------------------------------------
+      Late answers to requests that already timed out are dropped
+      -----------------------------------------------------------------------*/
+      std::lock_guard<std::mutex> lock( mReplyMtx );
+      if( !mExpected || ( hdr.sequence != mExpected ) )
+      {
+        return;
+      }
+
+      mReply.assign( data + sizeof( BridgeHeader ), data + size );
+      mReplied = true;
+      mReplyCV.notify_all();
+    }
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool attachBridge( const Port_t port, const ChipSelect_t cs, const std::string &endpoint, const bool bind,
+                     const uint32_t timeout_ms )
+  {
+    auto device = std::make_shared<RemoteDevice>( port, cs, endpoint, bind, timeout_ms );
+    if( !device->start() )
+    {
+      return false;
+    }
+
+    return attachDevice( port, cs, device );
+  }
+
+}    // namespace mb::hw::spi::sim
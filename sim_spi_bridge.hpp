@@ -0,0 +1,113 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_spi_bridge.hpp
+ *
+ *  Description:
+ *    Forwards a simulated SPI device to a model running in another process
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_SPI_BRIDGE_HPP
+#define MBEDUTILS_SIM_SPI_BRIDGE_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "sim_spi.hpp"
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr uint32_t BRIDGE_MAGIC = 0x42495053; /**< "SPIB" on the wire */
+
+  /**
+   * @brief Operations that make up a bridge request
+   */
+  enum BridgeOpType : uint8_t
+  {
+    BRIDGE_OP_SELECT   = 0, /**< Chip select asserted */
+    BRIDGE_OP_DESELECT = 1, /**< Chip select released */
+    BRIDGE_OP_TRANSFER = 2, /**< Bytes clocked through the device */
+  };
+
+  /**
+   * @brief Bits of BridgeHeader::flags
+   */
+  enum BridgeFlags : uint16_t
+  {
+    BRIDGE_FLAG_REPLY    = 1u << 0, /**< Request: the sender is waiting for a response */
+    BRIDGE_FLAG_RESPONSE = 1u << 1, /**< Set on messages from the device model */
+  };
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Leading header of every bridge message, little endian.
+   *
+   * A request carries op_count BridgeOp records, each followed by tx_length
+   * bytes of MOSI data. A transfer with no tx data clocks out IDLE_BYTE. All
+   * operations issued while the firmware holds the port are batched into as
+   * few requests as possible: only a transfer that needs MISO data forces a
+   * request with BRIDGE_FLAG_REPLY set.
+   *
+   * The device model must answer such a request with a header echoing the
+   * sequence number, BRIDGE_FLAG_RESPONSE set and op_count of zero, followed
+   * by the MISO bytes of every op with a non-zero rx_length, concatenated in
+   * order. Requests without BRIDGE_FLAG_REPLY get no response.
+   */
+  struct __attribute__( ( packed ) ) BridgeHeader
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t port;
+    uint16_t flags;
+    uint32_t chip_select;
+    uint32_t op_count;
+  };
+
+  /**
+   * @brief A single operation within a bridge request
+   */
+  struct __attribute__( ( packed ) ) BridgeOp
+  {
+    uint8_t  type;      /**< One of BridgeOpType */
+    uint8_t  reserved[ 3 ];
+    uint32_t tx_length; /**< MOSI bytes following this record */
+    uint32_t rx_length; /**< MISO bytes wanted back for this op */
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Attaches a device whose model lives in another process.
+   *
+   * Transactions on the chip select are forwarded over a BidirectionalPipe
+   * using the BridgeHeader framing. Writes are buffered and only sent when a
+   * read needs an answer or the chip select is released, so a typical
+   * command-then-read sequence under one lock costs a single round trip.
+   *
+   * @param port        SPI port the device sits on
+   * @param cs          Chip select line of the device
+   * @param endpoint    ZMQ endpoint of the device model process
+   * @param bind        True to bind the endpoint, false to connect to it
+   * @param timeout_ms  How long to wait for a reply before reading IDLE_BYTE
+   * @return true       The pipe started and the device is attached
+   */
+  bool attachBridge( const Port_t port, const ChipSelect_t cs, const std::string &endpoint, const bool bind = false,
+                     const uint32_t timeout_ms = 1000 );
+
+}    // namespace mb::hw::spi::sim
+
+#endif /* !MBEDUTILS_SIM_SPI_BRIDGE_HPP */
@@ -0,0 +1,452 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_spi_flash.cpp
+ *
+ *  Description:
+ *    SPI NOR flash device model for the simulator SPI bus
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sim_spi_flash.hpp"
+#include "sim_time.hpp"
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr uint8_t CMD_PAGE_PROGRAM   = 0x02;
+  static constexpr uint8_t CMD_READ           = 0x03;
+  static constexpr uint8_t CMD_WRITE_DISABLE  = 0x04;
+  static constexpr uint8_t CMD_READ_STATUS    = 0x05;
+  static constexpr uint8_t CMD_WRITE_ENABLE   = 0x06;
+  static constexpr uint8_t CMD_FAST_READ      = 0x0B;
+  static constexpr uint8_t CMD_SECTOR_ERASE   = 0x20;
+  static constexpr uint8_t CMD_BLOCK32_ERASE  = 0x52;
+  static constexpr uint8_t CMD_CHIP_ERASE_ALT = 0x60;
+  static constexpr uint8_t CMD_JEDEC_ID       = 0x9F;
+  static constexpr uint8_t CMD_CHIP_ERASE     = 0xC7;
+  static constexpr uint8_t CMD_BLOCK64_ERASE  = 0xD8;
+
+  static constexpr uint8_t STATUS_WIP = 0x01;
+  static constexpr uint8_t STATUS_WEL = 0x02;
+
+  static constexpr size_t BLOCK32_SIZE = 32 * 1024;
+  static constexpr size_t BLOCK64_SIZE = 64 * 1024;
+  static constexpr size_t ADDR_BYTES   = 3;
+  static constexpr size_t MAX_SIZE     = 1u << ( 8 * ADDR_BYTES );
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  NorFlash::NorFlash( const NorFlashConfig &config ) :
+      mConfig( config ), mMem( nullptr ), mMapLength( config.size ), mFd( -1 ), mSectors( 0 ), mPhase( Phase::OPCODE ),
+      mOpcode( 0 ), mAddrBytes( 0 ), mAddress( 0 ), mDataIdx( 0 ), mWriteEnabled( false ), mBusyUntil( 0 )
+  {
+    if( !mConfig.size || !mConfig.page_size || !mConfig.sector_size || ( mConfig.size > MAX_SIZE ) ||
+        ( mConfig.size % mConfig.sector_size ) || ( mConfig.size % mConfig.page_size ) )
+    {
+      throw std::invalid_argument( "Invalid NOR flash geometry" );
+    }
+
+    /*-------------------------------------------------------------------------
+    Map the storage. Anything that didn't exist before starts out erased.
+    -------------------------------------------------------------------------*/
+    size_t erased_from = 0;
+
+    if( mConfig.backing_file.empty() )
+    {
+      void *mem = mmap( nullptr, mMapLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( mem == MAP_FAILED )
+      {
+        throw std::runtime_error( "Failed to allocate NOR flash memory" );
+      }
+
+      mMem = static_cast<uint8_t *>( mem );
+    }
+    else
+    {
+      mFd = open( mConfig.backing_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+
+      struct stat st;
+      if( ( mFd < 0 ) || ( fstat( mFd, &st ) != 0 ) )
+      {
+        if( mFd >= 0 )
+        {
+          close( mFd );
+        }
+        throw std::runtime_error( "Failed to open NOR flash backing file: " + mConfig.backing_file );
+      }
+
+      erased_from = std::min<size_t>( static_cast<size_t>( st.st_size ), mMapLength );
+      if( ( erased_from < mMapLength ) && ( ftruncate( mFd, static_cast<off_t>( mMapLength ) ) != 0 ) )
+      {
+        close( mFd );
+        throw std::runtime_error( "Failed to size NOR flash backing file: " + mConfig.backing_file );
+      }
+
+      void *mem = mmap( nullptr, mMapLength, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0 );
+      if( mem == MAP_FAILED )
+      {
+        close( mFd );
+        throw std::runtime_error( "Failed to map NOR flash backing file: " + mConfig.backing_file );
+      }
+
+      mMem = static_cast<uint8_t *>( mem );
+    }
+
+    memset( mMem + erased_from, 0xFF, mMapLength - erased_from );
+
+    mSectors = mConfig.size / mConfig.sector_size;
+    mWear    = std::make_unique<std::atomic<uint32_t>[]>( mSectors );
+    mPage    = std::make_unique<uint8_t[]>( mConfig.page_size );
+  }
+
+
+  NorFlash::~NorFlash()
+  {
+    if( mMem )
+    {
+      munmap( mMem, mMapLength );
+    }
+
+    if( mFd >= 0 )
+    {
+      close( mFd );
+    }
+  }
+
+
+  void NorFlash::select()
+  {
+    mPhase   = Phase::OPCODE;
+    mOpcode  = 0;
+    mDataIdx = 0;
+  }
+
+
+  void NorFlash::deselect()
+  {
+    /*-------------------------------------------------------------------------
+    Program and erase operations latch on the rising edge of chip select, and
+    only if the full command was clocked in.
+    -------------------------------------------------------------------------*/
+    const bool addressed = ( mPhase == Phase::DATA ) || ( mPhase == Phase::IGNORE );
+
+    if( mWriteEnabled )
+    {
+      switch( mOpcode )
+      {
+        case CMD_PAGE_PROGRAM:
+          if( addressed && mDataIdx )
+          {
+            program();
+          }
+          break;
+
+        case CMD_SECTOR_ERASE:
+          if( addressed )
+          {
+            erase( mAddress, mConfig.sector_size, mConfig.sector_erase_ns );
+          }
+          break;
+
+        case CMD_BLOCK32_ERASE:
+          if( addressed )
+          {
+            erase( mAddress, BLOCK32_SIZE, mConfig.block32_erase_ns );
+          }
+          break;
+
+        case CMD_BLOCK64_ERASE:
+          if( addressed )
+          {
+            erase( mAddress, BLOCK64_SIZE, mConfig.block64_erase_ns );
+          }
+          break;
+
+        case CMD_CHIP_ERASE:
+        case CMD_CHIP_ERASE_ALT:
+          erase( 0, mConfig.size, mConfig.chip_erase_ns );
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    select();
+  }
+
+
+  void NorFlash::abort()
+  {
+    select();
+  }
+
+
+  void NorFlash::transfer( const uint8_t *tx, uint8_t *rx, const size_t length )
+  {
+    size_t idx = 0;
+
+    while( idx < length )
+    {
+      /*-----------------------------------------------------------------------
+      Array reads are streamed straight out of the mapping in bulk
+      -----------------------------------------------------------------------*/
+      if( ( mPhase == Phase::DATA ) && ( ( mOpcode == CMD_READ ) || ( mOpcode == CMD_FAST_READ ) ) )
+      {
+        while( idx < length )
+        {
+          const size_t chunk = std::min<size_t>( length - idx, mConfig.size - mAddress );
+          if( rx )
+          {
+            memcpy( rx + idx, mMem + mAddress, chunk );
+          }
+
+          mAddress = static_cast<uint32_t>( ( mAddress + chunk ) % mConfig.size );
+          idx += chunk;
+        }
+        break;
+      }
+
+      const uint8_t in  = tx ? tx[ idx ] : IDLE_BYTE;
+      uint8_t       out = IDLE_BYTE;
+
+      switch( mPhase )
+      {
+        case Phase::OPCODE:
+          begin_command( in );
+          break;
+
+        case Phase::ADDRESS:
+          mAddress = ( mAddress << 8 ) | in;
+          if( --mAddrBytes == 0 )
+          {
+            mAddress %= mConfig.size;
+
+            switch( mOpcode )
+            {
+              case CMD_FAST_READ:
+                mPhase = Phase::DUMMY;
+                break;
+
+              case CMD_READ:
+              case CMD_PAGE_PROGRAM:
+                mPhase = Phase::DATA;
+                break;
+
+              default:
+                mPhase = Phase::IGNORE;
+                break;
+            }
+          }
+          break;
+
+        case Phase::DUMMY:
+          mPhase = Phase::DATA;
+          break;
+
+        case Phase::DATA:
+          out = data_byte( in );
+          break;
+
+        case Phase::IGNORE:
+        default:
+          break;
+      }
+
+      if( rx )
+      {
+        rx[ idx ] = out;
+      }
+      idx++;
+    }
+  }
+
+
+  uint8_t *NorFlash::data()
+  {
+    return mMem;
+  }
+
+
+  size_t NorFlash::size() const
+  {
+    return mConfig.size;
+  }
+
+
+  uint32_t NorFlash::eraseCount( const size_t sector ) const
+  {
+    return ( sector < mSectors ) ? mWear[ sector ].load( std::memory_order_relaxed ) : 0;
+  }
+
+
+  size_t NorFlash::sectorCount() const
+  {
+    return mSectors;
+  }
+
+
+  void NorFlash::sync()
+  {
+    if( mFd >= 0 )
+    {
+      msync( mMem, mMapLength, MS_SYNC );
+    }
+  }
+
+
+  bool NorFlash::busy() const
+  {
+    return mBusyUntil && ( mb::time::sim::nanos() < mBusyUntil );
+  }
+
+
+  uint8_t NorFlash::status() const
+  {
+    return ( busy() ? STATUS_WIP : 0 ) | ( mWriteEnabled ? STATUS_WEL : 0 );
+  }
+
+
+  void NorFlash::begin_command( const uint8_t opcode )
+  {
+    mOpcode  = opcode;
+    mDataIdx = 0;
+    mPhase   = Phase::IGNORE;
+
+    /*-------------------------------------------------------------------------
+    A busy device only answers status polls
+    -------------------------------------------------------------------------*/
+    if( busy() && ( opcode != CMD_READ_STATUS ) )
+    {
+      mOpcode = 0;
+      return;
+    }
+
+    switch( opcode )
+    {
+      case CMD_JEDEC_ID:
+      case CMD_READ_STATUS:
+        mPhase = Phase::DATA;
+        break;
+
+      case CMD_WRITE_ENABLE:
+        mWriteEnabled = true;
+        break;
+
+      case CMD_WRITE_DISABLE:
+        mWriteEnabled = false;
+        break;
+
+      case CMD_PAGE_PROGRAM:
+        memset( mPage.get(), 0xFF, mConfig.page_size );
+        [[fallthrough]];
+
+      case CMD_READ:
+      case CMD_FAST_READ:
+      case CMD_SECTOR_ERASE:
+      case CMD_BLOCK32_ERASE:
+      case CMD_BLOCK64_ERASE:
+        mPhase     = Phase::ADDRESS;
+        mAddrBytes = ADDR_BYTES;
+        mAddress   = 0;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+
+  uint8_t NorFlash::data_byte( const uint8_t in )
+  {
+    switch( mOpcode )
+    {
+      case CMD_JEDEC_ID: {
+        const size_t n = mDataIdx++;
+        return ( n < 3 ) ? static_cast<uint8_t>( mConfig.jedec_id >> ( 8 * ( 2 - n ) ) ) : 0x00;
+      }
+
+      case CMD_READ_STATUS:
+        return status();
+
+      case CMD_PAGE_PROGRAM:
+        /*---------------------------------------------------------------------
+        Data past the end of the page wraps back to its start and replaces
+        what was latched there. Nothing reaches the array before deselect.
+        ---------------------------------------------------------------------*/
+        if( mWriteEnabled )
+        {
+          const size_t offset = ( ( mAddress % mConfig.page_size ) + mDataIdx ) % mConfig.page_size;
+          mPage[ offset ]     = in;
+          mDataIdx++;
+        }
+        return IDLE_BYTE;
+
+      default:
+        return IDLE_BYTE;
+    }
+  }
+
+
+  void NorFlash::program()
+  {
+    /*-------------------------------------------------------------------------
+    Programming can only clear bits. Unlatched bytes are 0xFF and keep theirs.
+    -------------------------------------------------------------------------*/
+    uint8_t *page = mMem + ( mAddress - ( mAddress % mConfig.page_size ) );
+    for( size_t idx = 0; idx < mConfig.page_size; idx++ )
+    {
+      page[ idx ] &= mPage[ idx ];
+    }
+
+    mWriteEnabled = false;
+    if( mConfig.page_program_ns )
+    {
+      mBusyUntil = mb::time::sim::nanos() + mConfig.page_program_ns;
+    }
+  }
+
+
+  void NorFlash::erase( const size_t address, const size_t length, const int64_t latency_ns )
+  {
+    /*-------------------------------------------------------------------------
+    A block erase in the last, partial block of a device that isn't a whole
+    number of blocks only reaches the end of the array.
+    -------------------------------------------------------------------------*/
+    const size_t block = std::min( length, mConfig.size );
+    const size_t start = address - ( address % block );
+    const size_t span  = std::min( block, mConfig.size - start );
+
+    memset( mMem + start, 0xFF, span );
+
+    const size_t first = start / mConfig.sector_size;
+    const size_t last  = ( start + span - 1 ) / mConfig.sector_size;
+    for( size_t sector = first; ( sector <= last ) && ( sector < mSectors ); sector++ )
+    {
+      mWear[ sector ].fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    mWriteEnabled = false;
+    if( latency_ns )
+    {
+      mBusyUntil = mb::time::sim::nanos() + latency_ns;
+    }
+  }
+
+}    // namespace mb::hw::spi::sim
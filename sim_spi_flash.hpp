@@ -0,0 +1,163 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_spi_flash.hpp
+ *
+ *  Description:
+ *    SPI NOR flash device model for the simulator SPI bus
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_SPI_FLASH_HPP
+#define MBEDUTILS_SIM_SPI_FLASH_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "sim_spi.hpp"
+
+namespace mb::hw::spi::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Geometry and timing of a simulated NOR flash part.
+   *
+   * Defaults describe a 4MB W25Q32 style device. Latencies are in simulated
+   * nanoseconds and set how long the busy bit stays up after the operation is
+   * started. Leave them at zero to complete every operation instantly.
+   */
+  struct NorFlashConfig
+  {
+    std::string backing_file     = "";       /**< File holding the contents, empty for RAM only */
+    size_t      size             = 4 * 1024 * 1024;
+    uint32_t    jedec_id         = 0xEF4016; /**< Manufacturer, type and capacity bytes */
+    size_t      page_size        = 256;
+    size_t      sector_size      = 4 * 1024;
+    int64_t     page_program_ns  = 0;
+    int64_t     sector_erase_ns  = 0;
+    int64_t     block32_erase_ns = 0;
+    int64_t     block64_erase_ns = 0;
+    int64_t     chip_erase_ns    = 0;
+  };
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Behavioral model of a serial NOR flash.
+   *
+   * Supports the common command set: JEDEC ID (9F), read (03), fast read (0B),
+   * write enable/disable (06/04), read status (05), page program (02), 4K
+   * sector erase (20), 32K/64K block erase (52/D8) and chip erase (C7/60),
+   * all with 24-bit addressing.
+   *
+   * Contents live in a memory mapped file, so large images load instantly
+   * and persist across runs. Programming can only clear bits, erases set them
+   * back to 0xFF, and each sector counts how many times it has been erased.
+   */
+  class NorFlash : public DeviceModel
+  {
+  public:
+    /**
+     * @brief Maps the backing storage for the flash.
+     *
+     * A backing file smaller than the device is grown and the new space is
+     * left erased. Throws std::invalid_argument unless the size is a whole
+     * number of pages and sectors, and std::runtime_error if the storage can't
+     * be mapped.
+     *
+     * @param config  Device description
+     */
+    explicit NorFlash( const NorFlashConfig &config );
+    ~NorFlash() override;
+
+    NorFlash( const NorFlash & )            = delete;
+    NorFlash &operator=( const NorFlash & ) = delete;
+
+    void select() override;
+    void deselect() override;
+    void abort() override;
+    void transfer( const uint8_t *tx, uint8_t *rx, const size_t length ) override;
+
+    /**
+     * @brief Direct access to the flash contents, for seeding or inspection
+     *
+     * @return uint8_t*
+     */
+    uint8_t *data();
+
+    /**
+     * @brief Gets the device size in bytes
+     *
+     * @return size_t
+     */
+    size_t size() const;
+
+    /**
+     * @brief Gets how many times a sector has been erased
+     *
+     * @param sector  Sector index
+     * @return uint32_t
+     */
+    uint32_t eraseCount( const size_t sector ) const;
+
+    /**
+     * @brief Gets the number of sectors tracked for wear
+     *
+     * @return size_t
+     */
+    size_t sectorCount() const;
+
+    /**
+     * @brief Flushes the contents out to the backing file
+     */
+    void sync();
+
+  private:
+    enum class Phase : uint8_t
+    {
+      OPCODE,
+      ADDRESS,
+      DUMMY,
+      DATA,
+      IGNORE
+    };
+
+    const NorFlashConfig mConfig;
+    uint8_t             *mMem;
+    size_t               mMapLength;
+    int                  mFd;
+    size_t               mSectors;
+
+    std::unique_ptr<std::atomic<uint32_t>[]> mWear;
+    std::unique_ptr<uint8_t[]>               mPage;
+
+    Phase    mPhase;
+    uint8_t  mOpcode;
+    uint8_t  mAddrBytes;
+    uint32_t mAddress;
+    size_t   mDataIdx;
+    bool     mWriteEnabled;
+    int64_t  mBusyUntil;
+
+    bool    busy() const;
+    uint8_t status() const;
+    void    begin_command( const uint8_t opcode );
+    uint8_t data_byte( const uint8_t in );
+    void    program();
+    void    erase( const size_t address, const size_t length, const int64_t latency_ns );
+  };
+
+}    // namespace mb::hw::spi::sim
+
+#endif /* !MBEDUTILS_SIM_SPI_FLASH_HPP */
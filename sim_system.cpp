@@ -11,20 +11,79 @@
 /*-----------------------------------------------------------------------------
 Includes
 -----------------------------------------------------------------------------*/
+#include <atomic>
+#include <fstream>
 #include <mbedutils/interfaces/system_intf.hpp>
 #include <mbedutils/logging.hpp>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <cstring>
+#include <vector>
+#include "sim_gpio.hpp"
+#include "sim_heap.hpp"
+#include "sim_node.hpp"
+#include "sim_osal.hpp"
+#include "sim_serial.hpp"
+#include "sim_spi.hpp"
+#include "sim_system.hpp"
+#include "sim_thread.hpp"
+#include "sim_timer.hpp"
 
-namespace mb::system::intf
+namespace mb::system::sim
 {
   /*---------------------------------------------------------------------------
-  Public Functions
+  Structures
   ---------------------------------------------------------------------------*/
 
-  void warm_reset()
+  /**
+   * @brief Per node warm reset bookkeeping
+   */
+  struct ResetState
+  {
+    std::atomic<bool> pending{ false }; /**< A reset thread has been handed this node */
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::atomic<EntryPoint> s_entry{ nullptr };
+  static std::atomic<uint32_t>   s_timeout_ms{ 1000 };
+  static std::atomic<uint64_t>   s_reset_count{ 0 };
+  static std::mutex              s_reset_lock;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Reads back the command line this process was started with
+   *
+   * @return std::vector<std::string>
+   */
+  static std::vector<std::string> read_cmdline()
+  {
+    std::vector<std::string> args;
+    std::ifstream            file( "/proc/self/cmdline", std::ios::binary );
+    std::string              arg;
+
+    while( std::getline( file, arg, '\0' ) )
+    {
+      args.push_back( arg );
+    }
+
+    return args;
+  }
+
+
+  /**
+   * @brief Replaces the process with a fresh copy of itself, keeping argv
+   */
+  [[noreturn]] static void reset_with_exec()
   {
     /*-------------------------------------------------------------------------
     Get path to our own executable
@@ -40,15 +99,146 @@ namespace mb::system::intf
     exe_path[ len ] = '\0';
 
     /*-------------------------------------------------------------------------
-    Create minimal argument array
+    Rebuild the original argument array, falling back to just the binary
     -------------------------------------------------------------------------*/
-    char *new_argv[] = { exe_path, NULL };
+    std::vector<std::string> args = read_cmdline();
+    std::vector<char *>      new_argv;
+
+    for( std::string &arg : args )
+    {
+      new_argv.push_back( arg.data() );
+    }
+
+    if( new_argv.empty() )
+    {
+      new_argv.push_back( exe_path );
+    }
+
+    new_argv.push_back( nullptr );
 
     /*-------------------------------------------------------------------------
     Replace current process
     -------------------------------------------------------------------------*/
-    execvp( exe_path, new_argv );
+    execvp( exe_path, new_argv.data() );
     LOG_ERROR( "Failed to restart: %s", strerror( errno ) );
     exit( EXIT_FAILURE );
   }
+
+
+  /**
+   * @brief Tears down all simulated firmware state and boots it again.
+   *
+   * Anything that can't be brought back to a clean state in process, like a
+   * task that won't stop, escalates to a full exec based reset. Tasks,
+   * timers, serial channels and OSAL objects are those of the given node,
+   * and the firmware reboots on it. GPIO, SPI and the heap are shared by the
+   * whole process, so they are only reset while a single node exists.
+   *
+   * @param entry   Firmware entry point to run once the reset is done
+   * @param node    Node being reset
+   */
+  static void reset_in_process( const EntryPoint entry, mb::hw::sim::Node *node )
+  {
+    mb::hw::sim::NodeScope scope( *node );
+
+    {
+      std::lock_guard<std::mutex> lock( s_reset_lock );
+
+      /*-----------------------------------------------------------------------
+      Silence the sources of asynchronous firmware calls, then the tasks
+      -----------------------------------------------------------------------*/
+      if( mb::time::sim::timerServiceNode() == node )
+      {
+        mb::time::sim::stopTimerService();
+      }
+
+      const int64_t timeout_ns = static_cast<int64_t>( s_timeout_ms.load() ) * 1000000LL;
+      if( !mb::thread::sim::cancelAllTasks( timeout_ns ) )
+      {
+        LOG_ERROR( "Warm reset could not stop all tasks, restarting the process" );
+        reset_with_exec();
+      }
+
+      /*-----------------------------------------------------------------------
+      Bring the drivers back to their power-on state
+      -----------------------------------------------------------------------*/
+      mb::time::sim::cancelAllTimers();
+      mb::hw::serial::sim::resetState();
+      mb::osal::sim::releaseBootMutexes();
+      mb::osal::sim::releaseBootSmphrs();
+
+      if( mb::hw::sim::nodeCount() == 1 )
+      {
+        mb::hw::gpio::sim::resetState();
+        mb::osal::sim::resetHeap();
+
+        if( !mb::hw::spi::sim::resetState() )
+        {
+          LOG_ERROR( "Warm reset found an SPI port locked by a dead task, restarting the process" );
+          reset_with_exec();
+        }
+      }
+
+      node->beginBoot();
+
+      s_reset_count.fetch_add( 1 );
+      node->state<ResetState>().pending.store( false );
+    }
+
+    entry();
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void setWarmResetEntry( EntryPoint entry, const uint32_t timeout_ms )
+  {
+    s_timeout_ms.store( timeout_ms );
+    s_entry.store( entry );
+  }
+
+
+  uint64_t getWarmResetCount()
+  {
+    return s_reset_count.load();
+  }
+}    // namespace mb::system::sim
+
+
+namespace mb::system::intf
+{
+  using namespace mb::system::sim;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void warm_reset()
+  {
+    const EntryPoint entry = s_entry.load();
+    if( !entry )
+    {
+      reset_with_exec();
+    }
+
+    mb::hw::sim::Node *node = &mb::hw::sim::currentNode();
+    if( !mb::thread::sim::isTaskThread() )
+    {
+      reset_in_process( entry, node );
+      return;
+    }
+
+    /*-------------------------------------------------------------------------
+    A task can't tear itself down, so hand the reset to another thread and
+    unwind. Later requests from the same node while one is in flight just
+    unwind as well. The reset thread acts on the requesting task's node.
+    -------------------------------------------------------------------------*/
+    if( !node->state<ResetState>().pending.exchange( true ) )
+    {
+      std::thread( reset_in_process, entry, node ).detach();
+    }
+
+    throw mb::thread::sim::TaskCancelled();
+  }
 }    // namespace mb::system::intf
@@ -0,0 +1,66 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_system.hpp
+ *
+ *  Description:
+ *    Simulator specific interface to the system driver
+ *
+ *  2025 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_SYSTEM_HPP
+#define MBEDUTILS_SIM_SYSTEM_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstdint>
+
+namespace mb::system::sim
+{
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Firmware boot function re-entered after an in-process warm reset
+   */
+  using EntryPoint = void ( * )();
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Registers the firmware entry point, enabling in-process warm resets.
+   *
+   * Without an entry point, warm_reset() re-executes the binary with its
+   * original command line. With one, warm_reset() instead cancels the calling
+   * node's tasks and timers, frees its idle mutexes and semaphores created
+   * since the last boot, resets its serial state, then calls the entry point
+   * again. GPIO, SPI and the heap are shared between nodes, so they are only
+   * reset while a single node exists. ZMQ pipes, attached SPI device models,
+   * the GPIO shared memory bridge and OSAL objects created before the first
+   * boot survive the reset, so the entry point should only do what the
+   * firmware does on boot, not the simulator setup.
+   *
+   * Called from a task, warm_reset() unwinds that task and the entry point runs
+   * on a fresh thread. Called from any other thread, it runs the reset and the
+   * entry point in place, then returns.
+   *
+   * @param entry       Function to boot the firmware, or nullptr to disable
+   * @param timeout_ms  How long tasks get to stop before falling back to exec
+   */
+  void setWarmResetEntry( EntryPoint entry, const uint32_t timeout_ms = 1000 );
+
+  /**
+   * @brief Gets the number of in-process warm resets performed so far
+   *
+   * @return uint64_t
+   */
+  uint64_t getWarmResetCount();
+
+}    // namespace mb::system::sim
+
+#endif /* !MBEDUTILS_SIM_SYSTEM_HPP */
@@ -8,17 +8,28 @@
  *  2024 | Brandon Braun | brandonbraun653@protonmail.com
  *****************************************************************************/
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstring>
 #include <mbedutils/drivers/threading/thread.hpp>
 #include <mbedutils/interfaces/util_intf.hpp>
+#include <mbedutils/logging.hpp>
 #include <mbedutils/threading.hpp>
 #include <memory>
 #include <mutex>
+#include <pthread.h>
+#include <signal.h>
 #include <stdexcept>
 #include <thread>
 #include <unordered_map>
+#include "sim_node.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_timer.hpp"
+#include "sim_trace.hpp"
 
 
 namespace mb::thread
@@ -27,29 +38,69 @@ namespace mb::thread
   Structures
   ---------------------------------------------------------------------------*/
 
+  struct NodeTasks;
+
   struct TaskData
   {
     std::unique_ptr<std::thread> thread;
     mb::thread::Task::Config     cfg;
     bool                         kill_request;
     bool                         start_request;
+    std::atomic<bool>            cancel_request{ false };
+    std::atomic<bool>            finished{ false };
+    NodeTasks                   *owner = nullptr;
   };
 
   using TaskMap = std::unordered_map<TaskId, std::shared_ptr<TaskData>>;
 
+  /**
+   * @brief Tasks of one simulated node. Task ids only need to be unique within
+   * a node, and idle detection only looks at the node's own tasks.
+   */
+  struct NodeTasks
+  {
+    std::mutex              lock;         /**< Guards the task table */
+    std::condition_variable created_cv;   /**< Signalled when a task enters the table */
+    TaskMap                 tasks;
+    std::atomic<int>        running{ 0 }; /**< Tasks executing their body */
+    std::atomic<int>        blocked{ 0 }; /**< Running tasks inside a blocking call */
+  };
+
   /*---------------------------------------------------------------------------
   Private Data
   ---------------------------------------------------------------------------*/
 
-  static std::condition_variable s_task_created_cv;
-  static std::mutex              s_module_mutex;
-  static TaskMap                 s_task_internal_map;
-  static size_t                  s_module_ready = ~DRIVER_INITIALIZED_KEY;
+  static size_t                 s_module_ready = ~DRIVER_INITIALIZED_KEY;
+  static std::atomic<bool>      s_rt_enabled{ false };
+  static std::atomic<int>       s_rt_policy{ SCHED_FIFO };
+  static std::atomic<bool>      s_rt_error_logged{ false };
+  static thread_local TaskData *tls_task = nullptr;
+
+  /*-------------------------------------------------------------------------
+  Interrupts blocking syscalls of tasks being cancelled. The handler does
+  nothing; it only exists so the syscall returns EINTR.
+  -------------------------------------------------------------------------*/
+  static const int CANCEL_SIGNAL = SIGRTMIN + 2;
 
   /*---------------------------------------------------------------------------
   Private Functions
   ---------------------------------------------------------------------------*/
 
+  /**
+   * @brief Gets the task state of the node the calling thread belongs to
+   */
+  static inline NodeTasks &node_tasks()
+  {
+    return mb::hw::sim::currentNode().state<NodeTasks>();
+  }
+
+
+  static inline TaskMap &task_map()
+  {
+    return node_tasks().tasks;
+  }
+
+
   /**
    * @brief Looks up a task in the internal map based on the id.
    *
@@ -58,7 +109,8 @@ namespace mb::thread
    */
   static TaskMap::iterator find_task( const TaskId id )
   {
-    for( auto it = s_task_internal_map.begin(); it != s_task_internal_map.end(); ++it )
+    auto &tasks = task_map();
+    for( auto it = tasks.begin(); it != tasks.end(); ++it )
     {
       if( it->second->cfg.id == id )
       {
@@ -66,7 +118,56 @@ namespace mb::thread
       }
     }
 
-    return s_task_internal_map.end();
+    return tasks.end();
+  }
+
+
+  /**
+   * @brief Moves the calling thread onto the real-time scheduler, if enabled.
+   *
+   * The task priority is mapped as an offset from the policy's minimum, so
+   * the relative ordering of tasks is preserved.
+   *
+   * @param cfg   Configuration of the task being started
+   */
+  static void apply_realtime_priority( const Task::Config &cfg )
+  {
+    if( !s_rt_enabled.load() )
+    {
+      return;
+    }
+
+    const int policy   = s_rt_policy.load();
+    const int prio_min = sched_get_priority_min( policy );
+    const int prio_max = sched_get_priority_max( policy );
+
+    sched_param param;
+    param.sched_priority = std::min<int>( prio_min + static_cast<int>( cfg.priority ), prio_max );
+
+    const int err = pthread_setschedparam( pthread_self(), policy, &param );
+    if( err && !s_rt_error_logged.exchange( true ) )
+    {
+      LOG_ERROR( "Unable to apply real-time priority to tasks: %s", strerror( err ) );
+    }
+  }
+
+
+  static void on_cancel_signal( int )
+  {
+  }
+
+
+  static void install_cancel_handler()
+  {
+    static std::once_flag s_installed;
+    std::call_once( s_installed, [] {
+      struct sigaction action;
+      memset( &action, 0, sizeof( action ) );
+      action.sa_handler = on_cancel_signal;
+      action.sa_flags   = 0; /* No SA_RESTART, blocking calls must return EINTR */
+      sigemptyset( &action.sa_mask );
+      sigaction( CANCEL_SIGNAL, &action, nullptr );
+    } );
   }
 
   /*---------------------------------------------------------------------------
@@ -106,10 +207,10 @@ namespace mb::thread
 
   void Task::start()
   {
-    std::lock_guard<std::mutex> lock( s_module_mutex );
+    std::lock_guard<std::mutex> lock( node_tasks().lock );
 
     auto task_iter = find_task( mHandle );
-    if( task_iter == s_task_internal_map.end() )
+    if( task_iter == task_map().end() )
     {
       throw std::runtime_error( "Task not found in map" );
     }
@@ -194,8 +295,8 @@ namespace mb::thread
     {
       auto id = std::this_thread::get_id();
 
-      std::lock_guard<std::mutex> lock( s_module_mutex );
-      for( auto &task : s_task_internal_map )
+      std::lock_guard<std::mutex> lock( node_tasks().lock );
+      for( auto &task : task_map() )
       {
         if( task.second->thread->get_id() == id )
         {
@@ -209,20 +310,22 @@ namespace mb::thread
 
     void sleep_for( const size_t timeout )
     {
-      std::this_thread::sleep_for( std::chrono::milliseconds( timeout ) );
+      mb::time::sim::sleepFor( static_cast<int64_t>( timeout ) * 1000000LL );
     }
 
 
     void sleep_until( const size_t wakeup )
     {
-      auto now = std::chrono::system_clock::now();
-      auto wakeup_time = now + std::chrono::milliseconds( wakeup );
-      std::this_thread::sleep_until( wakeup_time );
+      /*-----------------------------------------------------------------------
+      The wakeup time is absolute, on the same time base as mb::time::millis()
+      -----------------------------------------------------------------------*/
+      mb::time::sim::sleepUntil( static_cast<int64_t>( wakeup ) * 1000000LL );
     }
 
 
     void yield()
     {
+      mb::thread::sim::cancellationPoint();
       std::this_thread::yield();
     }
 
@@ -231,8 +334,8 @@ namespace mb::thread
     {
       auto id = std::this_thread::get_id();
 
-      std::lock_guard<std::mutex> lock( s_module_mutex );
-      for( auto &task : s_task_internal_map )
+      std::lock_guard<std::mutex> lock( node_tasks().lock );
+      for( auto &task : task_map() )
       {
         if( task.second->thread->get_id() == id )
         {
@@ -258,18 +361,23 @@ namespace mb::thread::intf
    * This allows us to mimic most RTOS behavior by having the task wait until
    * it is signaled to start.
    *
-   * @param id Which task to execute
+   * @param id   Which task to execute
+   * @param node Simulated node that created the task
    */
-  static void task_func( const mb::thread::TaskId id )
+  static void task_func( const mb::thread::TaskId id, mb::hw::sim::Node *node )
   {
+    mb::hw::sim::setCurrentNode( *node );
+    auto &state = node_tasks();
+    auto &tasks = state.tasks;
+
     /*-------------------------------------------------------------------------
     Wait until this particular task configuration has made it into the map.
     -------------------------------------------------------------------------*/
     {
-      std::unique_lock<std::mutex> lock( s_module_mutex );
-      while( s_task_internal_map.find( id ) == s_task_internal_map.end() )
+      std::unique_lock<std::mutex> lock( state.lock );
+      while( tasks.find( id ) == tasks.end() )
       {
-        s_task_created_cv.wait( lock );
+        state.created_cv.wait( lock );
       }
     }
 
@@ -277,15 +385,15 @@ namespace mb::thread::intf
     Wait for the signal to start. This should be coming from the Task::start()
     method.
     -------------------------------------------------------------------------*/
-    auto task_iter = s_task_internal_map.find( id );
-    if( task_iter == s_task_internal_map.end() )
+    auto task_iter = tasks.find( id );
+    if( task_iter == tasks.end() )
     {
       // We've broken an assumption with the STL map timing. This should never happen.
       throw std::runtime_error( "Task not found in map" );
     }
 
-    auto &task_data = s_task_internal_map[ id ];
-    while( !task_data->start_request )
+    auto task_data = tasks[ id ];
+    while( !task_data->start_request && !task_data->cancel_request.load() )
     {
       std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
     }
@@ -293,7 +401,49 @@ namespace mb::thread::intf
     /*-------------------------------------------------------------------------
     Execute the user task, then terminate
     -------------------------------------------------------------------------*/
-    task_data->cfg.func( task_data->cfg.user_data );
+    if( !task_data->cancel_request.load() )
+    {
+      struct RunningScope
+      {
+        RunningScope( TaskData *task )
+        {
+          tls_task = task;
+          tls_task->owner->running.fetch_add( 1 );
+        }
+
+        ~RunningScope()
+        {
+          tls_task->owner->running.fetch_sub( 1 );
+          tls_task = nullptr;
+        }
+      } running( task_data.get() );
+
+      namespace trace = mb::hw::sim::trace;
+      trace::setThreadName( std::string( task_data->cfg.name.c_str() ) );
+
+      const bool traced = trace::enabled();
+      if( traced )
+      {
+        trace::begin( trace::Category::TASK, "run" );
+      }
+
+      try
+      {
+        apply_realtime_priority( task_data->cfg );
+        task_data->cfg.func( task_data->cfg.user_data );
+      }
+      catch( const mb::thread::sim::TaskCancelled & )
+      {
+        // Unwound by cancelAllTasks(), nothing left to do
+      }
+
+      if( traced )
+      {
+        trace::end( trace::Category::TASK, "run" );
+      }
+    }
+
+    task_data->finished.store( true );
   }
 
   /*---------------------------------------------------------------------------
@@ -308,7 +458,7 @@ namespace mb::thread::intf
     }
 
     s_module_ready = DRIVER_INITIALIZED_KEY;
-    s_task_internal_map.clear();
+    task_map().clear();
   }
 
 
@@ -319,10 +469,12 @@ namespace mb::thread::intf
       return;
     }
 
+    mb::time::sim::stopTimerService();
+
     /*-------------------------------------------------------------------------
     Destroy all tasks
     -------------------------------------------------------------------------*/
-    for( auto &task : s_task_internal_map )
+    for( auto &task : task_map() )
     {
       if( task.second->thread->joinable() )
       {
@@ -330,38 +482,45 @@ namespace mb::thread::intf
       }
     }
 
-    s_task_internal_map.clear();
+    task_map().clear();
     s_module_ready = ~DRIVER_INITIALIZED_KEY;
   }
 
 
   mb::thread::TaskId create_task( mb::thread::Task::Config &cfg )
   {
-    std::lock_guard<std::mutex> lock( s_module_mutex );
+    auto &state = node_tasks();
 
-    /*-------------------------------------------------------------------------
-    Ensure the task ID is unique
-    -------------------------------------------------------------------------*/
-    if( s_task_internal_map.find( cfg.id ) != s_task_internal_map.end() )
     {
-      return -1;
-    }
+      std::lock_guard<std::mutex> lock( state.lock );
+      auto                       &tasks = state.tasks;
 
-    /*-------------------------------------------------------------------------
-    Construct the task and wait for it to be ready.
-    -------------------------------------------------------------------------*/
-    s_task_internal_map[ cfg.id ] =
-        std::make_shared<TaskData>( std::make_unique<std::thread>( task_func, cfg.id ), cfg, false, false );
+      /*-----------------------------------------------------------------------
+      Ensure the task ID is unique
+      -----------------------------------------------------------------------*/
+      if( tasks.find( cfg.id ) != tasks.end() )
+      {
+        return -1;
+      }
 
-    do
-    {
-      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-    } while( s_task_internal_map[ cfg.id ]->thread->get_id() == std::thread::id() );
+      /*-----------------------------------------------------------------------
+      Construct the task and wait for it to be ready.
+      -----------------------------------------------------------------------*/
+      tasks[ cfg.id ] = std::make_shared<TaskData>(
+          std::make_unique<std::thread>( task_func, cfg.id, &mb::hw::sim::currentNode() ), cfg, false, false );
+      tasks[ cfg.id ]->owner = &state;
+
+      do
+      {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+      } while( tasks[ cfg.id ]->thread->get_id() == std::thread::id() );
+    }
 
     /*-------------------------------------------------------------------------
-    Notify the task that we've injected its configuration into the map.
+    Notify the task that we've injected its configuration into the map. The
+    settling delay runs unlocked so the task can actually pick it up.
     -------------------------------------------------------------------------*/
-    s_task_created_cv.notify_all();
+    state.created_cv.notify_all();
     std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
 
     return cfg.id;
@@ -370,10 +529,10 @@ namespace mb::thread::intf
 
   void destroy_task( mb::thread::TaskId task )
   {
-    std::lock_guard<std::mutex> lock( s_module_mutex );
+    std::lock_guard<std::mutex> lock( node_tasks().lock );
 
     auto iter = find_task( task );
-    if( iter != s_task_internal_map.end() )
+    if( iter != task_map().end() )
     {
       iter->second->kill_request = true;
 
@@ -382,7 +541,7 @@ namespace mb::thread::intf
         iter->second->thread->join();
       }
 
-      s_task_internal_map.erase( iter );
+      task_map().erase( iter );
     }
   }
 
@@ -395,11 +554,18 @@ namespace mb::thread::intf
 
   void start_scheduler()
   {
-    std::lock_guard<std::mutex> lock( s_module_mutex );
-    for( auto &task : s_task_internal_map )
     {
-      task.second->start_request = true;
+      std::lock_guard<std::mutex> lock( node_tasks().lock );
+      for( auto &task : task_map() )
+      {
+        task.second->start_request = true;
+      }
     }
+
+    /*-------------------------------------------------------------------------
+    Bring up the simulated RTOS tick alongside the scheduler
+    -------------------------------------------------------------------------*/
+    mb::time::sim::startTimerService();
   }
 
 
@@ -427,3 +593,129 @@ namespace mb::thread::intf
   }
 
 }    // namespace mb::thread::intf
+
+
+namespace mb::thread::sim
+{
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  void enableRealtimePriorities( const bool enable, const int policy )
+  {
+    s_rt_policy.store( policy );
+    s_rt_enabled.store( enable );
+  }
+
+
+  bool realtimePrioritiesEnabled()
+  {
+    return s_rt_enabled.load();
+  }
+
+
+  bool allTasksBlocked()
+  {
+    auto &state = node_tasks();
+    return state.running.load() <= state.blocked.load();
+  }
+
+
+  bool isTaskThread()
+  {
+    return tls_task != nullptr;
+  }
+
+
+  mb::thread::TaskId currentTaskId()
+  {
+    return tls_task ? tls_task->cfg.id : TASK_ID_INVALID;
+  }
+
+
+  void cancellationPoint()
+  {
+    if( tls_task && tls_task->cancel_request.load( std::memory_order_relaxed ) )
+    {
+      throw TaskCancelled();
+    }
+  }
+
+
+  bool cancelAllTasks( const int64_t timeout_ns )
+  {
+    install_cancel_handler();
+
+    std::vector<std::shared_ptr<TaskData>> tasks;
+    {
+      std::lock_guard<std::mutex> lock( node_tasks().lock );
+      for( auto &task : task_map() )
+      {
+        task.second->kill_request = true;
+        task.second->cancel_request.store( true );
+        tasks.push_back( task.second );
+      }
+    }
+
+    /*-------------------------------------------------------------------------
+    Keep poking the stragglers. A task can be between its cancellation check
+    and the blocking call when a signal lands, so a single one isn't enough.
+    -------------------------------------------------------------------------*/
+    const int64_t deadline = mb::time::sim::monotonic_ns() + timeout_ns;
+    while( true )
+    {
+      size_t remaining = 0;
+      for( auto &task : tasks )
+      {
+        if( !task->finished.load() )
+        {
+          remaining++;
+          pthread_kill( task->thread->native_handle(), CANCEL_SIGNAL );
+        }
+      }
+
+      if( !remaining )
+      {
+        break;
+      }
+
+      if( mb::time::sim::monotonic_ns() >= deadline )
+      {
+        LOG_ERROR( "%d simulated tasks did not stop when cancelled", static_cast<int>( remaining ) );
+        return false;
+      }
+
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    std::lock_guard<std::mutex> lock( node_tasks().lock );
+    for( auto &task : tasks )
+    {
+      if( task->thread->joinable() )
+      {
+        task->thread->join();
+      }
+    }
+
+    task_map().clear();
+    return true;
+  }
+
+
+  BlockedScope::BlockedScope() : mCounted( tls_task != nullptr )
+  {
+    if( mCounted )
+    {
+      tls_task->owner->blocked.fetch_add( 1 );
+    }
+  }
+
+
+  BlockedScope::~BlockedScope()
+  {
+    if( mCounted )
+    {
+      tls_task->owner->blocked.fetch_sub( 1 );
+    }
+  }
+}    // namespace mb::thread::sim
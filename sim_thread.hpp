@@ -0,0 +1,130 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_thread.hpp
+ *
+ *  Description:
+ *    Simulator specific configuration of the threading driver
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_THREAD_HPP
+#define MBEDUTILS_SIM_THREAD_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstdint>
+#include <mbedutils/drivers/threading/thread.hpp>
+#include <sched.h>
+
+namespace mb::thread::sim
+{
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Thrown from a cancellation point to unwind a task being torn down.
+   *
+   * Deliberately not a std::exception, so firmware handlers don't swallow it.
+   * The task wrapper catches it and lets the thread exit.
+   */
+  struct TaskCancelled
+  {
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Runs simulated tasks under a real-time scheduling policy.
+   *
+   * Each task created afterwards maps its configured priority onto the host
+   * real-time priority range, so higher priority tasks preempt lower ones just
+   * like on target. Pair with mb::osal::sim::enablePriorityInheritance() to
+   * get RTOS-like priority inversion bounds. Requires CAP_SYS_NICE, or a
+   * suitable RLIMIT_RTPRIO; if the host refuses, tasks run at normal priority
+   * and an error is logged once.
+   *
+   * @param enable  True to apply real-time priorities to new tasks
+   * @param policy  SCHED_FIFO or SCHED_RR
+   */
+  void enableRealtimePriorities( const bool enable, const int policy = SCHED_FIFO );
+
+  /**
+   * @brief Checks if new tasks will be given real-time priorities
+   */
+  bool realtimePrioritiesEnabled();
+
+  /**
+   * @brief Checks if every running task of the current node is blocked.
+   *
+   * Used by the timer service to decide when the simulated RTOS is idle.
+   * Tasks of other nodes don't count.
+   *
+   * @return true   No simulated task is runnable
+   */
+  bool allTasksBlocked();
+
+  /**
+   * @brief Checks if the calling thread is a simulated task
+   */
+  bool isTaskThread();
+
+  /**
+   * @brief Gets the id of the calling task without searching the task table
+   *
+   * @return TaskId   TASK_ID_INVALID on non-task threads
+   */
+  mb::thread::TaskId currentTaskId();
+
+  /**
+   * @brief Unwinds the calling task if cancelAllTasks() has asked it to stop.
+   *
+   * Simulated sleeps, yields and semaphore waits call this, so a task being
+   * cancelled stops at its next blocking call. No effect on non-task threads.
+   */
+  void cancellationPoint();
+
+  /**
+   * @brief Stops every simulated task of the current node and forgets about it.
+   *
+   * Each task is flagged for cancellation and its thread is signalled so a
+   * blocking sleep or semaphore wait returns early and hits a cancellation
+   * point. Tasks that never reach one, e.g. stuck on a mutex held by a dead
+   * task, make this fail. Must not be called from a task.
+   *
+   * @param timeout_ns  Host nanoseconds to wait for the tasks to exit
+   * @return true       Every task exited and was joined
+   */
+  bool cancelAllTasks( const int64_t timeout_ns );
+
+  /*---------------------------------------------------------------------------
+  Classes
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Marks the calling simulated task as blocked while in scope.
+   *
+   * Simulator primitives wrap their blocking waits with this so the idle state
+   * of the system can be tracked. Has no effect on non-task threads.
+   */
+  class BlockedScope
+  {
+  public:
+    BlockedScope();
+    ~BlockedScope();
+
+    BlockedScope( const BlockedScope & )            = delete;
+    BlockedScope &operator=( const BlockedScope & ) = delete;
+
+  private:
+    bool mCounted;
+  };
+
+}    // namespace mb::thread::sim
+
+#endif /* !MBEDUTILS_SIM_THREAD_HPP */
@@ -12,25 +12,285 @@
 Includes
 -----------------------------------------------------------------------------*/
 #include <mbedutils/interfaces/time_intf.hpp>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <ctime>
+#include <cerrno>
+#include <mutex>
+#include <sys/prctl.h>
 #include <thread>
+#include "sim_futex.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <cpuid.h>
+#include <x86intrin.h>
+#define SIM_TIME_HAS_TSC 1
+#else
+#define SIM_TIME_HAS_TSC 0
+#endif
 
 namespace mb::time
 {
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr int64_t PARKED_POLL_NS = 100000; /**< Host wait step of a timed wait while time is parked */
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Conversion from TSC ticks to nanoseconds since the epoch.
+   *
+   * ns = base_ns + ( ( tsc - base_tsc ) * mult ) >> 32
+   */
+  struct TscParams
+  {
+    uint64_t base_tsc;
+    int64_t  base_ns;
+    uint64_t mult;
+  };
+
+  /**
+   * @brief Mapping from host time to simulated time, guarded by a seqlock.
+   *
+   * sim_ns = min( sim_anchor + ( host_ns - host_anchor ) * scale, horizon )
+   *
+   * Readers never block; the rare writer bumps the sequence to odd while it
+   * updates the fields and readers retry if they overlap with it.
+   */
+  struct TimeScale
+  {
+    std::atomic<uint32_t> seq{ 0 };
+    std::atomic<int64_t>  host_anchor{ 0 };
+    std::atomic<int64_t>  sim_anchor{ 0 };
+    std::atomic<double>   scale{ 1.0 };
+    std::atomic<int64_t>  horizon{ mb::time::sim::NO_TIME_HORIZON };
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static int64_t                  s_epoch_ns;
+  static std::atomic<TscParams *> s_tsc{ nullptr };
+  static std::mutex               s_tsc_lock;
+  static uint64_t                 s_tsc_mult;
+  static TimeScale                s_scale;
+  static std::mutex               s_scale_lock;
+  static std::atomic<uint32_t>    s_horizon_epoch{ 0 };
+
+  static std::atomic<bool>                              s_precise_delay{ false };
+  static std::atomic<int64_t>                           s_spin_threshold_ns{ 100000 };
+  static std::atomic<uint64_t>                          s_delay_count{ 0 };
+  static std::atomic<int64_t>                           s_delay_error_sum{ 0 };
+  static std::atomic<int64_t>                           s_delay_error_max{ 0 };
+  static std::atomic<mb::time::sim::DelayStatsCallback> s_delay_callback{ nullptr };
+
   /*---------------------------------------------------------------------------
   Private Functions
   ---------------------------------------------------------------------------*/
 
-  static inline int64_t absolute_system_time_ms()
+  static inline int64_t host_monotonic_ns()
+  {
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<int64_t>( ts.tv_sec ) * 1000000000LL + ts.tv_nsec;
+  }
+
+  /**
+   * @brief Captures the shared epoch before any other static initializers run.
+   *
+   * Doing this once up front keeps a lazily initialized static (and its guard
+   * check) off the millis()/micros() hot path.
+   */
+  __attribute__( ( constructor( 101 ) ) ) static void capture_epoch()
+  {
+    s_epoch_ns = host_monotonic_ns();
+  }
+
+#if SIM_TIME_HAS_TSC
+  static bool tsc_is_invariant()
+  {
+    unsigned int eax, ebx, ecx, edx;
+    if( !__get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) )
+    {
+      return false;
+    }
+
+    return ( edx & ( 1u << 8 ) ) != 0;
+  }
+
+  /**
+   * @brief Measures the TSC rate against CLOCK_MONOTONIC
+   *
+   * @return uint64_t Nanoseconds per tick as a 32.32 fixed point value
+   */
+  static uint64_t calibrate_tsc()
+  {
+    const int64_t  t0 = host_monotonic_ns();
+    const uint64_t c0 = __rdtsc();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    const int64_t  t1 = host_monotonic_ns();
+    const uint64_t c1 = __rdtsc();
+
+    if( c1 <= c0 )
+    {
+      return 0;
+    }
+
+    return static_cast<uint64_t>( ( static_cast<unsigned __int128>( t1 - t0 ) << 32 ) / ( c1 - c0 ) );
+  }
+#endif /* SIM_TIME_HAS_TSC */
+
+  /**
+   * @brief Host nanoseconds since the epoch, using the fastest enabled source
+   */
+  static inline int64_t host_elapsed_ns()
+  {
+#if SIM_TIME_HAS_TSC
+    const TscParams *tsc = s_tsc.load( std::memory_order_acquire );
+    if( tsc )
+    {
+      const uint64_t delta = __rdtsc() - tsc->base_tsc;
+      return tsc->base_ns + static_cast<int64_t>( ( static_cast<unsigned __int128>( delta ) * tsc->mult ) >> 32 );
+    }
+#endif
+
+    return host_monotonic_ns() - s_epoch_ns;
+  }
+
+  /**
+   * @brief Simulated nanoseconds since the epoch, after applying the time scale and horizon
+   */
+  static inline int64_t elapsed_ns()
+  {
+    uint32_t seq;
+    int64_t  host_now;
+    int64_t  host_anchor;
+    int64_t  sim_anchor;
+    double   scale;
+    int64_t  horizon;
+
+    /*-------------------------------------------------------------------------
+    The host clock is read inside the seqlock so a switch of clock source,
+    which re-anchors, can never pair one source with the other's anchor.
+    -------------------------------------------------------------------------*/
+    do
+    {
+      seq         = s_scale.seq.load( std::memory_order_acquire );
+      host_anchor = s_scale.host_anchor.load( std::memory_order_relaxed );
+      sim_anchor  = s_scale.sim_anchor.load( std::memory_order_relaxed );
+      scale       = s_scale.scale.load( std::memory_order_relaxed );
+      horizon     = s_scale.horizon.load( std::memory_order_relaxed );
+      host_now    = host_elapsed_ns();
+      std::atomic_thread_fence( std::memory_order_acquire );
+    } while( ( seq & 1u ) || ( seq != s_scale.seq.load( std::memory_order_relaxed ) ) );
+
+    const int64_t host_delta = host_now - host_anchor;
+
+    int64_t sim_ns;
+    if( scale == 1.0 )
+    {
+      sim_ns = sim_anchor + host_delta;
+    }
+    else
+    {
+      sim_ns = sim_anchor + static_cast<int64_t>( static_cast<double>( host_delta ) * scale );
+    }
+
+    return ( sim_ns < horizon ) ? sim_ns : horizon;
+  }
+
+  static inline void cpu_relax()
+  {
+#if SIM_TIME_HAS_TSC
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+
+  static void record_delay( const int64_t requested_ns, const int64_t error_ns )
   {
-    return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::high_resolution_clock::now().time_since_epoch() )
-        .count();
+    s_delay_count.fetch_add( 1, std::memory_order_relaxed );
+    s_delay_error_sum.fetch_add( error_ns, std::memory_order_relaxed );
+
+    int64_t prev_max = s_delay_error_max.load( std::memory_order_relaxed );
+    while( ( error_ns > prev_max ) && !s_delay_error_max.compare_exchange_weak( prev_max, error_ns ) )
+    {
+    }
+
+    auto callback = s_delay_callback.load( std::memory_order_acquire );
+    if( callback )
+    {
+      callback( requested_ns, error_ns );
+    }
   }
 
-  static inline int64_t absolute_system_time_us()
+  /**
+   * @brief Sleeps the host thread until an absolute CLOCK_MONOTONIC deadline.
+   *
+   * In precise mode the thread's timer slack is dropped to 1ns and the kernel
+   * sleep stops short of the deadline by the spin threshold; the remainder is
+   * spent spinning on the clock. This trades some CPU for accuracy in the tens
+   * of microseconds range, where a plain sleep routinely overshoots.
+   *
+   * @param deadline_ns   Absolute host monotonic time to wake at
+   * @param requested_ns  Host duration the caller asked for, used for stats
+   */
+  static void host_sleep_until( const int64_t deadline_ns, const int64_t requested_ns )
   {
-    return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::high_resolution_clock::now().time_since_epoch() )
-        .count();
+    thread_local bool tls_slack_reduced = false;
+
+    const bool    precise = s_precise_delay.load( std::memory_order_relaxed );
+    const int64_t wake_at = precise ? ( deadline_ns - s_spin_threshold_ns.load( std::memory_order_relaxed ) ) : deadline_ns;
+
+    if( precise && !tls_slack_reduced )
+    {
+      prctl( PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL );
+      tls_slack_reduced = true;
+    }
+
+    mb::thread::sim::cancellationPoint();
+    mb::thread::sim::BlockedScope blocked;
+
+    if( wake_at > host_monotonic_ns() )
+    {
+      timespec ts;
+      ts.tv_sec  = static_cast<time_t>( wake_at / 1000000000LL );
+      ts.tv_nsec = static_cast<long>( wake_at % 1000000000LL );
+      while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) == EINTR )
+      {
+        mb::thread::sim::cancellationPoint();
+      }
+    }
+
+    int64_t now = host_monotonic_ns();
+    if( precise )
+    {
+      while( now < deadline_ns )
+      {
+        cpu_relax();
+        now = host_monotonic_ns();
+      }
+    }
+
+    record_delay( requested_ns, now - deadline_ns );
+
+    if( mb::hw::sim::trace::enabled() )
+    {
+      mb::hw::sim::trace::complete( mb::hw::sim::trace::Category::SLEEP, "sleep", deadline_ns - requested_ns,
+                                    static_cast<uint64_t>( requested_ns ) );
+    }
   }
 
   /*---------------------------------------------------------------------------
@@ -39,27 +299,315 @@ namespace mb::time
 
   int64_t millis()
   {
-    static int64_t start_time = absolute_system_time_ms();
-    return absolute_system_time_ms() - start_time;
+    return elapsed_ns() / 1000000LL;
   }
 
 
   int64_t micros()
   {
-    static int64_t start_time = absolute_system_time_us();
-    return absolute_system_time_us() - start_time;
+    return elapsed_ns() / 1000LL;
   }
 
 
   void delayMilliseconds( const size_t val )
   {
-    std::this_thread::sleep_for( std::chrono::milliseconds( val ) );
+    mb::time::sim::sleepFor( static_cast<int64_t>( val ) * 1000000LL );
   }
 
 
   void delayMicroseconds( const size_t val )
   {
-    std::this_thread::sleep_for( std::chrono::microseconds( val ) );
+    mb::time::sim::sleepFor( static_cast<int64_t>( val ) * 1000LL );
   }
 
 }    // namespace mb::time
+
+
+namespace mb::time::sim
+{
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  int64_t nanos()
+  {
+    return elapsed_ns();
+  }
+
+
+  int64_t monotonic_ns()
+  {
+    return host_monotonic_ns();
+  }
+
+
+  bool useTscClock( const bool enable )
+  {
+    std::lock_guard<std::mutex> lock( s_tsc_lock );
+
+    if( !enable )
+    {
+      if( !s_tsc.load() )
+      {
+        return true;
+      }
+
+      /*-----------------------------------------------------------------------
+      The TSC drifts a little from CLOCK_MONOTONIC after calibration, so
+      re-anchor on the way out to keep simulated time continuous. Parameter
+      blocks are leaked on purpose: a reader may still hold one, and switching
+      sources is rare enough that it doesn't matter.
+      -----------------------------------------------------------------------*/
+      std::lock_guard<std::mutex> scale_lock( s_scale_lock );
+
+      const int64_t sim_now = elapsed_ns();
+      const auto    seq     = s_scale.seq.load( std::memory_order_relaxed );
+
+      s_scale.seq.store( seq + 1, std::memory_order_relaxed );
+      std::atomic_thread_fence( std::memory_order_release );
+
+      s_tsc.store( nullptr, std::memory_order_release );
+      s_scale.host_anchor.store( host_elapsed_ns(), std::memory_order_relaxed );
+      s_scale.sim_anchor.store( sim_now, std::memory_order_relaxed );
+
+      s_scale.seq.store( seq + 2, std::memory_order_release );
+      return true;
+    }
+
+#if SIM_TIME_HAS_TSC
+    if( s_tsc.load() )
+    {
+      return true;
+    }
+
+    if( !tsc_is_invariant() )
+    {
+      return false;
+    }
+
+    if( !s_tsc_mult )
+    {
+      s_tsc_mult = calibrate_tsc();
+      if( !s_tsc_mult )
+      {
+        return false;
+      }
+    }
+
+    auto params      = new TscParams();
+    params->mult     = s_tsc_mult;
+    params->base_ns  = host_elapsed_ns();
+    params->base_tsc = __rdtsc();
+    s_tsc.store( params, std::memory_order_release );
+    return true;
+#else
+    return false;
+#endif
+  }
+
+
+  bool setTimeScale( const double scale )
+  {
+    if( !( scale > 0.0 ) )
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock( s_scale_lock );
+
+    /*-------------------------------------------------------------------------
+    Re-anchor at the current instant so simulated time doesn't jump
+    -------------------------------------------------------------------------*/
+    const int64_t sim_now  = elapsed_ns();
+    const int64_t host_now = host_elapsed_ns();
+    const auto    seq      = s_scale.seq.load( std::memory_order_relaxed );
+
+    s_scale.seq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    s_scale.host_anchor.store( host_now, std::memory_order_relaxed );
+    s_scale.sim_anchor.store( sim_now, std::memory_order_relaxed );
+    s_scale.scale.store( scale, std::memory_order_relaxed );
+
+    s_scale.seq.store( seq + 2, std::memory_order_release );
+    return true;
+  }
+
+
+  double getTimeScale()
+  {
+    return s_scale.scale.load( std::memory_order_relaxed );
+  }
+
+
+  int64_t toHostNanos( const int64_t sim_ns )
+  {
+    const double scale = s_scale.scale.load( std::memory_order_relaxed );
+    if( scale == 1.0 || sim_ns <= 0 )
+    {
+      return sim_ns;
+    }
+
+    return static_cast<int64_t>( std::ceil( static_cast<double>( sim_ns ) / scale ) );
+  }
+
+
+  void sleepFor( const int64_t sim_ns )
+  {
+    if( s_scale.horizon.load( std::memory_order_relaxed ) != NO_TIME_HORIZON )
+    {
+      sleepUntil( elapsed_ns() + sim_ns );
+      return;
+    }
+
+    const int64_t host_ns = toHostNanos( sim_ns );
+    host_sleep_until( host_monotonic_ns() + host_ns, host_ns );
+  }
+
+
+  void sleepUntil( const int64_t sim_deadline_ns )
+  {
+    if( s_scale.horizon.load( std::memory_order_relaxed ) != NO_TIME_HORIZON )
+    {
+      /*-----------------------------------------------------------------------
+      Sleep in steps that never cross the horizon. When time is parked on it,
+      wait for the next raise instead. The epoch is read before the clock so a
+      raise in between makes the futex wait return straight away.
+      -----------------------------------------------------------------------*/
+      while( true )
+      {
+        const uint32_t epoch   = s_horizon_epoch.load( std::memory_order_acquire );
+        const int64_t  now     = elapsed_ns();
+        const int64_t  horizon = s_scale.horizon.load( std::memory_order_relaxed );
+
+        if( now >= sim_deadline_ns )
+        {
+          return;
+        }
+
+        if( now >= horizon )
+        {
+          mb::thread::sim::cancellationPoint();
+          mb::thread::sim::BlockedScope blocked;
+          mb::hw::sim::futex::wait( &s_horizon_epoch, epoch );
+          continue;
+        }
+
+        const int64_t host_ns = toHostNanos( std::min( sim_deadline_ns, horizon ) - now );
+        host_sleep_until( host_monotonic_ns() + host_ns, host_ns );
+      }
+    }
+
+    /*-------------------------------------------------------------------------
+    Translate the simulated deadline onto the host clock once, then sleep
+    against that absolute point so call overhead doesn't accumulate.
+    -------------------------------------------------------------------------*/
+    const int64_t host_ns = toHostNanos( sim_deadline_ns - elapsed_ns() );
+    host_sleep_until( host_monotonic_ns() + host_ns, host_ns );
+  }
+
+
+  int64_t hostWaitStep( const int64_t sim_deadline_ns )
+  {
+    /*-------------------------------------------------------------------------
+    Same plan as sleepUntil(), but the caller waits on its own primitive and
+    can't also wait on the horizon epoch, so a parked wait polls instead. The
+    epoch brackets the reads so a raise in between is never half seen.
+    -------------------------------------------------------------------------*/
+    while( true )
+    {
+      const uint32_t epoch   = s_horizon_epoch.load( std::memory_order_acquire );
+      const int64_t  now     = elapsed_ns();
+      const int64_t  horizon = s_scale.horizon.load( std::memory_order_relaxed );
+
+      if( epoch != s_horizon_epoch.load( std::memory_order_acquire ) )
+      {
+        continue;
+      }
+
+      if( now >= sim_deadline_ns )
+      {
+        return 0;
+      }
+
+      if( now >= horizon )
+      {
+        return PARKED_POLL_NS;
+      }
+
+      return toHostNanos( std::min( sim_deadline_ns, horizon ) - now );
+    }
+  }
+
+
+  int64_t setTimeHorizon( const int64_t sim_ns )
+  {
+    std::lock_guard<std::mutex> lock( s_scale_lock );
+
+    /*-------------------------------------------------------------------------
+    Re-anchor first. If time is parked on the old horizon this drops the host
+    time spent waiting, so time resumes from the horizon rather than jumping.
+    Time may have moved on since the caller picked sim_ns, so never set the
+    horizon below what nanos() already returned.
+    -------------------------------------------------------------------------*/
+    const int64_t sim_now  = elapsed_ns();
+    const int64_t host_now = host_elapsed_ns();
+    const int64_t horizon  = std::max( sim_ns, sim_now );
+    const auto    seq      = s_scale.seq.load( std::memory_order_relaxed );
+
+    s_scale.seq.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    s_scale.host_anchor.store( host_now, std::memory_order_relaxed );
+    s_scale.sim_anchor.store( sim_now, std::memory_order_relaxed );
+    s_scale.horizon.store( horizon, std::memory_order_relaxed );
+
+    s_scale.seq.store( seq + 2, std::memory_order_release );
+
+    s_horizon_epoch.fetch_add( 1, std::memory_order_release );
+    mb::hw::sim::futex::wake_all( &s_horizon_epoch );
+    return horizon;
+  }
+
+
+  int64_t getTimeHorizon()
+  {
+    return s_scale.horizon.load( std::memory_order_acquire );
+  }
+
+
+  void enablePreciseDelay( const bool enable )
+  {
+    s_precise_delay.store( enable );
+  }
+
+
+  void setSpinThreshold( const int64_t host_ns )
+  {
+    s_spin_threshold_ns.store( host_ns > 0 ? host_ns : 0 );
+  }
+
+
+  void setDelayStatsCallback( DelayStatsCallback callback )
+  {
+    s_delay_callback.store( callback, std::memory_order_release );
+  }
+
+
+  DelayStats getDelayStats()
+  {
+    DelayStats stats;
+    stats.count        = s_delay_count.load();
+    stats.max_error_ns = s_delay_error_max.load();
+    stats.avg_error_ns = stats.count ? ( s_delay_error_sum.load() / static_cast<int64_t>( stats.count ) ) : 0;
+    return stats;
+  }
+
+
+  void resetDelayStats()
+  {
+    s_delay_count.store( 0 );
+    s_delay_error_sum.store( 0 );
+    s_delay_error_max.store( 0 );
+  }
+}    // namespace mb::time::sim
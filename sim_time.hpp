@@ -0,0 +1,207 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_time.hpp
+ *
+ *  Description:
+ *    Simulator specific extensions to the time interface
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_TIME_HPP
+#define MBEDUTILS_SIM_TIME_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstdint>
+
+namespace mb::time::sim
+{
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Observer invoked after every simulated delay completes
+   *
+   * @param requested_ns  Host duration the delay asked for
+   * @param error_ns      How late the delay finished (negative if early)
+   */
+  using DelayStatsCallback = void ( * )( const int64_t requested_ns, const int64_t error_ns );
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr int64_t NO_TIME_HORIZON = INT64_MAX; /**< Simulated time runs freely */
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  struct DelayStats
+  {
+    uint64_t count;        /**< Number of delays measured */
+    int64_t  avg_error_ns; /**< Mean lateness of a delay */
+    int64_t  max_error_ns; /**< Worst lateness seen */
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Nanoseconds elapsed since the simulator started.
+   *
+   * This shares one monotonic epoch, captured at process start, with millis()
+   * and micros(), so all three always agree with each other.
+   *
+   * @return int64_t
+   */
+  int64_t nanos();
+
+  /**
+   * @brief Reads the host monotonic clock in nanoseconds, without any epoch
+   *
+   * @return int64_t
+   */
+  int64_t monotonic_ns();
+
+  /**
+   * @brief Switches the time base to read the CPU timestamp counter directly.
+   *
+   * On x86 hosts with an invariant TSC this skips the clock_gettime() call
+   * entirely. The TSC is calibrated against CLOCK_MONOTONIC the first time it
+   * is enabled, and the switch keeps time continuous. Hosts without a usable
+   * TSC stay on the vDSO CLOCK_MONOTONIC path.
+   *
+   * @param enable  True to read the TSC, false for CLOCK_MONOTONIC
+   * @return true   The requested source is now active
+   */
+  bool useTscClock( const bool enable );
+
+  /**
+   * @brief Runs simulated time faster or slower than the host clock.
+   *
+   * A scale of 10.0 makes millis()/micros() advance ten times faster than
+   * real time, while delays, task sleeps and OSAL timed waits shrink to a
+   * tenth of their host duration. The change takes effect immediately and
+   * simulated time stays continuous across it. Sleeps already in progress
+   * finish on the scale they started with.
+   *
+   * @param scale   Simulated seconds per host second. Must be positive.
+   * @return true   The scale was accepted
+   */
+  bool setTimeScale( const double scale );
+
+  /**
+   * @brief Gets the current simulated-to-host time ratio
+   *
+   * @return double
+   */
+  double getTimeScale();
+
+  /**
+   * @brief Converts a simulated duration into the host duration to wait for
+   *
+   * @param sim_ns  Duration in simulated nanoseconds
+   * @return int64_t Duration in host nanoseconds, rounded up
+   */
+  int64_t toHostNanos( const int64_t sim_ns );
+
+  /**
+   * @brief Gets how long the next host wait of a timed wait may last.
+   *
+   * For OSAL primitives that block on their own futex or mutex. Call it in a
+   * loop around a host wait until it returns zero. Each step ends at the
+   * simulated deadline or the time horizon, whichever is first. While time is
+   * parked on the horizon the step is a short poll, so the wait picks up a
+   * raise of the horizon.
+   *
+   * @param sim_deadline_ns   Simulated time the wait gives up at, as reported by nanos()
+   * @return int64_t  Host nanoseconds to wait for, zero once the deadline has passed
+   */
+  int64_t hostWaitStep( const int64_t sim_deadline_ns );
+
+  /**
+   * @brief Sleeps for a simulated duration
+   *
+   * @param sim_ns  Simulated nanoseconds to sleep
+   */
+  void sleepFor( const int64_t sim_ns );
+
+  /**
+   * @brief Sleeps until an absolute simulated time, as reported by nanos()
+   *
+   * @param sim_deadline_ns   Simulated time to wake at
+   */
+  void sleepUntil( const int64_t sim_deadline_ns );
+
+  /**
+   * @brief Caps how far simulated time may advance.
+   *
+   * Once nanos() reaches the horizon it stops there, and sleeps that would end
+   * past it block until the horizon is raised. Raising it resumes time from
+   * where it stopped, so the host time spent waiting never appears as
+   * simulated time. This is what lets separate simulator processes advance in
+   * lockstep quanta.
+   *
+   * A horizon below the current simulated time is raised to it, so time never
+   * steps backwards. Use the return value to learn where time was parked.
+   *
+   * @param sim_ns  Simulated time to stop at, or NO_TIME_HORIZON to run freely
+   * @return int64_t  The horizon that was applied
+   */
+  int64_t setTimeHorizon( const int64_t sim_ns );
+
+  /**
+   * @brief Gets the simulated time that time is currently allowed to reach
+   *
+   * @return int64_t  NO_TIME_HORIZON if unbounded
+   */
+  int64_t getTimeHorizon();
+
+  /**
+   * @brief Enables the hybrid sleep-then-spin delay strategy.
+   *
+   * Plain sleeps on Linux tend to overshoot by 50-100us due to timer slack and
+   * scheduling latency, which makes bit-banged protocols and tight timing loops
+   * much slower than on target. Precise mode lowers the thread's timer slack,
+   * sleeps with an absolute clock_nanosleep() until the spin threshold before
+   * the deadline, then spins on the monotonic clock for the rest.
+   *
+   * @param enable  True to use the precise strategy for all delays and sleeps
+   */
+  void enablePreciseDelay( const bool enable );
+
+  /**
+   * @brief Sets how long before the deadline precise mode stops sleeping and spins
+   *
+   * @param host_ns   Spin window in host nanoseconds. Defaults to 100us.
+   */
+  void setSpinThreshold( const int64_t host_ns );
+
+  /**
+   * @brief Installs an observer of the achieved error of every delay
+   *
+   * @param callback  Function to invoke, or nullptr to remove
+   */
+  void setDelayStatsCallback( DelayStatsCallback callback );
+
+  /**
+   * @brief Gets the accumulated delay error statistics
+   *
+   * @return DelayStats
+   */
+  DelayStats getDelayStats();
+
+  /**
+   * @brief Clears the accumulated delay error statistics
+   */
+  void resetDelayStats();
+
+}    // namespace mb::time::sim
+
+#endif /* !MBEDUTILS_SIM_TIME_HPP */
@@ -0,0 +1,516 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_timer.cpp
+ *
+ *  Description:
+ *    Hierarchical timing wheel driven by a single timerfd thread
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mbedutils/logging.hpp>
+#include <mbedutils/threading.hpp>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "sim_node.hpp"
+#include "sim_pool.hpp"
+#include "sim_thread.hpp"
+#include "sim_time.hpp"
+#include "sim_timer.hpp"
+
+namespace mb::time::sim
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t   WHEEL_BITS   = 6;
+  static constexpr size_t   WHEEL_SLOTS  = 1u << WHEEL_BITS;
+  static constexpr size_t   WHEEL_MASK   = WHEEL_SLOTS - 1u;
+  static constexpr size_t   WHEEL_LEVELS = 4;
+  static constexpr uint64_t WHEEL_SPAN   = 1ull << ( WHEEL_BITS * WHEEL_LEVELS );
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Intrusive list node for a pending timer.
+   *
+   * Slot heads are sentinels of the same type, so linking and unlinking are
+   * both O(1) without any special cases.
+   */
+  struct TimerNode
+  {
+    TimerNode         *prev         = this;
+    TimerNode         *next         = this;
+    TimerId            id           = TIMER_ID_INVALID;
+    uint64_t           expires      = 0;
+    uint64_t           period_ticks = 0;
+    mb::hw::sim::Node *owner        = nullptr;
+    TimerCallback      callback;
+    bool               cancelled = false;
+
+    bool linked() const
+    {
+      return next != this;
+    }
+
+    void unlink()
+    {
+      prev->next = next;
+      next->prev = prev;
+      prev       = this;
+      next       = this;
+    }
+
+    void push_back( TimerNode *node )
+    {
+      node->prev = prev;
+      node->next = this;
+      prev->next = node;
+      prev       = node;
+    }
+  };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::mutex                               s_wheel_lock;
+  static TimerNode                                s_wheel[ WHEEL_LEVELS ][ WHEEL_SLOTS ];
+  static uint64_t                                 s_current_tick;
+  static TimerId                                  s_next_id = 1;
+  static std::unordered_map<TimerId, TimerNode *> s_timers;
+  static auto                                    &s_node_pool = *new mb::hw::sim::ObjectPool<TimerNode>( 64 );
+
+  static std::mutex                       s_service_lock;
+  static std::thread                      s_service_thread;
+  static std::atomic<bool>                s_service_running{ false };
+  static std::atomic<mb::hw::sim::Node *> s_service_node{ nullptr };
+  static std::atomic<uint64_t>            s_tick_count{ 0 };
+  static std::atomic<uint32_t>            s_tick_hz{ 1000 };
+  static int                              s_stop_fd = -1;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Places a node into the wheel level that covers its expiry.
+   *
+   * Timers further out than the whole wheel go into the last slot reachable
+   * and are re-filed each time they cascade until they come in range.
+   * Must be called with s_wheel_lock held.
+   */
+  static void wheel_insert( TimerNode *node )
+  {
+    uint64_t expires = node->expires;
+    uint64_t delta   = ( expires > s_current_tick ) ? ( expires - s_current_tick ) : 0;
+
+    if( delta >= WHEEL_SPAN )
+    {
+      delta   = WHEEL_SPAN - 1;
+      expires = s_current_tick + delta;
+    }
+
+    size_t level = 0;
+    while( ( level < WHEEL_LEVELS - 1 ) && ( delta >= ( 1ull << ( WHEEL_BITS * ( level + 1 ) ) ) ) )
+    {
+      level++;
+    }
+
+    const size_t slot = ( expires >> ( WHEEL_BITS * level ) ) & WHEEL_MASK;
+    s_wheel[ level ][ slot ].push_back( node );
+  }
+
+  /**
+   * @brief Re-files every node in a higher level slot into the lower levels
+   */
+  static void wheel_cascade( const size_t level, const size_t slot )
+  {
+    TimerNode &head = s_wheel[ level ][ slot ];
+    while( head.linked() )
+    {
+      TimerNode *node = head.next;
+      node->unlink();
+      wheel_insert( node );
+    }
+  }
+
+  /**
+   * @brief Advances the wheel by one tick, collecting every timer that expired
+   *
+   * @param expired   Output list of nodes whose callbacks should run
+   */
+  static void wheel_advance( std::vector<TimerNode *> &expired )
+  {
+    std::lock_guard<std::mutex> lock( s_wheel_lock );
+
+    s_current_tick++;
+
+    for( size_t level = 1; level < WHEEL_LEVELS; level++ )
+    {
+      const uint64_t lower_bits = s_current_tick & ( ( 1ull << ( WHEEL_BITS * level ) ) - 1u );
+      if( lower_bits != 0 )
+      {
+        break;
+      }
+
+      wheel_cascade( level, ( s_current_tick >> ( WHEEL_BITS * level ) ) & WHEEL_MASK );
+    }
+
+    TimerNode &head = s_wheel[ 0 ][ s_current_tick & WHEEL_MASK ];
+    while( head.linked() )
+    {
+      TimerNode *node = head.next;
+      node->unlink();
+
+      if( node->expires > s_current_tick )
+      {
+        // Clamped long timer that isn't due yet
+        wheel_insert( node );
+        continue;
+      }
+
+      expired.push_back( node );
+    }
+  }
+
+  /**
+   * @brief Runs expired callbacks outside of the wheel lock, then re-arms or frees them.
+   *
+   * Each callback runs on behalf of the node that scheduled it, whichever
+   * node owns the service thread.
+   */
+  static void run_expired( std::vector<TimerNode *> &expired )
+  {
+    for( TimerNode *node : expired )
+    {
+      bool cancelled;
+      {
+        std::lock_guard<std::mutex> lock( s_wheel_lock );
+        cancelled = node->cancelled;
+      }
+
+      if( node->callback && !cancelled )
+      {
+        mb::hw::sim::NodeScope scope( *node->owner );
+        node->callback();
+      }
+
+      std::lock_guard<std::mutex> lock( s_wheel_lock );
+      if( node->period_ticks && !node->cancelled )
+      {
+        node->expires = s_current_tick + node->period_ticks;
+        wheel_insert( node );
+      }
+      else
+      {
+        s_timers.erase( node->id );
+        s_node_pool.release( node );
+      }
+    }
+
+    expired.clear();
+  }
+
+
+  static uint64_t us_to_ticks( const uint64_t us, const uint32_t tick_hz )
+  {
+    const uint64_t ticks = ( us * tick_hz + 999999u ) / 1000000u;
+    return ticks ? ticks : 1;
+  }
+
+
+  static TimerId schedule( const uint64_t delay_us, const uint64_t period_us, TimerCallback callback )
+  {
+    const uint32_t tick_hz = s_tick_hz.load();
+
+    std::lock_guard<std::mutex> lock( s_wheel_lock );
+
+    TimerNode *node = s_node_pool.allocate();
+    if( !node )
+    {
+      return TIMER_ID_INVALID;
+    }
+
+    node->id           = s_next_id++;
+    node->expires      = s_current_tick + us_to_ticks( delay_us, tick_hz );
+    node->period_ticks = period_us ? us_to_ticks( period_us, tick_hz ) : 0;
+    node->owner        = &mb::hw::sim::currentNode();
+    node->callback     = std::move( callback );
+
+    wheel_insert( node );
+    s_timers[ node->id ] = node;
+    return node->id;
+  }
+
+
+  static void arm_timerfd( const int fd, const uint32_t tick_hz )
+  {
+    const int64_t host_ns = std::max<int64_t>( toHostNanos( 1000000000LL / tick_hz ), 1000 );
+
+    itimerspec spec;
+    spec.it_interval.tv_sec  = static_cast<time_t>( host_ns / 1000000000LL );
+    spec.it_interval.tv_nsec = static_cast<long>( host_ns % 1000000000LL );
+    spec.it_value            = spec.it_interval;
+    timerfd_settime( fd, 0, &spec, nullptr );
+  }
+
+  /**
+   * @brief Body of the timer service thread
+   */
+  static void service_loop( const int timer_fd, const int stop_fd, const uint32_t tick_hz )
+  {
+    std::vector<TimerNode *> expired;
+    double                   armed_scale  = getTimeScale();
+    const int64_t            tick_ns      = 1000000000LL / tick_hz;
+    int64_t                  next_tick_ns = nanos() + tick_ns;
+
+    arm_timerfd( timer_fd, tick_hz );
+
+    pollfd fds[ 2 ] = { { timer_fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+    while( s_service_running.load() )
+    {
+      if( poll( fds, 2, -1 ) <= 0 || ( fds[ 1 ].revents & POLLIN ) )
+      {
+        continue;
+      }
+
+      uint64_t expirations = 0;
+      if( read( timer_fd, &expirations, sizeof( expirations ) ) != sizeof( expirations ) )
+      {
+        continue;
+      }
+
+      /*-----------------------------------------------------------------------
+      Follow time scale changes so the tick stays fixed in simulated time
+      -----------------------------------------------------------------------*/
+      if( getTimeScale() != armed_scale )
+      {
+        armed_scale = getTimeScale();
+        arm_timerfd( timer_fd, tick_hz );
+      }
+
+      /*-----------------------------------------------------------------------
+      Under a time horizon the host timer keeps firing while simulated time is
+      parked, so count ticks against simulated time instead.
+      -----------------------------------------------------------------------*/
+      uint64_t ticks = expirations;
+      if( getTimeHorizon() != NO_TIME_HORIZON )
+      {
+        const int64_t now = nanos();
+
+        ticks = 0;
+        while( next_tick_ns <= now )
+        {
+          next_tick_ns += tick_ns;
+          ticks++;
+        }
+      }
+      else
+      {
+        next_tick_ns += static_cast<int64_t>( expirations ) * tick_ns;
+      }
+
+      /*-----------------------------------------------------------------------
+      Process every tick that elapsed, including any we were late for
+      -----------------------------------------------------------------------*/
+      for( uint64_t i = 0; i < ticks; i++ )
+      {
+        wheel_advance( expired );
+        run_expired( expired );
+
+        s_tick_count.fetch_add( 1, std::memory_order_relaxed );
+        mb::thread::intf::on_tick();
+
+        if( mb::thread::sim::allTasksBlocked() )
+        {
+          mb::thread::intf::on_idle();
+        }
+      }
+    }
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool startTimerService( const uint32_t tick_hz )
+  {
+    std::lock_guard<std::mutex> lock( s_service_lock );
+    if( s_service_running.load() || !tick_hz )
+    {
+      return s_service_running.load();
+    }
+
+    const int timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    const int stop_fd  = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    if( timer_fd < 0 || stop_fd < 0 )
+    {
+      LOG_ERROR( "Failed to create timer service fds: %s", strerror( errno ) );
+      if( timer_fd >= 0 )
+      {
+        close( timer_fd );
+      }
+      if( stop_fd >= 0 )
+      {
+        close( stop_fd );
+      }
+      return false;
+    }
+
+    /*-------------------------------------------------------------------------
+    Timers already pending keep the tick count they were converted with
+    -------------------------------------------------------------------------*/
+    s_tick_hz.store( tick_hz );
+    s_stop_fd = stop_fd;
+    s_service_running.store( true );
+
+    /*-------------------------------------------------------------------------
+    The tick and its idle check belong to the node that started the service
+    -------------------------------------------------------------------------*/
+    mb::hw::sim::Node *node = &mb::hw::sim::currentNode();
+    s_service_node.store( node );
+
+    s_service_thread = std::thread( [ timer_fd, stop_fd, tick_hz, node ]() {
+      mb::hw::sim::NodeScope scope( *node );
+      service_loop( timer_fd, stop_fd, tick_hz );
+      close( timer_fd );
+    } );
+
+    return true;
+  }
+
+
+  void stopTimerService()
+  {
+    std::lock_guard<std::mutex> lock( s_service_lock );
+    if( !s_service_running.exchange( false ) )
+    {
+      return;
+    }
+
+    const uint64_t one = 1;
+    write( s_stop_fd, &one, sizeof( one ) );
+
+    if( s_service_thread.joinable() )
+    {
+      s_service_thread.join();
+    }
+
+    close( s_stop_fd );
+    s_stop_fd = -1;
+    s_service_node.store( nullptr );
+  }
+
+
+  bool timerServiceRunning()
+  {
+    return s_service_running.load();
+  }
+
+
+  mb::hw::sim::Node *timerServiceNode()
+  {
+    return s_service_node.load();
+  }
+
+
+  uint64_t getTickCount()
+  {
+    return s_tick_count.load( std::memory_order_relaxed );
+  }
+
+
+  TimerId scheduleOnce( const uint64_t delay_us, TimerCallback callback )
+  {
+    return schedule( delay_us, 0, std::move( callback ) );
+  }
+
+
+  TimerId schedulePeriodic( const uint64_t period_us, TimerCallback callback )
+  {
+    if( !period_us )
+    {
+      return TIMER_ID_INVALID;
+    }
+
+    return schedule( period_us, period_us, std::move( callback ) );
+  }
+
+
+  bool cancelTimer( const TimerId id )
+  {
+    std::lock_guard<std::mutex> lock( s_wheel_lock );
+
+    auto iter = s_timers.find( id );
+    if( iter == s_timers.end() )
+    {
+      return false;
+    }
+
+    TimerNode *node = iter->second;
+    if( !node->linked() )
+    {
+      /*-----------------------------------------------------------------------
+      The callback is running right now. Flag it so run_expired() frees the
+      node instead of re-arming it.
+      -----------------------------------------------------------------------*/
+      const bool was_pending = !node->cancelled;
+      node->cancelled        = true;
+      return was_pending;
+    }
+
+    node->unlink();
+    s_timers.erase( iter );
+    s_node_pool.release( node );
+    return true;
+  }
+
+
+  void cancelAllTimers()
+  {
+    mb::hw::sim::Node *owner = &mb::hw::sim::currentNode();
+
+    std::lock_guard<std::mutex> lock( s_wheel_lock );
+
+    for( auto iter = s_timers.begin(); iter != s_timers.end(); )
+    {
+      TimerNode *node = iter->second;
+      if( node->owner != owner )
+      {
+        ++iter;
+        continue;
+      }
+
+      if( !node->linked() )
+      {
+        /*---------------------------------------------------------------------
+        Running right now, run_expired() frees it once the callback returns
+        ---------------------------------------------------------------------*/
+        node->cancelled = true;
+        ++iter;
+        continue;
+      }
+
+      node->unlink();
+      s_node_pool.release( node );
+      iter = s_timers.erase( iter );
+    }
+  }
+}    // namespace mb::time::sim
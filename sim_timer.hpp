@@ -0,0 +1,117 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_timer.hpp
+ *
+ *  Description:
+ *    Simulator timer service, standing in for the RTOS tick and software
+ *    timers on target
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_TIMER_HPP
+#define MBEDUTILS_SIM_TIMER_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <cstdint>
+#include <functional>
+#include "sim_node.hpp"
+
+namespace mb::time::sim
+{
+  /*---------------------------------------------------------------------------
+  Aliases
+  ---------------------------------------------------------------------------*/
+
+  using TimerId       = uint64_t;
+  using TimerCallback = std::function<void()>;
+
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr TimerId TIMER_ID_INVALID = 0;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Starts the timer service thread.
+   *
+   * A single thread, woken by a timerfd at the tick rate, advances a
+   * hierarchical timing wheel, invokes mb::thread::intf::on_tick() once per
+   * tick and mb::thread::intf::on_idle() on ticks where no simulated task is
+   * runnable. The tick period is in simulated time, so it follows the time
+   * scale. This is started automatically by start_scheduler().
+   *
+   * @param tick_hz   Tick rate in simulated Hz
+   * @return true     The service is running
+   */
+  bool startTimerService( const uint32_t tick_hz = 1000 );
+
+  /**
+   * @brief Stops the timer service thread. Pending timers are kept.
+   */
+  void stopTimerService();
+
+  /**
+   * @brief Checks if the timer service thread is running
+   */
+  bool timerServiceRunning();
+
+  /**
+   * @brief Gets the node whose tick the service thread drives
+   *
+   * @return mb::hw::sim::Node*   nullptr while the service is stopped
+   */
+  mb::hw::sim::Node *timerServiceNode();
+
+  /**
+   * @brief Gets the number of ticks processed since the service first started
+   *
+   * @return uint64_t
+   */
+  uint64_t getTickCount();
+
+  /**
+   * @brief Schedules a callback to run once after a delay.
+   *
+   * Callbacks run on the timer service thread, so they should be short and
+   * must not block. They act on behalf of the scheduling thread's node. The
+   * delay is rounded up to whole ticks.
+   *
+   * @param delay_us  Simulated microseconds until the callback fires
+   * @param callback  Function to invoke
+   * @return TimerId  Handle for cancelTimer(), TIMER_ID_INVALID on failure
+   */
+  TimerId scheduleOnce( const uint64_t delay_us, TimerCallback callback );
+
+  /**
+   * @brief Schedules a callback to run repeatedly
+   *
+   * @param period_us Simulated microseconds between invocations
+   * @param callback  Function to invoke
+   * @return TimerId  Handle for cancelTimer(), TIMER_ID_INVALID on failure
+   */
+  TimerId schedulePeriodic( const uint64_t period_us, TimerCallback callback );
+
+  /**
+   * @brief Cancels a pending timer in O(1)
+   *
+   * @param id      Handle returned when the timer was scheduled
+   * @return true   The timer was pending and has been removed
+   */
+  bool cancelTimer( const TimerId id );
+
+  /**
+   * @brief Cancels every pending timer the calling thread's node scheduled, e.g. ahead of a warm reset
+   */
+  void cancelAllTimers();
+
+}    // namespace mb::time::sim
+
+#endif /* !MBEDUTILS_SIM_TIMER_HPP */
@@ -0,0 +1,359 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_trace.cpp
+ *
+ *  Description:
+ *    Timeline tracer of simulator activity in the Chrome trace event format
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <mbedutils/logging.hpp>
+#include <memory>
+#include <mutex>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "sim_time.hpp"
+#include "sim_trace.hpp"
+
+namespace mb::hw::sim::trace
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t  RING_DEPTH       = 8192; /**< Events per thread, power of two */
+  static constexpr int64_t WRITER_PERIOD_MS = 10;
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Fixed size capture of one event
+   */
+  struct Event
+  {
+    int64_t     time_ns;
+    int64_t     duration_ns;
+    uint64_t    arg;
+    const char *name;
+    char        phase; /**< Chrome trace event phase: B, E, X or i */
+    Category    category;
+  };
+
+  /**
+   * @brief Single producer, single consumer ring owned by one thread
+   */
+  struct ThreadRing
+  {
+    alignas( 64 ) std::atomic<uint64_t> head{ 0 };
+    alignas( 64 ) std::atomic<uint64_t> tail{ 0 };
+    std::array<Event, RING_DEPTH>       events;
+
+    pid_t       tid;
+    std::string name;       /**< Guarded by s_registry_lock */
+    bool        named;      /**< Writer has emitted the current name */
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  std::atomic<bool> g_enabled{ false };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::mutex                               s_registry_lock;
+  static std::vector<std::shared_ptr<ThreadRing>> s_rings;
+  static std::atomic<uint64_t>                    s_dropped{ 0 };
+
+  static std::mutex        s_control_lock;
+  static std::thread       s_writer;
+  static std::atomic<bool> s_writer_stop{ false };
+  static FILE             *s_file   = nullptr;
+  static int64_t           s_origin = 0;
+
+  static thread_local std::string tls_name;
+  static thread_local ThreadRing *tls_ring = nullptr;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static const char *category_name( const Category category )
+  {
+    switch( category )
+    {
+      case Category::TASK:
+        return "task";
+      case Category::LOCK:
+        return "lock";
+      case Category::SLEEP:
+        return "sleep";
+      case Category::PIPE:
+        return "pipe";
+      default:
+        return "sim";
+    }
+  }
+
+
+  static ThreadRing *thread_ring()
+  {
+    thread_local std::shared_ptr<ThreadRing> tls_owner;
+
+    if( !tls_owner )
+    {
+      tls_owner        = std::make_shared<ThreadRing>();
+      tls_owner->tid   = static_cast<pid_t>( syscall( SYS_gettid ) );
+      tls_owner->named = false;
+      tls_ring         = tls_owner.get();
+
+      std::lock_guard<std::mutex> lock( s_registry_lock );
+      tls_owner->name = tls_name.empty() ? ( "thread " + std::to_string( tls_owner->tid ) ) : tls_name;
+      s_rings.push_back( tls_owner );
+    }
+
+    return tls_owner.get();
+  }
+
+
+  static inline void push( const Event &event )
+  {
+    ThreadRing    *ring = thread_ring();
+    const uint64_t head = ring->head.load( std::memory_order_relaxed );
+    if( head - ring->tail.load( std::memory_order_acquire ) >= RING_DEPTH )
+    {
+      s_dropped.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+
+    ring->events[ head & ( RING_DEPTH - 1 ) ] = event;
+    ring->head.store( head + 1, std::memory_order_release );
+  }
+
+
+  /**
+   * @brief Writes a quoted JSON string, escaping anything that would break the file
+   */
+  static void write_string( FILE *file, const char *str )
+  {
+    fputc( '"', file );
+    for( ; *str; str++ )
+    {
+      const unsigned char c = static_cast<unsigned char>( *str );
+      if( ( c == '"' ) || ( c == '\\' ) )
+      {
+        fputc( '\\', file );
+        fputc( c, file );
+      }
+      else if( c < 0x20 )
+      {
+        fprintf( file, "\\u%04x", c );
+      }
+      else
+      {
+        fputc( c, file );
+      }
+    }
+    fputc( '"', file );
+  }
+
+
+  static void write_event( FILE *file, const pid_t pid, const pid_t tid, const Event &event )
+  {
+    const double ts_us = static_cast<double>( event.time_ns - s_origin ) / 1000.0;
+
+    fprintf( file, ",\n{\"name\":" );
+    write_string( file, event.name );
+    fprintf( file, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", category_name( event.category ),
+             event.phase, ts_us, pid, tid );
+
+    if( event.phase == 'X' )
+    {
+      fprintf( file, ",\"dur\":%.3f", static_cast<double>( event.duration_ns ) / 1000.0 );
+    }
+    else if( event.phase == 'i' )
+    {
+      fprintf( file, ",\"s\":\"t\"" );
+    }
+
+    fprintf( file, ",\"args\":{\"arg\":%llu}}", static_cast<unsigned long long>( event.arg ) );
+  }
+
+
+  /**
+   * @brief Moves everything buffered so far into the file. Rings of exited threads are dropped once empty.
+   */
+  static void drain( FILE *file, const pid_t pid )
+  {
+    std::lock_guard<std::mutex> lock( s_registry_lock );
+    for( auto iter = s_rings.begin(); iter != s_rings.end(); )
+    {
+      ThreadRing *ring = iter->get();
+      if( !ring->named )
+      {
+        fprintf( file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, ring->tid );
+        write_string( file, ring->name.c_str() );
+        fprintf( file, "}}" );
+        ring->named = true;
+      }
+
+      const uint64_t head = ring->head.load( std::memory_order_acquire );
+      uint64_t       tail = ring->tail.load( std::memory_order_relaxed );
+
+      for( ; tail != head; tail++ )
+      {
+        write_event( file, pid, ring->tid, ring->events[ tail & ( RING_DEPTH - 1 ) ] );
+      }
+      ring->tail.store( tail, std::memory_order_release );
+
+      if( ( iter->use_count() == 1 ) && ( tail == ring->head.load( std::memory_order_acquire ) ) )
+      {
+        iter = s_rings.erase( iter );
+      }
+      else
+      {
+        ++iter;
+      }
+    }
+  }
+
+
+  static void writer_thread( FILE *file )
+  {
+    const pid_t pid = getpid();
+
+    fprintf( file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"mbedutils sim\"}}", pid );
+
+    while( !s_writer_stop.load() )
+    {
+      drain( file, pid );
+      std::this_thread::sleep_for( std::chrono::milliseconds( WRITER_PERIOD_MS ) );
+    }
+
+    drain( file, pid );
+    fprintf( file, "\n]\n" );
+    fflush( file );
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool start( const std::string &path )
+  {
+    std::lock_guard<std::mutex> lock( s_control_lock );
+    if( s_file )
+    {
+      return false;
+    }
+
+    s_file = fopen( path.c_str(), "w" );
+    if( !s_file )
+    {
+      LOG_ERROR( "Unable to open trace file %s", path.c_str() );
+      return false;
+    }
+
+    /*-------------------------------------------------------------------------
+    Leftovers from an earlier session would carry stale timestamps
+    -------------------------------------------------------------------------*/
+    {
+      std::lock_guard<std::mutex> registry( s_registry_lock );
+      for( auto &ring : s_rings )
+      {
+        ring->tail.store( ring->head.load( std::memory_order_acquire ), std::memory_order_release );
+        ring->named = false;
+      }
+    }
+
+    s_origin = timestamp();
+    s_dropped.store( 0 );
+    s_writer_stop.store( false );
+    s_writer = std::thread( writer_thread, s_file );
+    g_enabled.store( true );
+    return true;
+  }
+
+
+  void stop()
+  {
+    std::lock_guard<std::mutex> lock( s_control_lock );
+    if( !s_file )
+    {
+      return;
+    }
+
+    g_enabled.store( false );
+    s_writer_stop.store( true );
+    if( s_writer.joinable() )
+    {
+      s_writer.join();
+    }
+
+    fclose( s_file );
+    s_file = nullptr;
+  }
+
+
+  uint64_t droppedEvents()
+  {
+    return s_dropped.load( std::memory_order_relaxed );
+  }
+
+
+  void setThreadName( const std::string &name )
+  {
+    tls_name = name;
+
+    if( tls_ring )
+    {
+      std::lock_guard<std::mutex> lock( s_registry_lock );
+      tls_ring->name  = name;
+      tls_ring->named = false;
+    }
+  }
+
+
+  int64_t timestamp()
+  {
+    return mb::time::sim::monotonic_ns();
+  }
+
+
+  void begin( const Category category, const char *name )
+  {
+    push( Event{ timestamp(), 0, 0, name, 'B', category } );
+  }
+
+
+  void end( const Category category, const char *name )
+  {
+    push( Event{ timestamp(), 0, 0, name, 'E', category } );
+  }
+
+
+  void complete( const Category category, const char *name, const int64_t start_ns, const uint64_t arg )
+  {
+    push( Event{ start_ns, timestamp() - start_ns, arg, name, 'X', category } );
+  }
+
+
+  void instant( const Category category, const char *name, const uint64_t arg )
+  {
+    push( Event{ timestamp(), 0, arg, name, 'i', category } );
+  }
+
+}    // namespace mb::hw::sim::trace
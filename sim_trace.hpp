@@ -0,0 +1,130 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_trace.hpp
+ *
+ *  Description:
+ *    Timeline tracer of simulator activity in the Chrome trace event format
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_TRACE_HPP
+#define MBEDUTILS_SIM_TRACE_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace mb::hw::sim::trace
+{
+  /*---------------------------------------------------------------------------
+  Enumerations
+  ---------------------------------------------------------------------------*/
+
+  enum class Category : uint8_t
+  {
+    TASK,
+    LOCK,
+    SLEEP,
+    PIPE
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  extern std::atomic<bool> g_enabled;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Checks if tracing is turned on. Cheap enough for hot paths.
+   */
+  static inline bool enabled()
+  {
+    return g_enabled.load( std::memory_order_relaxed );
+  }
+
+  /**
+   * @brief Starts tracing into a Chrome trace event JSON file.
+   *
+   * Events are appended to a lock-free ring owned by the emitting thread and
+   * a background writer streams them to the file. Load the result in
+   * chrome://tracing or ui.perfetto.dev. Events are dropped, and counted, if
+   * a thread outruns the writer.
+   *
+   * @param path    File to write
+   * @return true   The file was opened and tracing has started
+   */
+  bool start( const std::string &path );
+
+  /**
+   * @brief Stops tracing and completes the file
+   */
+  void stop();
+
+  /**
+   * @brief Gets how many events were lost to full per-thread rings
+   *
+   * @return uint64_t
+   */
+  uint64_t droppedEvents();
+
+  /**
+   * @brief Names the calling thread's track in the timeline
+   *
+   * @param name    Track name, copied
+   */
+  void setThreadName( const std::string &name );
+
+  /**
+   * @brief Timestamp source of all events, nanoseconds on CLOCK_MONOTONIC
+   *
+   * @return int64_t
+   */
+  int64_t timestamp();
+
+  /**
+   * @brief Opens a span on the calling thread's track
+   *
+   * @param category  Event category
+   * @param name      String with static storage duration
+   */
+  void begin( const Category category, const char *name );
+
+  /**
+   * @brief Closes the span most recently opened with begin()
+   *
+   * @param category  Event category
+   * @param name      String with static storage duration
+   */
+  void end( const Category category, const char *name );
+
+  /**
+   * @brief Records a span that started at the given time and ends now
+   *
+   * @param category  Event category
+   * @param name      String with static storage duration
+   * @param start_ns  When the span began, from timestamp()
+   * @param arg       Value shown with the event, e.g. a lock id or byte count
+   */
+  void complete( const Category category, const char *name, const int64_t start_ns, const uint64_t arg = 0 );
+
+  /**
+   * @brief Records a point in time event
+   *
+   * @param category  Event category
+   * @param name      String with static storage duration
+   * @param arg       Value shown with the event
+   */
+  void instant( const Category category, const char *name, const uint64_t arg = 0 );
+
+}    // namespace mb::hw::sim::trace
+
+#endif /* !MBEDUTILS_SIM_TRACE_HPP */
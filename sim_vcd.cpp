@@ -0,0 +1,416 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_vcd.cpp
+ *
+ *  Description:
+ *    Value Change Dump recorder of simulated GPIO and serial activity
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <ctime>
+#include <mbedutils/interfaces/time_intf.hpp>
+#include <mbedutils/logging.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sim_gpio.hpp"
+#include "sim_vcd.hpp"
+
+namespace mb::hw::sim::vcd
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  static constexpr size_t  RING_DEPTH        = 16384; /**< Records per thread, power of two */
+  static constexpr int64_t WRITER_PERIOD_US  = 1000;
+  static constexpr int64_t REORDER_WINDOW_US = 2000;  /**< Records younger than this wait for stragglers */
+
+  static constexpr size_t GPIO_SIGNALS     = mb::hw::gpio::sim::MAX_PORTS * mb::hw::gpio::sim::PINS_PER_PORT;
+  static constexpr size_t SIGNALS_PER_CHAN = 4; /**< tx, tx strobe, rx, rx strobe */
+  static constexpr size_t TOTAL_SIGNALS    = GPIO_SIGNALS + MAX_SERIAL_CHANNELS * SIGNALS_PER_CHAN;
+
+  /*---------------------------------------------------------------------------
+  Structures
+  ---------------------------------------------------------------------------*/
+
+  enum class RecordKind : uint8_t
+  {
+    GPIO,
+    SERIAL_TX,
+    SERIAL_RX
+  };
+
+  /**
+   * @brief Fixed size capture of one event
+   */
+  struct Record
+  {
+    int64_t    time_us;
+    uint32_t   a;    /**< GPIO: changed pins. Serial: byte value. */
+    uint32_t   b;    /**< GPIO: new port state. Serial: unused. */
+    uint16_t   id;   /**< Port or channel */
+    RecordKind kind;
+  };
+
+  /**
+   * @brief Single producer, single consumer ring owned by one thread
+   */
+  struct ThreadRing
+  {
+    alignas( 64 ) std::atomic<uint64_t> head{ 0 };
+    alignas( 64 ) std::atomic<uint64_t> tail{ 0 };
+    std::array<Record, RING_DEPTH>      records;
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  std::atomic<bool> g_enabled{ false };
+
+  /*---------------------------------------------------------------------------
+  Private Data
+  ---------------------------------------------------------------------------*/
+
+  static std::mutex                               s_registry_lock;
+  static std::vector<std::shared_ptr<ThreadRing>> s_rings;
+  static std::atomic<uint64_t>                    s_dropped{ 0 };
+
+  static std::mutex        s_control_lock;
+  static std::thread       s_writer;
+  static std::atomic<bool> s_writer_stop{ false };
+  static FILE             *s_file = nullptr;
+
+  /*---------------------------------------------------------------------------
+  Private Functions
+  ---------------------------------------------------------------------------*/
+
+  static ThreadRing *thread_ring()
+  {
+    thread_local std::shared_ptr<ThreadRing> tls_ring;
+
+    if( !tls_ring )
+    {
+      tls_ring = std::make_shared<ThreadRing>();
+
+      std::lock_guard<std::mutex> lock( s_registry_lock );
+      s_rings.push_back( tls_ring );
+    }
+
+    return tls_ring.get();
+  }
+
+
+  static inline void push( ThreadRing *ring, const Record &record )
+  {
+    const uint64_t head = ring->head.load( std::memory_order_relaxed );
+    if( head - ring->tail.load( std::memory_order_acquire ) >= RING_DEPTH )
+    {
+      s_dropped.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+
+    ring->records[ head & ( RING_DEPTH - 1 ) ] = record;
+    ring->head.store( head + 1, std::memory_order_release );
+  }
+
+
+  /**
+   * @brief Builds the short printable identifier VCD uses for a signal
+   */
+  static std::string signal_id( size_t index )
+  {
+    std::string id;
+    do
+    {
+      id.push_back( static_cast<char>( '!' + ( index % 94 ) ) );
+      index /= 94;
+    } while( index );
+
+    return id;
+  }
+
+
+  static inline size_t serial_signal( const size_t channel, const RecordKind kind, const bool strobe )
+  {
+    return GPIO_SIGNALS + channel * SIGNALS_PER_CHAN + ( ( kind == RecordKind::SERIAL_RX ) ? 2 : 0 ) + ( strobe ? 1 : 0 );
+  }
+
+
+  static void write_byte_value( FILE *file, const uint32_t value, const std::string &id )
+  {
+    char bits[ 9 ];
+    for( size_t bit = 0; bit < 8; bit++ )
+    {
+      bits[ bit ] = ( value & ( 0x80u >> bit ) ) ? '1' : '0';
+    }
+    bits[ 8 ] = '\0';
+
+    fprintf( file, "b%s %s\n", bits, id.c_str() );
+  }
+
+
+  static void write_header( FILE *file, const std::vector<std::string> &ids )
+  {
+    char       date[ 64 ];
+    const auto now = std::time( nullptr );
+    std::strftime( date, sizeof( date ), "%Y-%m-%d %H:%M:%S", std::localtime( &now ) );
+
+    fprintf( file, "$date %s $end\n", date );
+    fprintf( file, "$version mbedutils simulator $end\n" );
+    fprintf( file, "$timescale 1us $end\n" );
+    fprintf( file, "$scope module sim $end\n" );
+
+    fprintf( file, "$scope module gpio $end\n" );
+    for( size_t port = 0; port < mb::hw::gpio::sim::MAX_PORTS; port++ )
+    {
+      fprintf( file, "$scope module port%zu $end\n", port );
+      for( size_t pin = 0; pin < mb::hw::gpio::sim::PINS_PER_PORT; pin++ )
+      {
+        fprintf( file, "$var wire 1 %s p%zu $end\n", ids[ port * mb::hw::gpio::sim::PINS_PER_PORT + pin ].c_str(), pin );
+      }
+      fprintf( file, "$upscope $end\n" );
+    }
+    fprintf( file, "$upscope $end\n" );
+
+    fprintf( file, "$scope module serial $end\n" );
+    for( size_t chan = 0; chan < MAX_SERIAL_CHANNELS; chan++ )
+    {
+      fprintf( file, "$scope module ch%zu $end\n", chan );
+      fprintf( file, "$var wire 8 %s tx $end\n", ids[ serial_signal( chan, RecordKind::SERIAL_TX, false ) ].c_str() );
+      fprintf( file, "$var wire 1 %s tx_strobe $end\n", ids[ serial_signal( chan, RecordKind::SERIAL_TX, true ) ].c_str() );
+      fprintf( file, "$var wire 8 %s rx $end\n", ids[ serial_signal( chan, RecordKind::SERIAL_RX, false ) ].c_str() );
+      fprintf( file, "$var wire 1 %s rx_strobe $end\n", ids[ serial_signal( chan, RecordKind::SERIAL_RX, true ) ].c_str() );
+      fprintf( file, "$upscope $end\n" );
+    }
+    fprintf( file, "$upscope $end\n" );
+
+    fprintf( file, "$upscope $end\n" );
+    fprintf( file, "$enddefinitions $end\n" );
+  }
+
+
+  /**
+   * @brief Writes the initial value of every signal
+   */
+  static void write_initial_values( FILE *file, const std::vector<std::string> &ids, const int64_t time_us )
+  {
+    fprintf( file, "#%lld\n$dumpvars\n", static_cast<long long>( time_us ) );
+
+    for( size_t port = 0; port < mb::hw::gpio::sim::MAX_PORTS; port++ )
+    {
+      const uint32_t state = mb::hw::gpio::sim::readPort( static_cast<mb::hw::gpio::Port_t>( port ) );
+      for( size_t pin = 0; pin < mb::hw::gpio::sim::PINS_PER_PORT; pin++ )
+      {
+        fprintf( file, "%c%s\n", ( ( state >> pin ) & 1u ) ? '1' : '0',
+                 ids[ port * mb::hw::gpio::sim::PINS_PER_PORT + pin ].c_str() );
+      }
+    }
+
+    for( size_t chan = 0; chan < MAX_SERIAL_CHANNELS; chan++ )
+    {
+      for( const RecordKind kind : { RecordKind::SERIAL_TX, RecordKind::SERIAL_RX } )
+      {
+        fprintf( file, "bxxxxxxxx %s\n", ids[ serial_signal( chan, kind, false ) ].c_str() );
+        fprintf( file, "0%s\n", ids[ serial_signal( chan, kind, true ) ].c_str() );
+      }
+    }
+
+    fprintf( file, "$end\n" );
+  }
+
+
+  /**
+   * @brief Background thread merging the rings into the VCD file
+   */
+  static void writer_thread( FILE *file, const int64_t start_us )
+  {
+    std::vector<std::string> ids( TOTAL_SIGNALS );
+    for( size_t idx = 0; idx < TOTAL_SIGNALS; idx++ )
+    {
+      ids[ idx ] = signal_id( idx );
+    }
+
+    write_header( file, ids );
+    write_initial_values( file, ids, start_us );
+
+    std::vector<uint8_t> strobes( TOTAL_SIGNALS, 0 );
+    std::vector<Record>  pending;
+    int64_t              last_time = start_us;
+
+    while( true )
+    {
+      const bool final_pass = s_writer_stop.load();
+
+      /*-----------------------------------------------------------------------
+      Drain every thread's ring. Rings of exited threads are dropped once empty.
+      -----------------------------------------------------------------------*/
+      {
+        std::lock_guard<std::mutex> lock( s_registry_lock );
+        for( auto iter = s_rings.begin(); iter != s_rings.end(); )
+        {
+          ThreadRing    *ring = iter->get();
+          const uint64_t head = ring->head.load( std::memory_order_acquire );
+          uint64_t       tail = ring->tail.load( std::memory_order_relaxed );
+
+          for( ; tail != head; tail++ )
+          {
+            pending.push_back( ring->records[ tail & ( RING_DEPTH - 1 ) ] );
+          }
+          ring->tail.store( tail, std::memory_order_release );
+
+          if( ( iter->use_count() == 1 ) && ( tail == ring->head.load( std::memory_order_acquire ) ) )
+          {
+            iter = s_rings.erase( iter );
+          }
+          else
+          {
+            ++iter;
+          }
+        }
+      }
+
+      /*-----------------------------------------------------------------------
+      Emit everything old enough that no straggler can still precede it
+      -----------------------------------------------------------------------*/
+      std::stable_sort( pending.begin(), pending.end(),
+                        []( const Record &lhs, const Record &rhs ) { return lhs.time_us < rhs.time_us; } );
+
+      const int64_t horizon = final_pass ? INT64_MAX : ( mb::time::micros() - REORDER_WINDOW_US );
+
+      size_t emitted = 0;
+      for( ; ( emitted < pending.size() ) && ( pending[ emitted ].time_us < horizon ); emitted++ )
+      {
+        const Record &rec  = pending[ emitted ];
+        const int64_t time = std::max( rec.time_us, last_time );
+
+        if( time != last_time )
+        {
+          fprintf( file, "#%lld\n", static_cast<long long>( time ) );
+          last_time = time;
+        }
+
+        if( rec.kind == RecordKind::GPIO )
+        {
+          uint32_t changed = rec.a;
+          while( changed )
+          {
+            const size_t pin = static_cast<size_t>( __builtin_ctz( changed ) );
+            changed &= changed - 1;
+            fprintf( file, "%c%s\n", ( ( rec.b >> pin ) & 1u ) ? '1' : '0',
+                     ids[ rec.id * mb::hw::gpio::sim::PINS_PER_PORT + pin ].c_str() );
+          }
+        }
+        else
+        {
+          const size_t value_sig  = serial_signal( rec.id, rec.kind, false );
+          const size_t strobe_sig = serial_signal( rec.id, rec.kind, true );
+
+          write_byte_value( file, rec.a, ids[ value_sig ] );
+          strobes[ strobe_sig ] ^= 1u;
+          fprintf( file, "%c%s\n", strobes[ strobe_sig ] ? '1' : '0', ids[ strobe_sig ].c_str() );
+        }
+      }
+
+      pending.erase( pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>( emitted ) );
+
+      if( final_pass )
+      {
+        break;
+      }
+
+      std::this_thread::sleep_for( std::chrono::microseconds( WRITER_PERIOD_US ) );
+    }
+
+    fflush( file );
+  }
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  bool start( const std::string &path )
+  {
+    std::lock_guard<std::mutex> lock( s_control_lock );
+    if( s_file )
+    {
+      return false;
+    }
+
+    s_file = fopen( path.c_str(), "w" );
+    if( !s_file )
+    {
+      LOG_ERROR( "Unable to open VCD file %s", path.c_str() );
+      return false;
+    }
+
+    s_dropped.store( 0 );
+    s_writer_stop.store( false );
+    s_writer = std::thread( writer_thread, s_file, static_cast<int64_t>( mb::time::micros() ) );
+    g_enabled.store( true );
+    return true;
+  }
+
+
+  void stop()
+  {
+    std::lock_guard<std::mutex> lock( s_control_lock );
+    if( !s_file )
+    {
+      return;
+    }
+
+    g_enabled.store( false );
+    s_writer_stop.store( true );
+    if( s_writer.joinable() )
+    {
+      s_writer.join();
+    }
+
+    fclose( s_file );
+    s_file = nullptr;
+  }
+
+
+  uint64_t droppedRecords()
+  {
+    return s_dropped.load( std::memory_order_relaxed );
+  }
+
+
+  void recordGpio( const size_t port, const uint32_t changed, const uint32_t new_state )
+  {
+    push( thread_ring(), Record{ mb::time::micros(), changed, new_state, static_cast<uint16_t>( port ), RecordKind::GPIO } );
+  }
+
+
+  void recordSerial( const size_t channel, const Direction direction, const void *data, const size_t length )
+  {
+    if( channel >= MAX_SERIAL_CHANNELS )
+    {
+      return;
+    }
+
+    ThreadRing      *ring  = thread_ring();
+    const int64_t    now   = mb::time::micros();
+    const RecordKind kind  = ( direction == Direction::TX ) ? RecordKind::SERIAL_TX : RecordKind::SERIAL_RX;
+    const uint8_t   *bytes = static_cast<const uint8_t *>( data );
+
+    for( size_t idx = 0; idx < length; idx++ )
+    {
+      push( ring, Record{ now + static_cast<int64_t>( idx ), bytes[ idx ], 0, static_cast<uint16_t>( channel ), kind } );
+    }
+  }
+
+}    // namespace mb::hw::sim::vcd
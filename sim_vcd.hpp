@@ -0,0 +1,112 @@
+/******************************************************************************
+ *  File Name:
+ *    sim_vcd.hpp
+ *
+ *  Description:
+ *    Value Change Dump recorder of simulated GPIO and serial activity
+ *
+ *  2024 | Brandon Braun | brandonbraun653@protonmail.com
+ *****************************************************************************/
+
+#pragma once
+#ifndef MBEDUTILS_SIM_VCD_HPP
+#define MBEDUTILS_SIM_VCD_HPP
+
+/*-----------------------------------------------------------------------------
+Includes
+-----------------------------------------------------------------------------*/
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mb::hw::sim::vcd
+{
+  /*---------------------------------------------------------------------------
+  Constants
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Serial channels given signals in the dump. Higher channels are ignored.
+   */
+  static constexpr size_t MAX_SERIAL_CHANNELS = 8;
+
+  /*---------------------------------------------------------------------------
+  Enumerations
+  ---------------------------------------------------------------------------*/
+
+  enum class Direction : uint8_t
+  {
+    TX,
+    RX
+  };
+
+  /*---------------------------------------------------------------------------
+  Public Data
+  ---------------------------------------------------------------------------*/
+
+  extern std::atomic<bool> g_enabled;
+
+  /*---------------------------------------------------------------------------
+  Public Functions
+  ---------------------------------------------------------------------------*/
+
+  /**
+   * @brief Checks if a recording is in progress. Cheap enough for hot paths.
+   */
+  static inline bool enabled()
+  {
+    return g_enabled.load( std::memory_order_relaxed );
+  }
+
+  /**
+   * @brief Starts recording to a VCD file.
+   *
+   * Producers only append fixed-size records to a per-thread lock-free ring.
+   * A background writer merges the rings in timestamp order and streams the
+   * text out, so recording can stay on during throughput tests. Timestamps
+   * come from mb::time::micros(). Records are dropped, and counted, if a
+   * thread outruns the writer.
+   *
+   * @param path    File to write
+   * @return true   The file was opened and recording has started
+   */
+  bool start( const std::string &path );
+
+  /**
+   * @brief Stops recording, flushing everything captured so far to the file
+   */
+  void stop();
+
+  /**
+   * @brief Gets how many records were lost to full per-thread rings
+   *
+   * @return uint64_t
+   */
+  uint64_t droppedRecords();
+
+  /**
+   * @brief Records a change of a GPIO port's pin levels
+   *
+   * @param port        Port index
+   * @param changed     Pins that changed
+   * @param new_state   Port levels after the change
+   */
+  void recordGpio( const size_t port, const uint32_t changed, const uint32_t new_state );
+
+  /**
+   * @brief Records bytes moving over a serial channel.
+   *
+   * Bytes of one burst are laid out one microsecond apart, so each one
+   * shows up as its own value on the timeline.
+   *
+   * @param channel     Serial channel
+   * @param direction   Whether the bytes were sent or received
+   * @param data        Bytes moved
+   * @param length      Number of bytes
+   */
+  void recordSerial( const size_t channel, const Direction direction, const void *data, const size_t length );
+
+}    // namespace mb::hw::sim::vcd
+
+#endif /* !MBEDUTILS_SIM_VCD_HPP */